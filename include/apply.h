@@ -5,5 +5,12 @@
 #include <value.h>
 
 Value *apply(Value *fn, Value *args, Value **tco_expr, Environment **tco_env);
+/*
+ * Calls fn with argc arguments and returns its result. Compound fns bind
+ * the arguments directly instead of taking them from an argument list
+ * and are evaluated right away, which makes this the cheap way to call
+ * back into stutter from loops in C.
+ */
+Value *apply_call(Value *fn, size_t argc, Value **argv);
 
 #endif /* !APPLY_H */
@@ -0,0 +1,49 @@
+/*
+ * A hashtable for string keys that threads can read while another one
+ * writes to it, holding the bindings of the top-level environment.
+ *
+ * Lookups take no locks. Writers serialize on the interpreter's heap
+ * lock and never change what a reader may be looking at: a new key is
+ * linked in fully initialized at the head of its bucket, an update
+ * replaces the value of its entry atomically, and growing builds a new
+ * table next to the old one and swaps it in. The tables and nodes left
+ * behind go to the collector, which stops the other threads at their
+ * safepoints, never in the middle of a lookup.
+ */
+
+#ifndef __CMAP_H__
+#define __CMAP_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* shared by the nodes of all tables, so updates show in old ones too */
+typedef struct CMapEntry {
+    char *key;
+    unsigned long hash;
+    _Atomic(void *) value;
+} CMapEntry;
+
+typedef struct CMapNode {
+    CMapEntry *entry;
+    struct CMapNode *next;      /* never changes once linked */
+} CMapNode;
+
+typedef struct CMapTable {
+    size_t capacity;
+    _Atomic(CMapNode *) buckets[];
+} CMapTable;
+
+typedef struct CMap {
+    _Atomic(CMapTable *) table;
+    size_t size;                /* under the heap lock */
+} CMap;
+
+CMap *cmap_new(size_t n);
+
+void *cmap_get(CMap *map, char *key);
+/* cmap_get() for a key whose djb2 hash is already known */
+void *cmap_get_hashed(CMap *map, char *key, unsigned long hash);
+void cmap_put(CMap *map, char *key, void *value);
+
+#endif /* !__CMAP_H__ */
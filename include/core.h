@@ -12,37 +12,80 @@ typedef struct {
 extern CoreFn core_fns[];
 
 Value *core_add(const Value *args);
+Value *core_alts(const Value *args);
 Value *core_apply(const Value *args);
+/* the fn and spread argument list of an apply call, NULL on error */
+Value *core_apply_spread(const Value *args, Value **fn);
 Value *core_assert(const Value *args);
+Value *core_assoc_bang(const Value *args);
+Value *core_atom(const Value *args);
+Value *core_chan(const Value *args);
+Value *core_chan_put(const Value *args);
+Value *core_chan_take(const Value *args);
+Value *core_close(const Value *args);
+Value *core_comp(const Value *args);
+Value *core_compare_and_set_bang(const Value *args);
 Value *core_concat(const Value *args);
+Value *core_conj_bang(const Value *args);
 Value *core_cons(const Value *args);
 Value *core_count(const Value *args);
+Value *core_deliver(const Value *args);
+Value *core_deref(const Value *args);
 Value *core_div(const Value *args);
+Value *core_drop(const Value *args);
 Value *core_eq(const Value *args);
+Value *core_every(const Value *args);
+Value *core_filter(const Value *args);
 Value *core_first(const Value *args);
+Value *core_flush(const Value *args);
+Value *core_future_call(const Value *args);
 Value *core_geq(const Value *args);
 Value *core_gt(const Value *args);
+Value *core_into(const Value *args);
 Value *core_is_empty(const Value *args);
 Value *core_is_false(const Value *args);
+Value *core_is_keyword(const Value *args);
 Value *core_is_list(const Value *args);
 Value *core_is_nil(const Value *args);
+Value *core_is_realized(const Value *args);
 Value *core_is_symbol(const Value *args);
 Value *core_is_true(const Value *args);
+Value *core_iterate(const Value *args);
+Value *core_keyword(const Value *args);
 Value *core_leq(const Value *args);
+Value *core_line_seq(const Value *args);
 Value *core_list(const Value *args);
 Value *core_lt(const Value *args);
 Value *core_map(const Value *args);
 Value *core_mul(const Value *args);
 Value *core_nth(const Value *args);
+Value *core_partition_all(const Value *args);
+Value *core_persistent_bang(const Value *args);
+Value *core_pfold(const Value *args);
+Value *core_pmap(const Value *args);
 Value *core_pr(const Value *args);
 Value *core_pr_str(const Value *args);
+Value *core_preduce(const Value *args);
 Value *core_prn(const Value *args);
+Value *core_promise(const Value *args);
+Value *core_range(const Value *args);
+Value *core_read_line(const Value *args);
+Value *core_reduce(const Value *args);
+Value *core_remove(const Value *args);
+Value *core_reset_bang(const Value *args);
 Value *core_rest(const Value *args);
 Value *core_slurp(const Value *args);
+Value *core_some(const Value *args);
 Value *core_str(const Value *args);
 Value *core_sub(const Value *args);
+Value *core_subs(const Value *args);
+Value *core_swap_bang(const Value *args);
 Value *core_symbol(const Value *args);
+Value *core_take(const Value *args);
 Value *core_throw(const Value *args);
+Value *core_timeout(const Value *args);
+Value *core_transduce(const Value *args);
+Value *core_transient(const Value *args);
 
 /* utility functions */
 bool is_truthy(const Value *v);
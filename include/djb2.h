@@ -7,6 +7,10 @@
 #ifndef __DJB2_H__
 #define __DJB2_H__
 
+#include <stddef.h>
+
 unsigned long djb2(char *str);
+/* the same hash over n bytes that need not be NUL-terminated */
+unsigned long djb2_n(const char *str, size_t n);
 
 #endif /* !__DJB2_H__ */
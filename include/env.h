@@ -1,21 +1,47 @@
 #ifndef __ENV_H__
 #define __ENV_H__
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include "cmap.h"
 #include "map.h"
 
 struct Value;
 
 typedef struct Environment {
-    Map *map;
+    Map *map;                   /* created on the first env_set */
+    /* instead of map in the top-level env, read by all threads */
+    CMap *globals;
     struct Environment *parent;
+    /* loop frames bind their names to slots that recur overwrites */
+    char **slot_names;
+    struct Value **slots;
+    size_t nslots;
+    size_t slot_capacity;
+    /* reachable from a closure, lazy sequence or macro, see env_capture() */
+    bool captured;
 } Environment;
 
 Environment *env_new(Environment *parent);
+Environment *env_new_frame(Environment *parent, size_t nslots);
+void env_bind(Environment *env, char *symbol, const struct Value *value);
+/*
+ * Marks env and its parents as captured. Values that outlive the current
+ * evaluation, like closures, capture the environment they are created
+ * in; loops then give the next iteration a new frame instead of
+ * rebinding the captured one in place.
+ */
+void env_capture(Environment *env);
+/* a new frame with the parent and slot names of frame, bound to slots */
+Environment *env_rebind_frame(const Environment *frame, struct Value **slots);
 void env_delete(Environment *env);
 
 void env_set(Environment *env, char *symbol, const struct Value *value);
 struct Value *env_get(Environment *env, char *symbol);
+/* env_get() for a symbol whose djb2 hash is already known */
+struct Value *env_get_hashed(Environment *env, char *symbol, unsigned long hash);
+/* looks up a symbol value using the hash cached in its name */
+struct Value *env_lookup(Environment *env, const struct Value *symbol);
 bool env_contains(Environment *env, char *symbol);
 
 #endif /* !__ENV_H__ */
@@ -0,0 +1,19 @@
+#ifndef __FILEMAP_H__
+#define __FILEMAP_H__
+
+#include <stddef.h>
+
+/*
+ * Read-only memory mappings of whole files.
+ *
+ * The mapped contents are followed by at least one NUL byte, so they can
+ * be used as a C string. Pages are only read from disk when touched.
+ * Truncating the file while it is mapped makes accesses past the new end
+ * fault.
+ */
+
+/* maps size bytes of fd, or returns NULL and sets errno */
+char *filemap_open(int fd, size_t size);
+void filemap_close(char *data);
+
+#endif /* !__FILEMAP_H__ */
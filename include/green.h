@@ -0,0 +1,102 @@
+#ifndef __GREEN_H__
+#define __GREEN_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "interp.h"
+#include "value.h"
+
+/*
+ * Go blocks: lightweight tasks that communicate over channels and park,
+ * instead of blocking their thread, while a channel operation cannot
+ * complete.
+ *
+ * All go blocks of an interpreter run on the interpreter's own thread,
+ * one at a time, each on a stack of its own that is mapped when it
+ * starts and unmapped when it ends. Pages are only backed once used, so
+ * a parked go block costs about as much memory as it had stack in use,
+ * usually a few KB. The heap only collects while the interpreter's own
+ * code runs, and then scans the used part of the stacks of parked go
+ * blocks too (see HeapStack in interp.h).
+ *
+ * The interpreter's own code runs the go blocks whenever it waits on a
+ * channel. Go blocks and the interpreter's code also give way to each
+ * other at the yield points in eval, so long computations do not starve
+ * the rest.
+ */
+
+/* the stack of a go block, the lowest page guards against overflows */
+#define GREEN_STACK_SIZE (256 * 1024)
+/* evaluations between yield points */
+#define GREEN_YIELD_INTERVAL 4096
+
+typedef struct GreenTask {
+    ucontext_t ctx;
+    char *stack;                /* mapped when the go block starts */
+    HeapStack scan;             /* the part of stack the collector scans */
+    struct Value *fn;
+    struct Value *result;       /* the channel receiving the value of fn */
+    bool finished;
+    struct GreenTask *next;     /* in the run queue */
+    struct GreenTask *prev_started;
+    struct GreenTask *next_started;
+} GreenTask;
+
+/*
+ * A channel operation, or the operations of one alts!, waiting to
+ * complete. The first one that does sets done.
+ */
+typedef struct GreenAlt {
+    GreenTask *task;            /* NULL for the interpreter's own code */
+    bool done;
+    struct Value *value;        /* taken, or whether a put succeeded */
+    struct Value *chan;         /* the channel the operation completed on */
+} GreenAlt;
+
+typedef struct GreenWaiter {
+    GreenAlt *alt;
+    struct Value *value;        /* to put, NULL for takes */
+    struct GreenWaiter *next;
+} GreenWaiter;
+
+typedef struct GreenTimer {
+    struct timespec deadline;
+    struct Value *chan;         /* closed at the deadline */
+    struct GreenTimer *next;
+} GreenTimer;
+
+/* a put, or a take if value is NULL */
+typedef struct GreenOp {
+    struct Value *chan;
+    struct Value *value;
+} GreenOp;
+
+typedef struct Green {
+    pthread_t thread;
+    ucontext_t host;            /* the interpreter's own code */
+    GreenTask *current;         /* NULL while the host runs */
+    GreenTask *started;         /* until they finish, for the collector */
+    GreenTask *runq_head;
+    GreenTask *runq_tail;
+    GreenTimer *timers;         /* by deadline */
+} Green;
+
+/* queues (fn) to run as a go block, returns the channel receiving its value */
+struct Value *green_go(struct Value *fn);
+/* a channel that closes after ms milliseconds */
+struct Value *green_timeout(long ms);
+/*
+ * Completes the first operation in ops that can, parking or waiting
+ * until one can. Returns the value taken, or whether the put succeeded,
+ * and the channel in chan. NULL with a pending exception on failure.
+ */
+struct Value *green_alts(const GreenOp *ops, size_t n, struct Value **chan);
+void green_close(struct Value *chan);
+/* lets the other go blocks run, called from eval */
+void green_yield();
+
+#endif /* !__GREEN_H__ */
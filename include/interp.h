@@ -0,0 +1,157 @@
+#ifndef __INTERP_H__
+#define __INTERP_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "env.h"
+#include "gc.h"
+#include "map.h"
+
+struct Green;
+struct Pool;
+struct Value;
+
+/*
+ * Threads using a shared heap take blocks of the common sizes from the
+ * heap in bulk and hand them out without locking.
+ */
+#define HEAP_CACHE_CLASSES 5        /* blocks of 16, 32, 64, 128 and 256 bytes */
+#define HEAP_CACHE_REFILL 4096      /* bytes taken from the heap at once */
+/* a shared heap collects once this much was allocated, or the live size */
+#define HEAP_COLLECT_MIN (8 << 20)
+
+typedef struct HeapCache {
+    void **blocks[HEAP_CACHE_CLASSES];  /* root allocations, so the blocks stay */
+    size_t count[HEAP_CACHE_CLASSES];
+} HeapCache;
+
+/*
+ * A stack the root switches to besides its thread's own, such as the
+ * one of a go block. The collector scans the part in use while the root
+ * runs elsewhere, and only runs on the thread's own stack.
+ */
+typedef struct HeapStack {
+    char *top;                  /* the lowest address in use, when switched out */
+    char *bottom;
+    struct HeapStack *prev;
+    struct HeapStack *next;
+} HeapStack;
+
+/*
+ * The state of one interpreter: its heap, global environment, pending
+ * exception and interned keywords. Values never cross from one
+ * interpreter to another, so interpreters on different threads run
+ * without sharing anything but the constants (nil, true, false), which
+ * are never written.
+ *
+ * Each thread has a current interpreter. Threads that never entered one
+ * use the default interpreter, whose heap is the global `gc`.
+ *
+ * The worker threads of an interpreter's pool (see pool.h) run with
+ * interpreters of their own that keep a separate pending exception and
+ * allocation cache and share everything else with their root. Once the
+ * pool exists, the heap and the other shared state are guarded by the
+ * root's lock.
+ *
+ * A shared heap only collects on the root's thread, at its safepoints.
+ * The collector stops the other threads at theirs and scans copies of
+ * their stacks along with the root's own.
+ */
+typedef struct Interpreter {
+    GarbageCollector *gc;
+    GarbageCollector heap;          /* gc points here unless default */
+    Environment *env;
+    const struct Value *exc;
+    struct Interpreter *root;       /* the interpreter owning the heap */
+    /* the thread of the interpreter, on a shared heap */
+    unsigned locked;                /* how often it holds the heap lock */
+    HeapCache cache;
+    char *stack_bottom;             /* of the threads other than the root */
+    char *stack_top;                /* while stopped, under safepoint_lock */
+    struct Interpreter *next_thread;
+    /* the following are only used in the root */
+    Map *keywords;
+    struct Value *stdin_lines;
+    struct Pool *pool;
+    struct Green *green;            /* the go blocks, see green.h */
+    HeapStack *stacks;              /* see heap_stack_add() */
+    HeapStack *running;             /* NULL on the thread's own stack */
+    atomic_uint paused;             /* see heap_pause() */
+    bool shared;                    /* other threads use the heap */
+    pthread_mutex_t lock;           /* initialized once shared */
+    pthread_mutex_t safepoint_lock;
+    pthread_cond_t safepoint_changed;
+    struct Interpreter *threads;    /* attached, under safepoint_lock */
+    size_t n_threads;
+    size_t n_stopped;
+    atomic_bool collecting;
+    atomic_size_t allocated;        /* bytes since the last collection */
+    atomic_size_t live;             /* bytes left by the last collection */
+} Interpreter;
+
+/* the heap of the current interpreter, to start and stop it */
+#define HEAP (interp_current()->gc)
+
+/* starts a heap that scans the stack of the calling thread from bos */
+Interpreter *interp_new(void *bos);
+/* stops the pool and the heap, freeing everything allocated in the interpreter */
+void interp_delete(Interpreter *interp);
+
+Interpreter *interp_current();
+/* makes interp current for the calling thread, returns the previous one */
+Interpreter *interp_enter(Interpreter *interp);
+/* called on the root's thread before other threads use its heap */
+void interp_share(Interpreter *root);
+/*
+ * Lets the calling thread use the shared heap of interp's root, bos is
+ * the bottom of its stack as for interp_new. Detach before the thread
+ * exits.
+ */
+void interp_attach(Interpreter *interp, void *bos);
+void interp_detach(Interpreter *interp);
+
+/*
+ * Allocation from the current interpreter's heap, the gc_* functions of
+ * the same name that take the heap lock when the heap is shared.
+ */
+void *heap_malloc(size_t size);
+void *heap_malloc_ext(size_t size, void (*dtor)(void *));
+void *heap_calloc(size_t count, size_t size);
+void *heap_realloc(void *ptr, size_t size);
+void heap_free(void *ptr);
+char *heap_strdup(const char *s);
+void *heap_make_static(void *ptr);
+
+/* guards other state shared by the threads of an interpreter */
+void heap_lock();
+void heap_unlock();
+
+/*
+ * Where the calling thread lets the shared heap collect: the root
+ * collects if enough was allocated, other threads stop while it does.
+ */
+void heap_safepoint();
+/* collects the shared heap now, on the root's thread */
+void heap_collect();
+/*
+ * Defers all collections of the heap until the matching heap_resume(),
+ * for the root building a large structure that stays reachable anyway.
+ * Nests, and does nothing on the other threads.
+ */
+void heap_pause();
+void heap_resume();
+/*
+ * Makes the root's heap shared and scan stack whenever the root runs on
+ * another one, until it is removed. The caller keeps stack reachable
+ * meanwhile.
+ */
+void heap_stack_add(HeapStack *stack);
+void heap_stack_remove(HeapStack *stack);
+/* the root switches to stack, NULL for its thread's own */
+void heap_stack_switch(HeapStack *stack);
+/* pthread_cond_wait, letting the heap collect meanwhile */
+void heap_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+
+#endif /* !__INTERP_H__ */
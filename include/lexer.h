@@ -15,6 +15,7 @@ typedef enum {
     LEXER_TOK_QUASIQUOTE,
     LEXER_TOK_UNQUOTE,
     LEXER_TOK_SPLICE_UNQUOTE,
+    LEXER_TOK_KEYWORD,
     LEXER_TOK_EOF
 } TokenType;
 
@@ -41,25 +42,54 @@ typedef enum {
     LEXER_STATE_NUMBER,
     LEXER_STATE_FLOAT,
     LEXER_STATE_SYMBOL,
+    LEXER_STATE_KEYWORD,
     LEXER_STATE_STRING,
     LEXER_STATE_ESCAPESTRING,
     LEXER_STATE_UNQUOTE,
     LEXER_STATE_MINUS
 } LexerState;
 
+/*
+ * A token in buffer mode: a (offset, length) slice into the source buffer.
+ *
+ * For strings the slice covers the raw characters between the quotes,
+ * escape sequences are only decoded by lexer_slice_str().
+ */
+typedef struct {
+    TokenType type;
+    size_t offset;
+    size_t length;
+    size_t line;
+    size_t column;
+} LexerSlice;
+
 typedef struct {
     FILE *fp;
     LexerState state;
     size_t line_no;
     size_t char_no;
+    /* buffer mode */
+    const char *buf;
+    size_t size;
+    size_t pos;
+    size_t line_start;
 } Lexer;
 
 /* object lifecycle */
 Lexer *lexer_new(FILE *fp);
+Lexer *lexer_new_from_buffer(const char *buf, size_t size);
 void lexer_delete(Lexer *l);
 
 /* interface */
 LexerToken *lexer_get_token(Lexer *l);
 void lexer_delete_token(LexerToken *tok);
 
+/* buffer mode interface, does not allocate */
+void lexer_next_slice(Lexer *l, LexerSlice *tok);
+int lexer_slice_int(const Lexer *l, const LexerSlice *tok);
+double lexer_slice_float(const Lexer *l, const LexerSlice *tok);
+/* copies a string, symbol or keyword slice into dst (needs length + 1 bytes),
+ * keyword slices leave out the leading colon */
+size_t lexer_slice_str(const Lexer *l, const LexerSlice *tok, char *dst);
+
 #endif /* !__LEXER_H__ */
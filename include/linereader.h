@@ -0,0 +1,39 @@
+#ifndef __LINEREADER_H__
+#define __LINEREADER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Reads lines from a file descriptor through a large buffer.
+ *
+ * Lines are found with memchr over whole buffer fills and returned in
+ * place, so memory use is bounded by the buffer and the longest line,
+ * not by the size of the input.
+ */
+
+#define LINE_READER_BUFFER_SIZE (256 * 1024)
+
+typedef struct LineReader {
+    int fd;
+    char *data;
+    size_t start;     /* first byte of the next line */
+    size_t scanned;   /* bytes before this contain no newline after start */
+    size_t end;       /* end of the buffered input */
+    size_t capacity;
+    bool eof;
+    int error;        /* errno of a failed read, 0 otherwise */
+} LineReader;
+
+void line_reader_init(LineReader *r, int fd);
+/* frees the buffer, the file descriptor is left open */
+void line_reader_destroy(LineReader *r);
+
+/*
+ * Returns the next line without its "\n" or "\r\n" terminator, as a
+ * NUL-terminated string of *n bytes that is valid until the next call.
+ * Returns NULL at the end of input or if reading failed (r->error).
+ */
+char *line_reader_next(LineReader *r, size_t *n);
+
+#endif /* !__LINEREADER_H__ */
@@ -87,11 +87,11 @@ const struct Value *list_nth(const List *l, const size_t n);
 /**
  * Insert a value at the beginning of the list.
  *
- * This is an O(1) operation.
+ * This is an O(1) operation, the new list shares the items of `l`.
  *
  * @param l A list
  * @param value The value to prepend
- * @return A copy of `l` with `value` prepended.
+ * @return A new list with `value` followed by the items of `l`.
  *
  */
 const List *list_prepend(const List *l, const struct Value *value);
@@ -108,6 +108,49 @@ const List *list_prepend(const List *l, const struct Value *value);
  */
 const List *list_append(const List *l, const struct Value *value);
 
+/**
+ * Incremental construction of a new list.
+ *
+ * Appends in O(1) by keeping a pointer to the end of the list. The list
+ * is private to the builder until `list_builder_finish` hands it out, so
+ * it can be built in place instead of being copied on every append.
+ *
+ */
+typedef struct ListBuilder {
+    List *list;        /**< the list under construction */
+    ListItem **tail;   /**< pointer to the `next` field of the last item */
+} ListBuilder;
+
+/**
+ * Start building a new, empty list.
+ *
+ * @param b The builder to initialize
+ *
+ */
+void list_builder_init(ListBuilder *b);
+
+/**
+ * Append a value to the list under construction.
+ *
+ * This is an O(1) operation.
+ *
+ * @param b A builder
+ * @param value The value to append
+ *
+ */
+void list_builder_append(ListBuilder *b, const struct Value *value);
+
+/**
+ * Finish building a list.
+ *
+ * The builder must not be used after this call.
+ *
+ * @param b A builder
+ * @return The constructed list
+ *
+ */
+const List *list_builder_finish(ListBuilder *b);
+
 /**
  * Return the size of a list.
  *
@@ -25,6 +25,8 @@ Map *map_new(size_t n);
 void map_delete(Map *);
 
 void *map_get(Map *ht, char *key);
+/* map_get() for a key whose djb2 hash is already known */
+void *map_get_hashed(Map *ht, char *key, unsigned long hash);
 void map_put(Map *ht, char *key, void *value, size_t siz);
 void map_remove(Map *ht, char *key);
 void map_resize(Map *ht, size_t capacity);
@@ -0,0 +1,30 @@
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Conversions between numbers and their textual representation.
+ *
+ * The parsers accept the reader's number syntax, [-]digits[.digits] and
+ * -.digits, and take an explicit length so they can work directly on
+ * lexer slices.
+ *
+ * Floats are formatted as the shortest decimal that reads back as the
+ * same double (0.1 rather than 0.100000), in plain notation and always
+ * with a fractional part so that they read back as floats.
+ */
+
+/* sizes of output buffers that fit any value, including the NUL */
+#define NUMBER_INT_BUFSIZE 21
+#define NUMBER_FLOAT_BUFSIZE 352
+
+int number_parse_int(const char *s, size_t n);
+double number_parse_float(const char *s, size_t n);
+
+/* both write a NUL-terminated string and return its length */
+size_t number_format_int(int64_t value, char *buf);
+size_t number_format_float(double value, char *buf);
+
+#endif /* !__NUMBER_H__ */
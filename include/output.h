@@ -0,0 +1,46 @@
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "strbuf.h"
+
+/*
+ * Buffered program output.
+ *
+ * pr and prn print into a large userspace buffer in front of a file
+ * descriptor. When the buffer is written out depends on the flush
+ * policy: on a terminal every complete line appears immediately, on
+ * pipes and files output is only written when the buffer is full, on
+ * (flush), and at exit.
+ *
+ * An Output can be shared between threads. Every write goes into the
+ * buffer as one piece under its lock, so the output appears in the
+ * order the writes happened, whichever thread made them.
+ */
+typedef enum {
+    OUTPUT_FLUSH_LINE,   /* whenever the output contains a newline */
+    OUTPUT_FLUSH_BLOCK   /* whenever the buffer is full */
+} OutputFlushPolicy;
+
+typedef struct Output {
+    StrBuf buf;
+    OutputFlushPolicy policy;
+    pthread_mutex_t lock;
+} Output;
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/* picks the flush policy from isatty(fd) */
+void output_init(Output *out, int fd);
+void output_destroy(Output *out);
+
+/* appends n bytes from s and applies the flush policy */
+void output_write(Output *out, const char *s, size_t n);
+void output_flush(Output *out);
+
+/* program output on stdout, shared by all threads and flushed at exit */
+Output *output_stdout();
+
+#endif /* !__OUTPUT_H__ */
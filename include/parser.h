@@ -1,15 +1,71 @@
 #ifndef __PARSER_H__
 #define __PARSER_H__
 
+#include <stdbool.h>
 #include <stdio.h>
+#include "scan.h"
 #include "value.h"
 
 enum ParseResult {
     PARSER_FAIL,
-    PARSER_SUCCESS
+    PARSER_SUCCESS,
+    PARSER_EOF
 };
 typedef enum ParseResult ParseResult;
 
 ParseResult parser_parse(FILE *stream, Value **ast);
+ParseResult parser_parse_buffer(const char *buf, size_t size, Value **ast);
+
+/*
+ * Two-stage variant of parser_parse_buffer() for large inputs: a SIMD pass
+ * scans the buffer into a typed tape of tokens (see scan.h), PARSER_TAPE_WINDOW
+ * bytes ahead at a time, and the parser builds the values straight from the
+ * tape, without collecting meanwhile. Produces the same results as
+ * parser_parse_buffer(); worth it from about PARSER_BULK_THRESHOLD bytes.
+ */
+#define PARSER_BULK_THRESHOLD (64 * 1024)
+#define PARSER_TAPE_WINDOW (64 * 1024)
+ParseResult parser_parse_bulk(const char *buf, size_t size, Value **ast);
+
+/*
+ * Incremental reader for a stream of top-level forms.
+ *
+ * Reads from the stream only as far as needed to complete the next form,
+ * so programs can be evaluated form by form from files and pipes while
+ * only the current form is kept in memory. Regular files are read in
+ * batches of PARSER_STREAM_BATCH bytes that go through the two stages of
+ * parser_parse_bulk(). Once a batch holds PARSER_STREAM_PARALLEL bytes of
+ * complete forms, their values are built ahead on the interpreter's
+ * worker pool (see pool.h) and still handed out in order.
+ */
+#define PARSER_STREAM_CHUNK 4096
+#define PARSER_STREAM_BATCH (4 * 1024 * 1024)
+#define PARSER_STREAM_PARALLEL (256 * 1024)
+
+/* batch mode state for regular files, see parser.c */
+typedef struct ParserBatch ParserBatch;
+
+typedef struct {
+    FILE *fp;
+    char *buf;
+    size_t size;
+    size_t capacity;
+    size_t start;      /* first character of the current form */
+    size_t pos;        /* lines are counted up to here */
+    size_t line;       /* line number at pos */
+    size_t form_line;  /* line number at start */
+    /* form boundaries from the structural index of buf, see scan.h */
+    ScanIndex *index;
+    size_t next;       /* first entry not consumed */
+    int depth;
+    bool started;
+    bool eof;
+    ParserBatch *batch;
+} ParserStream;
+
+ParserStream *parser_stream_new(FILE *fp);
+void parser_stream_delete(ParserStream *ps);
+/* PARSER_EOF once the stream is exhausted */
+ParseResult parser_stream_next(ParserStream *ps, Value **ast);
 
 #endif /* !__PARSER_H__ */
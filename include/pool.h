@@ -0,0 +1,87 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "interp.h"
+
+/*
+ * A fixed pool of worker threads running tasks for one interpreter.
+ *
+ * Every worker has a deque of tasks. It pushes and pops the tasks it
+ * submits itself at the bottom and, when it runs dry, steals from the top
+ * of the other workers' deques. Threads outside the pool submit through
+ * a shared queue.
+ *
+ * The workers share the interpreter's heap, each with an allocation
+ * cache of its own. They stop for collections between tasks, at the
+ * yield points in eval and while they wait.
+ */
+#define POOL_MAX_WORKERS 64
+
+typedef struct PoolTask {
+    void (*run)(void *arg);
+    void *arg;
+    struct PoolTask *next;      /* in the shared queue */
+} PoolTask;
+
+typedef struct PoolBuffer {
+    long capacity;
+    struct PoolBuffer *prev;    /* replaced buffers, freed with the deque */
+    _Atomic(PoolTask *) items[];
+} PoolBuffer;
+
+/* a Chase-Lev deque: lock-free, one owner, any number of thieves */
+typedef struct PoolDeque {
+    _Atomic long top;
+    _Atomic long bottom;
+    _Atomic(PoolBuffer *) buffer;
+} PoolDeque;
+
+typedef struct PoolWorker {
+    struct Pool *pool;
+    pthread_t thread;
+    bool started;
+    PoolDeque deque;
+    unsigned seed;              /* picks whom to steal from */
+} PoolWorker;
+
+typedef struct Pool {
+    Interpreter *root;
+    PoolWorker *workers;
+    size_t n_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* signalled when a task is queued */
+    pthread_cond_t changed;     /* broadcast by pool_notify and on submit */
+    PoolTask *queue_head;       /* the shared queue, under lock */
+    PoolTask *queue_tail;
+    _Atomic long queued;        /* submitted and not taken yet */
+    bool stopping;
+} Pool;
+
+/*
+ * starts n_workers threads, or if n_workers is 0 as many as STUTTER_WORKERS
+ * says or one per core
+ */
+Pool *pool_new(Interpreter *root, size_t n_workers);
+/* stops the workers, dropping the tasks that did not run */
+void pool_delete(Pool *pool);
+
+void pool_submit(Pool *pool, void (*run)(void *), void *arg);
+/* runs a queued task on the calling thread, false if there was none */
+bool pool_help(Pool *pool);
+/* helps out until *done is set, then wakes up through pool_notify */
+void pool_wait(Pool *pool, atomic_bool *done);
+/* wakes up the threads in pool_wait to check their flags */
+void pool_notify(Pool *pool);
+/*
+ * The arguments of the tasks not taken yet, for the collector while the
+ * other threads are stopped. Stores them in args unless it is NULL,
+ * returns how many there are.
+ */
+size_t pool_pending(Pool *pool, void **args);
+
+#endif /* !__POOL_H__ */
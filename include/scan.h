@@ -0,0 +1,111 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Classifier state carried from one block into the next.
+ */
+typedef struct {
+    uint64_t escaped;   /* first byte of the next block is escaped */
+    uint64_t in_string; /* all ones if the block starts inside a string */
+    uint64_t in_atom;   /* last byte of the previous block belongs to an atom */
+    bool in_comment;
+} ScanState;
+
+/*
+ * Structural index of a source buffer.
+ *
+ * Holds the offsets of every position where the lexer would start a
+ * token, in ascending order: parens and quote characters, the first
+ * character of each atom, and both the opening and the closing quote of
+ * every string. Whitespace, comments and string contents are not indexed.
+ *
+ * The index is built in 64 byte blocks using SIMD classification where
+ * available (SSE2/AVX2 on x86-64) and a scalar fallback elsewhere. It can
+ * follow a buffer that grows at the end and drops consumed input at the
+ * front, rescanning at most the last incomplete block.
+ */
+typedef struct ScanIndex {
+    size_t *offsets;
+    size_t size;
+    size_t capacity;
+    size_t scanned;     /* bytes covered by complete blocks */
+    ScanState state;    /* at scanned */
+} ScanIndex;
+
+ScanIndex *scan_index_new();
+void scan_index_delete(ScanIndex *idx);
+
+void scan_index_build(ScanIndex *idx, const char *buf, size_t n);
+/* indexes the bytes buf grew by since the last build or extend to n */
+void scan_index_extend(ScanIndex *idx, const char *buf, size_t n);
+/*
+ * Follows the buffer dropping its first n <= scanned bytes. Returns the
+ * number of entries that went with them.
+ */
+size_t scan_index_drop(ScanIndex *idx, size_t n);
+
+/*
+ * Typed tape of a source buffer, one entry per token in source order.
+ *
+ * Built by the same block classifier as the index, but every entry
+ * carries its extent: the atom ends come out of the classifier along
+ * with the token starts, so nothing is rescanned byte by byte. Atoms
+ * (numbers, symbols and keywords) are runs of characters that are not
+ * whitespace, parens, quotes or comments; the parser tells them apart.
+ */
+typedef enum {
+    SCAN_LPAREN,
+    SCAN_RPAREN,
+    SCAN_QUOTE,
+    SCAN_QUASIQUOTE,
+    SCAN_UNQUOTE,
+    SCAN_SPLICE_UNQUOTE,
+    SCAN_STRING,          /* the characters between the quotes */
+    SCAN_ESCAPED_STRING,  /* the same, with escape sequences to decode */
+    SCAN_OPEN_STRING,     /* a string that runs to the end of the input */
+    SCAN_ATOM
+} ScanKind;
+
+typedef struct {
+    ScanKind kind;
+    size_t offset;
+    size_t length;
+} ScanToken;
+
+/*
+ * Like the index, the tape can follow a buffer that grows at the end and
+ * drops consumed input at the front. Only complete blocks are taken
+ * until scan_tape_finish() marks the end of the input, so the last
+ * token may still be open.
+ */
+typedef struct ScanTape {
+    ScanToken *tokens;
+    size_t size;
+    size_t capacity;
+    size_t open;        /* the atom or string still open, SIZE_MAX if none */
+    size_t scanned;     /* bytes covered by complete blocks */
+    ScanState state;    /* at scanned */
+} ScanTape;
+
+ScanTape *scan_tape_new();
+void scan_tape_delete(ScanTape *tape);
+
+/* the tape of the complete buffer */
+void scan_tape_build(ScanTape *tape, const char *buf, size_t n);
+/* adds the complete blocks the buffer grew by since the last call */
+void scan_tape_extend(ScanTape *tape, const char *buf, size_t n);
+/* adds the rest of the buffer of size n, which ends the input */
+void scan_tape_finish(ScanTape *tape, const char *buf, size_t n);
+/* forgets the first k tokens, which were consumed; offsets stay */
+void scan_tape_forget(ScanTape *tape, size_t k);
+/*
+ * Follows the buffer dropping its first n <= scanned bytes, which hold
+ * complete tokens only. Returns the number of tokens that went with them.
+ */
+size_t scan_tape_drop(ScanTape *tape, size_t n);
+
+#endif /* !__SCAN_H__ */
@@ -0,0 +1,35 @@
+#ifndef __STRBUF_H__
+#define __STRBUF_H__
+
+#include <stddef.h>
+
+/*
+ * A string builder.
+ *
+ * Appends are amortized O(1). A buffer created with strbuf_init_fd()
+ * does not grow; it writes its contents to the file descriptor whenever
+ * it fills up, so arbitrarily large output streams through a fixed
+ * amount of memory.
+ */
+typedef struct StrBuf {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int fd;  /* destination of a streaming buffer, -1 otherwise */
+} StrBuf;
+
+void strbuf_init(StrBuf *b);
+void strbuf_init_fd(StrBuf *b, int fd, size_t capacity);
+/* frees the buffer, a streaming buffer is flushed first */
+void strbuf_destroy(StrBuf *b);
+
+void strbuf_append(StrBuf *b, const char *s, size_t n);
+void strbuf_puts(StrBuf *b, const char *s);
+void strbuf_putc(StrBuf *b, char c);
+
+/* the contents as a NUL-terminated string, valid until the next append */
+const char *strbuf_cstr(StrBuf *b);
+/* writes the contents of a streaming buffer to its file descriptor */
+void strbuf_flush(StrBuf *b);
+
+#endif /* !__STRBUF_H__ */
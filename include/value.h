@@ -1,34 +1,53 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include <stdatomic.h>
+
 #include "array.h"
 #include "env.h"
 #include "gc.h"
 #include "list.h"
 #include "map.h"
+#include "strbuf.h"
 
+#define ATOM(v) (v->value.atom)
 #define BOOL(v) (v->value.bool_)
 #define BUILTIN_FN(v) (v->value.builtin_fn)
-#define EXCEPTION(v) (v->value.str)
+#define CHANNEL(v) (v->value.channel)
+#define EXCEPTION(v) (value_cstr(v))
 #define FLOAT(v) (v->value.float_)
 #define FN(v) (v->value.fn)
+#define FUTURE(v) (v->value.future)
 #define INT(v)  (v->value.int_)
+#define KEYWORD(v) (value_cstr(v))
+#define LAZY_SEQ(v) (v->value.lazy_seq)
 #define LIST(v) (v->value.list)
-#define STRING(v) (v->value.str)
-#define SYMBOL(v) (v->value.str)
+#define STREAM(v) (v->value.stream)
+#define STRING(v) (value_cstr(v))
+#define SYMBOL(v) (value_cstr(v))
+#define TRANSDUCER(v) (v->value.transducer)
+#define TRANSIENT(v) (v->value.transient)
 
 typedef enum {
+    VALUE_ATOM,
     VALUE_BOOL,
     VALUE_BUILTIN_FN,
+    VALUE_CHANNEL,
     VALUE_EXCEPTION,
     VALUE_FLOAT,
     VALUE_FN,
+    VALUE_FUTURE,
     VALUE_INT,
+    VALUE_KEYWORD,
+    VALUE_LAZY_SEQ,
     VALUE_LIST,
     VALUE_MACRO_FN,
     VALUE_NIL,
+    VALUE_STREAM,
     VALUE_STRING,
-    VALUE_SYMBOL
+    VALUE_SYMBOL,
+    VALUE_TRANSDUCER,
+    VALUE_TRANSIENT
 } ValueType;
 
 extern const char *value_type_names[];
@@ -39,21 +58,186 @@ typedef struct CompositeFunction {
     Environment *env;
 } CompositeFunction;
 
+/*
+ * A stream produces its elements on demand and can only be consumed
+ * once. next() returns NULL at the end, or NULL with a pending exception
+ * if producing an element failed.
+ */
+typedef struct Stream {
+    struct Value *(*next)(struct Stream *stream);
+    void *state;
+} Stream;
+
+/* elements realized at once by chunked lazy sequences */
+#define LAZY_SEQ_CHUNK_SIZE 32
+
+/*
+ * A lazy sequence is realized on first use into a chunk of elements
+ * followed by the rest of the sequence: nil, a list, a stream or another
+ * lazy sequence. An empty chunk simply continues with the rest.
+ *
+ * realize() fills in items, count and rest, and returns false with a
+ * pending exception if it failed. It passes cache on to everything it
+ * reads from. A pure sequence produces the same elements every time it
+ * is realized, so it can be realized again instead of being cached.
+ */
+typedef struct LazySeq {
+    bool (*realize)(struct LazySeq *seq, bool cache);
+    void *state;
+    bool pure;
+    bool realized;
+    struct Value **items;
+    size_t count;
+    struct Value *rest;
+} LazySeq;
+
+/*
+ * A transducer transforms the elements fed into a reduction, stage by
+ * stage, before they reach the reducing function. It holds no state of
+ * its own, so one transducer can drive any number of reductions.
+ */
+typedef enum {
+    XFORM_MAP,
+    XFORM_FILTER,
+    XFORM_REMOVE,
+    XFORM_TAKE,
+    XFORM_DROP,
+    XFORM_PARTITION_ALL
+} XformKind;
+
+typedef struct XformStage {
+    XformKind kind;
+    struct Value *fn;   /* map and filter */
+    long n;             /* take, drop and partition-all */
+} XformStage;
+
+typedef struct Transducer {
+    XformStage *stages;
+    size_t count;
+} Transducer;
+
+/*
+ * A future is computed by the worker pool, a promise is delivered by
+ * hand. deref blocks until the value, or the exception raised computing
+ * it, is there.
+ */
+typedef struct Future {
+    struct Value *fn;           /* NULL for promises */
+    atomic_bool delivered;      /* a value was claimed, set before done */
+    atomic_bool done;
+    struct Value *value;
+    const struct Value *exc;
+} Future;
+
+/*
+ * An atom is a reference that threads sharing the heap update without
+ * locks: swap! computes the new value from the current one and retries
+ * if another thread changed it meanwhile.
+ */
+typedef struct Atom {
+    _Atomic(struct Value *) value;
+} Atom;
+
+/*
+ * A channel passes values between go blocks, see green.h. Puts wait
+ * while its buffer is full, takes while it is empty. Without a buffer,
+ * every put waits for a take.
+ */
+typedef struct Channel {
+    struct Value **buf;         /* a ring of capacity values */
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+    struct GreenWaiter *takers;
+    struct GreenWaiter *takers_tail;
+    struct GreenWaiter *putters;
+    struct GreenWaiter *putters_tail;
+} Channel;
+
+/*
+ * The contents of strings, symbols, keywords and exceptions. They never
+ * change, so the length is stored and the hash computed on first use,
+ * by whichever threads get there first. Strings made from C strings keep
+ * their contents in the same allocation as the Value, right after the
+ * String.
+ *
+ * The collector only recognizes pointers to the start of an allocation,
+ * so neither the String nor the contents (STRING(), SYMBOL() and the
+ * like) keep a Value alive. Code using them holds on to the Value itself
+ * until it is done.
+ *
+ * A view shares part of the contents of another string, which owner keeps
+ * alive. It is not NUL-terminated in general, a C string of its own is
+ * copied from it the first time one is needed and kept in cstr. Threads
+ * asking at the same time all get the copy that was stored first.
+ */
+typedef struct String {
+    const char *data;
+    size_t length;
+    _Atomic(unsigned long) hash; /* djb2 of the contents, 0 until computed */
+    const struct Value *owner;  /* the string whose contents a view shares */
+    bool terminated;            /* data[length] is a NUL byte */
+    _Atomic(char *) cstr;       /* the C string of a view, NULL until needed */
+} String;
+
+/*
+ * A transient list is private to the code building it. Its items grow
+ * in place in a heap block, so conj! and assoc! take constant time, until
+ * persistent! turns them into an ordinary list. It cannot be used after
+ * that.
+ */
+typedef struct Transient {
+    struct Value **items;
+    size_t size;
+    size_t capacity;
+    bool persistent;
+} Transient;
+
 typedef struct Value {
     ValueType type;
+    /* a loop form whose body passed the recur check, see eval.c */
+    _Atomic(bool) checked;
     union {
         bool bool_;
         int int_;
         double float_;
-        char *str;
+        String *string;
         Array *vector;
         const List *list;
         Map *map;
         struct Value *(*builtin_fn)(const struct Value *);
         CompositeFunction *fn;
+        Stream *stream;
+        LazySeq *lazy_seq;
+        Transducer *transducer;
+        Transient *transient;
+        Future *future;
+        Channel *channel;
+        Atom *atom;
     } value;
 } Value;
 
+/*
+ * Walks nil, lists, lazy sequences and streams alike.
+ *
+ * A caching iterator realizes lazy sequences in place, like first and
+ * rest do. Without caching, unrealized pure sequences are realized into
+ * private copies instead, so walking a sequence whose head is still
+ * referenced, e.g. by an argument list, does not keep every element
+ * alive. Traversals of whole sequences use this to run in constant
+ * memory, at the price of producing the elements again on the next
+ * traversal.
+ */
+typedef struct SeqIter {
+    const ListItem *item;
+    size_t remaining;       /* items left in the current list */
+    const LazySeq *chunk;
+    size_t index;           /* next element of the current chunk */
+    struct Value *stream;
+    bool cache;
+} SeqIter;
+
 /*
  * constants
  */
@@ -65,25 +249,74 @@ extern  Value *VALUE_CONST_NIL;
  * functions
  */
 bool is_symbol(const Value *value);
+bool is_keyword(const Value *value);
 bool is_macro(const Value *value);
 bool is_list(const Value *value);
+bool is_stream(const Value *value);
+bool is_lazy_seq(const Value *value);
+/* nil, lists, lazy sequences and streams */
+bool is_seq(const Value *value);
 bool is_exception(const Value *value);
 Value *value_new_nil();
 Value *value_new_bool(const bool bool_);
 Value *value_new_exception(const char *str);
 Value *value_make_exception(const char *fmt, ...);
 Value *value_new_int(int int_);
-Value *value_new_float(float float_);
+Value *value_new_float(double float_);
 Value *value_new_builtin_fn(Value * (fn)(const Value *));
 Value *value_new_fn(Value *args, Value *body, Environment *env);
 Value *value_new_macro(Value *args, Value *body, Environment *env);
 Value *value_new_string(const char *str);
+Value *value_new_string_len(const char *str, size_t length);
+/* takes ownership of an already gc-allocated, NUL-terminated string */
+Value *value_new_string_nocopy(char *str, size_t length);
+/* wraps external string memory, released by dtor(value) on collection */
+Value *value_new_string_ext(char *str, size_t length, void (*dtor)(void *));
+/* the bytes [start, end) of a string, sharing its contents */
+Value *value_new_string_view(const Value *str, size_t start, size_t end);
 Value *value_new_symbol(const char *str);
+Value *value_new_symbol_len(const char *str, size_t length);
+/* keywords are interned, equal keywords are the same Value */
+Value *value_new_keyword(const char *name);
+Value *value_new_stream(Value * (*next)(Stream *), void *state);
+Value *value_new_lazy_seq(bool (*realize)(LazySeq *, bool), void *state, bool pure);
+/* an already realized lazy sequence, items followed by rest */
+Value *value_new_chunk(Value **items, size_t count, Value *rest);
+Value *value_new_transducer(XformStage *stages, size_t count);
+Value *value_new_transient(void);
+/* a future running fn, or a promise if fn is NULL */
+Value *value_new_future(Value *fn);
+Value *value_new_channel(size_t capacity);
+Value *value_new_atom(Value *value);
 Value *value_new_list(const List *l);
+/* takes a list nobody else modifies, e.g. a finished ListBuilder's */
+Value *value_new_list_nocopy(const List *l);
 Value *value_make_list(Value *v);
 Value *value_head(const Value *v);
+/* the contents of a string-like value as a C string */
+char *value_cstr(const Value *v);
+unsigned long string_hash(String *s);
+bool string_equal(String *a, String *b);
+/* <0, 0 or >0 like strcmp, but embedded NUL bytes compare as well */
+int string_compare(const String *a, const String *b);
 Value *value_tail(const Value *v);
 void value_delete(Value *v);
+
+/* realizes seq unless it already is, NULL with a pending exception on failure */
+LazySeq *lazy_seq_realize(LazySeq *seq, bool cache);
+
+void seq_iter_init(SeqIter *it, const Value *seq, bool cache);
+/* false at the end, or with a pending exception if producing failed */
+bool seq_iter_next(SeqIter *it, Value **v);
+/* true if the next element is available without realizing anything */
+bool seq_iter_buffered(const SeqIter *it);
+/* the elements the iterator has not returned yet, as a sequence */
+Value *seq_iter_rest(const SeqIter *it);
+/* the elements of a sequence as a list, only some of them if producing
+ * failed with a pending exception */
+const List *value_seq_list(const Value *seq, bool cache);
+/* appends the printed representation of v, as produced by str */
+void value_write(StrBuf *out, const Value *v);
 void value_print(const Value *v);
 
 
@@ -28,6 +28,27 @@ static Value *apply_builtin_fn(Value *fn, Value *args)
     return NULL;
 }
 
+static Value *apply_keyword(Value *keyword, Value *args)
+{
+    // (:k plist) or (:k plist default) looks k up in a list of
+    // alternating keys and values
+    const List *list = LIST(args);
+    if (list_size(list) != 1 && list_size(list) != 2) {
+        exc_set(value_make_exception("Keywords take one or two arguments"));
+        return NULL;
+    }
+    Value *plist = list_head(list);
+    if (is_list(plist)) {
+        for (const ListItem *item = LIST(plist)->head; item && item->next;
+                item = item->next->next) {
+            if (item->val == keyword) {
+                return (Value *) item->next->val;
+            }
+        }
+    }
+    return list_size(list) == 2 ? list_nth(list, 1) : VALUE_CONST_NIL;
+}
+
 static Value *apply_compound_fn(Value *fn, Value *args,
                                 Value **tco_expr, Environment **tco_env)
 {
@@ -53,7 +74,7 @@ static Value *apply_compound_fn(Value *fn, Value *args,
             if (!arg_value) {
                 break;
             }
-            env_set(env, arg_name->value.str, arg_value);
+            env_set(env, SYMBOL(arg_name), arg_value);
             arg_names = list_tail(arg_names);
             arg_values = list_tail(arg_values);
             arg_name = list_head(arg_names);
@@ -93,6 +114,8 @@ Value *apply(Value *fn, Value *args, Value **tco_expr, Environment **tco_env)
     *tco_env = NULL;
     if (is_builtin_fn(fn)) {
         return apply_builtin_fn(fn, args);
+    } else if (is_keyword(fn)) {
+        return apply_keyword(fn, args);
     } else if (is_compound_fn(fn)) {
         return apply_compound_fn(fn, args, tco_expr, tco_env);
     } else {
@@ -101,3 +124,58 @@ Value *apply(Value *fn, Value *args, Value **tco_expr, Environment **tco_env)
     }
 }
 
+
+Value *apply_call(Value *fn, size_t argc, Value **argv)
+{
+    if (!fn) {
+        LOG_CRITICAL("Apply requires a valid fn to apply");
+        return NULL;
+    }
+    if (is_builtin_fn(fn) || is_keyword(fn)) {
+        // builtins may hold on to their argument list, so it is fresh
+        ListBuilder args;
+        list_builder_init(&args);
+        for (size_t i = 0; i < argc; ++i) {
+            list_builder_append(&args, argv[i]);
+        }
+        Value *list = value_new_list_nocopy(list_builder_finish(&args));
+        return is_keyword(fn) ? apply_keyword(fn, list) : apply_builtin_fn(fn, list);
+    }
+    if (!is_compound_fn(fn) || !fn->value.fn) {
+        exc_set(value_make_exception("apply: not a function"));
+        return NULL;
+    }
+    Environment *env = env_new(fn->value.fn->env);
+    size_t i = 0;
+    const ListItem *param;
+    for (param = LIST(fn->value.fn->args)->head; param; param = param->next) {
+        const Value *name = param->val;
+        if (!is_symbol(name)) {
+            exc_set(value_make_exception("Parameter names must be symbols"));
+            return NULL;
+        }
+        if (strcmp(SYMBOL(name), "&") == 0) {
+            if (!param->next) {
+                exc_set(value_make_exception("Variadic arg list requires a name"));
+                return NULL;
+            }
+            ListBuilder more;
+            list_builder_init(&more);
+            for (; i < argc; ++i) {
+                list_builder_append(&more, argv[i]);
+            }
+            env_set(env, SYMBOL(param->next->val), value_new_list_nocopy(list_builder_finish(&more)));
+            param = NULL;
+            break;
+        }
+        if (i == argc) {
+            break;
+        }
+        env_set(env, SYMBOL(name), argv[i++]);
+    }
+    if (param || i != argc) {
+        exc_set(value_make_exception("Invalid number of arguments for compound fn"));
+        return NULL;
+    }
+    return eval(fn->value.fn->body, env);
+}
@@ -0,0 +1,97 @@
+#include "cmap.h"
+
+#include <string.h>
+
+#include "djb2.h"
+#include "interp.h"
+#include "primes.h"
+
+static CMapTable *cmap_table_new(size_t capacity)
+{
+    CMapTable *table = heap_malloc(sizeof(CMapTable)
+                                   + capacity * sizeof(_Atomic(CMapNode *)));
+    table->capacity = capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        atomic_init(&table->buckets[i], NULL);
+    }
+    return table;
+}
+
+/* links entry into table, visible to readers once this returns */
+static void cmap_link(CMapTable *table, CMapEntry *entry)
+{
+    _Atomic(CMapNode *) *bucket = &table->buckets[entry->hash % table->capacity];
+    CMapNode *node = heap_malloc(sizeof(CMapNode));
+    node->entry = entry;
+    node->next = atomic_load_explicit(bucket, memory_order_relaxed);
+    atomic_store_explicit(bucket, node, memory_order_release);
+}
+
+static CMapEntry *cmap_find(CMapTable *table, char *key, unsigned long hash)
+{
+    CMapNode *node = atomic_load_explicit(&table->buckets[hash % table->capacity],
+                                          memory_order_acquire);
+    for (; node; node = node->next) {
+        if (node->entry->hash == hash && strcmp(node->entry->key, key) == 0) {
+            return node->entry;
+        }
+    }
+    return NULL;
+}
+
+static void cmap_grow(CMap *map)
+{
+    CMapTable *old = atomic_load_explicit(&map->table, memory_order_relaxed);
+    CMapTable *table = cmap_table_new(next_prime(2 * old->capacity));
+    for (size_t i = 0; i < old->capacity; ++i) {
+        CMapNode *node = atomic_load_explicit(&old->buckets[i], memory_order_relaxed);
+        for (; node; node = node->next) {
+            cmap_link(table, node->entry);
+        }
+    }
+    // readers still in the old table find the same entries there
+    atomic_store_explicit(&map->table, table, memory_order_release);
+}
+
+CMap *cmap_new(size_t capacity)
+{
+    CMap *map = heap_malloc(sizeof(CMap));
+    atomic_init(&map->table, cmap_table_new(next_prime(capacity)));
+    map->size = 0;
+    return map;
+}
+
+void *cmap_get(CMap *map, char *key)
+{
+    return cmap_get_hashed(map, key, djb2(key));
+}
+
+void *cmap_get_hashed(CMap *map, char *key, unsigned long hash)
+{
+    CMapTable *table = atomic_load_explicit(&map->table, memory_order_acquire);
+    CMapEntry *entry = cmap_find(table, key, hash);
+    return entry ? atomic_load_explicit(&entry->value, memory_order_acquire) : NULL;
+}
+
+void cmap_put(CMap *map, char *key, void *value)
+{
+    unsigned long hash = djb2(key);
+    heap_lock();
+    CMapTable *table = atomic_load_explicit(&map->table, memory_order_relaxed);
+    CMapEntry *entry = cmap_find(table, key, hash);
+    if (entry) {
+        atomic_store_explicit(&entry->value, value, memory_order_release);
+        heap_unlock();
+        return;
+    }
+    entry = heap_malloc(sizeof(CMapEntry));
+    entry->key = heap_strdup(key);
+    entry->hash = hash;
+    atomic_init(&entry->value, value);
+    cmap_link(table, entry);
+    // grow at a load factor of 0.7, like Map
+    if (10 * ++map->size > 7 * table->capacity) {
+        cmap_grow(map);
+    }
+    heap_unlock();
+}
@@ -2,12 +2,22 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "apply.h"
 #include "eval.h"
 #include "exc.h"
+#include "filemap.h"
+#include "green.h"
+#include "interp.h"
+#include "linereader.h"
 #include "log.h"
+#include "number.h"
+#include "output.h"
+#include "pool.h"
 
 
 #define NARGS(args) list_size(LIST(args))
@@ -62,10 +72,18 @@ bool is_truthy(const Value *v)
     case VALUE_FLOAT:
     case VALUE_STRING:
     case VALUE_SYMBOL:
+    case VALUE_KEYWORD:
     case VALUE_LIST:
+    case VALUE_LAZY_SEQ:
     case VALUE_FN:
     case VALUE_MACRO_FN:
     case VALUE_BUILTIN_FN:
+    case VALUE_STREAM:
+    case VALUE_TRANSDUCER:
+    case VALUE_TRANSIENT:
+    case VALUE_FUTURE:
+    case VALUE_CHANNEL:
+    case VALUE_ATOM:
         return true;
     }
 }
@@ -107,32 +125,41 @@ Value *core_is_empty(const Value *args)
     CHECK_ARGLIST(args);
     REQUIRE_LIST_CARDINALITY(args, 1ul, "empty? requires exactly one parameter");
     Value *arg0 = ARG(args, 0);
+    if (is_lazy_seq(arg0)) {
+        SeqIter it;
+        seq_iter_init(&it, arg0, true);
+        Value *v;
+        if (seq_iter_next(&it, &v)) {
+            return VALUE_CONST_FALSE;
+        }
+        return exc_is_pending() ? NULL : VALUE_CONST_TRUE;
+    }
     REQUIRE_VALUE_TYPE(arg0, VALUE_LIST, "empty? requires a list type");
     return NARGS(arg0) == 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
 }
 
-static float acc_add(float acc, float x)
+static double acc_add(double acc, double x)
 {
     return acc + x;
 }
 
-static float acc_sub(float acc, float x)
+static double acc_sub(double acc, double x)
 {
     return acc - x;
 }
 
-static float acc_mul(float acc, float x)
+static double acc_mul(double acc, double x)
 {
     return acc * x;
 }
 
-static float acc_div(float acc, float x)
+static double acc_div(double acc, double x)
 {
     return acc / x;
 }
 
 
-static Value *core_acc(const Value *args, float (*acc_fn)(float, float))
+static Value *core_acc(const Value *args, double (*acc_fn)(double, double))
 {
     CHECK_ARGLIST(args);
     REQUIRE_LIST_CARDINALITY_GE(args, 1ul, "Require at least one argument");
@@ -140,12 +167,12 @@ static Value *core_acc(const Value *args, float (*acc_fn)(float, float))
     bool all_int = true;
     const List *list = args->value.list;
     Value *head = list_head(list);
-    float acc;
+    double acc;
     if (head->type == VALUE_FLOAT) {
         acc = head->value.float_;
         all_int = false;
     } else if (head->type == VALUE_INT) {
-        acc = (float) head->value.int_;
+        acc = (double) head->value.int_;
     } else {
         exc_set(value_make_exception("Non-numeric argument in accumulation"));
         return NULL;
@@ -156,7 +183,7 @@ static Value *core_acc(const Value *args, float (*acc_fn)(float, float))
             acc = acc_fn(acc, head->value.float_);
             all_int = false;
         } else if (head->type == VALUE_INT) {
-            acc = acc_fn(acc, (float) head->value.int_);
+            acc = acc_fn(acc, (double) head->value.int_);
         } else {
             exc_set(value_make_exception("Non-numeric argument in accumulation"));
             return NULL;
@@ -192,8 +219,40 @@ Value *core_div(const Value *args)
     return core_acc(args, acc_div);
 }
 
+static Value *cmp_eq(const Value *a, const Value *b);
+
+/* element-wise equality of lists and lazy sequences */
+static Value *cmp_seq_eq(const Value *a, const Value *b)
+{
+    SeqIter it_a, it_b;
+    seq_iter_init(&it_a, a, false);
+    seq_iter_init(&it_b, b, false);
+    Value *x, *y;
+    while (true) {
+        bool more_a = seq_iter_next(&it_a, &x);
+        if (exc_is_pending()) {
+            return NULL;
+        }
+        bool more_b = seq_iter_next(&it_b, &y);
+        if (exc_is_pending()) {
+            return NULL;
+        }
+        if (!more_a || !more_b) {
+            return more_a == more_b ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        }
+        Value *cmp_result = cmp_eq(x, y);
+        if (cmp_result != VALUE_CONST_TRUE) {
+            return cmp_result;  /* NULL or VALUE_CONST_FALSE */
+        }
+    }
+}
+
 static Value *cmp_eq(const Value *a, const Value *b)
 {
+    if ((is_lazy_seq(a) && (is_list(b) || is_lazy_seq(b)))
+            || (is_list(a) && is_lazy_seq(b))) {
+        return cmp_seq_eq(a, b);
+    }
     if (a->type == b->type) {
         switch(a->type) {
         case VALUE_NIL:
@@ -211,7 +270,10 @@ static Value *cmp_eq(const Value *a, const Value *b)
             return FLOAT(a) == FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_STRING:
         case VALUE_SYMBOL:
-            return strcmp(STRING(a), STRING(b)) == 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+            return string_equal(a->value.string, b->value.string) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_KEYWORD:
+            /* interned */
+            return a == b ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_BUILTIN_FN:
             /* For built-in functions we currently use identity == equality */
             return BUILTIN_FN(a) == BUILTIN_FN(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
@@ -219,6 +281,20 @@ static Value *cmp_eq(const Value *a, const Value *b)
         case VALUE_MACRO_FN:
             /* For composite  functions we currently use identity == equality */
             return FN(a) == FN(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_STREAM:
+            return STREAM(a) == STREAM(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_LAZY_SEQ:
+            return cmp_seq_eq(a, b);
+        case VALUE_TRANSDUCER:
+            return TRANSDUCER(a) == TRANSDUCER(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_TRANSIENT:
+            return TRANSIENT(a) == TRANSIENT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_FUTURE:
+            return FUTURE(a) == FUTURE(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_CHANNEL:
+            return CHANNEL(a) == CHANNEL(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_ATOM:
+            return ATOM(a) == ATOM(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_LIST:
             if (list_size(LIST(a)) == list_size(LIST(b))) {
                 /* empty lists can be equal */
@@ -243,9 +319,9 @@ static Value *cmp_eq(const Value *a, const Value *b)
             return VALUE_CONST_FALSE;
         }
     } else if (a->type == VALUE_INT && b->type == VALUE_FLOAT) {
-        return ((float) INT(a)) == FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(a)) == FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_INT && a->type == VALUE_FLOAT) {
-        return ((float) INT(b)) == FLOAT(a) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(b)) == FLOAT(a) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_NIL || a->type == VALUE_NIL) {
         /* nil can be compared to anything but will yield false unless compared
          * to itself */
@@ -274,20 +350,36 @@ static Value *cmp_lt(const Value *a, const Value *b)
             return FLOAT(a) < FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_STRING:
         case VALUE_SYMBOL:
-            return strcmp(STRING(a), STRING(b)) < 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_KEYWORD:
+            return string_compare(a->value.string, b->value.string) < 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_BUILTIN_FN:
         case VALUE_FN:
         case VALUE_MACRO_FN:
+        case VALUE_TRANSDUCER:
             exc_set(value_make_exception("Cannot order functions"));
             return NULL;
         case VALUE_LIST:
+        case VALUE_LAZY_SEQ:
+        case VALUE_TRANSIENT:
             exc_set(value_make_exception("Cannot order lists"));
             return NULL;
+        case VALUE_FUTURE:
+            exc_set(value_make_exception("Cannot order futures"));
+            return NULL;
+        case VALUE_CHANNEL:
+            exc_set(value_make_exception("Cannot order channels"));
+            return NULL;
+        case VALUE_ATOM:
+            exc_set(value_make_exception("Cannot order atoms"));
+            return NULL;
+        case VALUE_STREAM:
+            exc_set(value_make_exception("Cannot order streams"));
+            return NULL;
         }
     } else if (a->type == VALUE_INT && b->type == VALUE_FLOAT) {
-        return ((float) INT(a)) < FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(a)) < FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_INT && a->type == VALUE_FLOAT) {
-        return FLOAT(a) < ((float) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return FLOAT(a) < ((double) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     }
     exc_set(value_make_exception("Cannot compare incompatible types"));
     return NULL;
@@ -312,20 +404,36 @@ static Value *cmp_leq(const Value *a, const Value *b)
             return FLOAT(a) <= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_STRING:
         case VALUE_SYMBOL:
-            return strcmp(STRING(a), STRING(b)) <= 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_KEYWORD:
+            return string_compare(a->value.string, b->value.string) <= 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_BUILTIN_FN:
         case VALUE_FN:
         case VALUE_MACRO_FN:
+        case VALUE_TRANSDUCER:
             exc_set(value_make_exception("Cannot order functions"));
             return NULL;
         case VALUE_LIST:
+        case VALUE_LAZY_SEQ:
+        case VALUE_TRANSIENT:
             exc_set(value_make_exception("Cannot order lists"));
             return NULL;
+        case VALUE_FUTURE:
+            exc_set(value_make_exception("Cannot order futures"));
+            return NULL;
+        case VALUE_CHANNEL:
+            exc_set(value_make_exception("Cannot order channels"));
+            return NULL;
+        case VALUE_ATOM:
+            exc_set(value_make_exception("Cannot order atoms"));
+            return NULL;
+        case VALUE_STREAM:
+            exc_set(value_make_exception("Cannot order streams"));
+            return NULL;
         }
     } else if (a->type == VALUE_INT && b->type == VALUE_FLOAT) {
-        return ((float) INT(a)) <= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(a)) <= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_INT && a->type == VALUE_FLOAT) {
-        return FLOAT(a) <= ((float) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return FLOAT(a) <= ((double) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     }
     exc_set(value_make_exception("Cannot compare incompatible types"));
     return NULL;
@@ -350,20 +458,36 @@ static Value *cmp_gt(const Value *a, const Value *b)
             return FLOAT(a) > FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_STRING:
         case VALUE_SYMBOL:
-            return strcmp(STRING(a), STRING(b)) > 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_KEYWORD:
+            return string_compare(a->value.string, b->value.string) > 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_BUILTIN_FN:
         case VALUE_FN:
         case VALUE_MACRO_FN:
+        case VALUE_TRANSDUCER:
             exc_set(value_make_exception("Cannot order functions"));
             return NULL;
         case VALUE_LIST:
+        case VALUE_LAZY_SEQ:
+        case VALUE_TRANSIENT:
             exc_set(value_make_exception("Cannot order lists"));
             return NULL;
+        case VALUE_FUTURE:
+            exc_set(value_make_exception("Cannot order futures"));
+            return NULL;
+        case VALUE_CHANNEL:
+            exc_set(value_make_exception("Cannot order channels"));
+            return NULL;
+        case VALUE_ATOM:
+            exc_set(value_make_exception("Cannot order atoms"));
+            return NULL;
+        case VALUE_STREAM:
+            exc_set(value_make_exception("Cannot order streams"));
+            return NULL;
         }
     } else if (a->type == VALUE_INT && b->type == VALUE_FLOAT) {
-        return ((float) INT(a)) > FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(a)) > FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_INT && a->type == VALUE_FLOAT) {
-        return FLOAT(a) > ((float) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return FLOAT(a) > ((double) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     }
     exc_set(value_make_exception("Cannot compare incompatible types"));
     return NULL;
@@ -388,20 +512,36 @@ static Value *cmp_geq(const Value *a, const Value *b)
             return FLOAT(a) >= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_STRING:
         case VALUE_SYMBOL:
-            return strcmp(STRING(a), STRING(b)) >= 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        case VALUE_KEYWORD:
+            return string_compare(a->value.string, b->value.string) >= 0 ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
         case VALUE_BUILTIN_FN:
         case VALUE_FN:
         case VALUE_MACRO_FN:
+        case VALUE_TRANSDUCER:
             exc_set(value_make_exception("Cannot order functions"));
             return NULL;
         case VALUE_LIST:
+        case VALUE_LAZY_SEQ:
+        case VALUE_TRANSIENT:
             exc_set(value_make_exception("Cannot order lists"));
             return NULL;
+        case VALUE_FUTURE:
+            exc_set(value_make_exception("Cannot order futures"));
+            return NULL;
+        case VALUE_CHANNEL:
+            exc_set(value_make_exception("Cannot order channels"));
+            return NULL;
+        case VALUE_ATOM:
+            exc_set(value_make_exception("Cannot order atoms"));
+            return NULL;
+        case VALUE_STREAM:
+            exc_set(value_make_exception("Cannot order streams"));
+            return NULL;
         }
     } else if (a->type == VALUE_INT && b->type == VALUE_FLOAT) {
-        return ((float) INT(a)) >= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return ((double) INT(a)) >= FLOAT(b) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     } else if (b->type == VALUE_INT && a->type == VALUE_FLOAT) {
-        return FLOAT(a) >= ((float) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
+        return FLOAT(a) >= ((double) INT(b)) ? VALUE_CONST_TRUE : VALUE_CONST_FALSE;
     }
     exc_set(value_make_exception("Cannot compare incompatible types"));
     return NULL;
@@ -454,92 +594,34 @@ Value *core_geq(const Value *args)
 }
 
 
-static char *str_append(char *str, size_t n_str, char *partial, size_t n_partial)
+/* false if realizing a lazy sequence failed with a pending exception */
+static bool core_str_write(StrBuf *out, const Value *args, bool printable)
 {
-    str = realloc(str, n_str + n_partial + 1);
-    strncat(str, partial, n_partial);
-    return str;
-}
+    if (!args)
+        return true;
 
-static char *core_str_inner(char *str, const Value *v)
-{
-    char *partial;
-    switch(v->type) {
-    case VALUE_NIL:
-        str = str_append(str, strlen(str), "nil", 3);
-        break;
-    case VALUE_BOOL:
-        partial = BOOL(v) ? "true" : "false";
-        str = str_append(str, strlen(str), partial, strlen(partial));
-        break;
-    case VALUE_INT:
-        asprintf(&partial, "%d", INT(v));
-        str = str_append(str, strlen(str), partial, strlen(partial));
-        free(partial);
-        break;
-    case VALUE_FLOAT:
-        asprintf(&partial, "%f", FLOAT(v));
-        str = str_append(str, strlen(str), partial, strlen(partial));
-        free(partial);
-        break;
-    case VALUE_STRING:
-    case VALUE_SYMBOL:
-    case VALUE_EXCEPTION:
-        asprintf(&partial, "%s", STRING(v));
-        str = str_append(str, strlen(str), partial, strlen(partial));
-        free(partial);
-        break;
-    case VALUE_LIST:
-        str = str_append(str, strlen(str), "(", 1);
-        Value *head2;
-        const List *tail2 = v->value.list;
-        while((head2 = list_head(tail2)) != NULL) {
-            str = core_str_inner(str, head2);
-            tail2 = list_tail(tail2);
-            if (list_head(tail2)) {
-                str = str_append(str, strlen(str), " ", 1);
+    if (args->type == VALUE_LIST) {
+        for (ListItem *item = LIST(args)->head; item; item = item->next) {
+            value_write(out, item->val);
+            if (printable) {
+                strbuf_putc(out, ' ');
             }
         }
-        str = str_append(str, strlen(str), ")", 1);
-        break;
-    case VALUE_FN:
-    case VALUE_MACRO_FN:
-        str = str_append(str, strlen(str), "(lambda ", 8);
-        str = core_str_inner(str, FN(v)->args);
-        str = str_append(str, strlen(str), " ", 1);
-        str = core_str_inner(str, FN(v)->body);
-        str = str_append(str, strlen(str), ")", 1);
-        break;
-    case VALUE_BUILTIN_FN:
-        asprintf(&partial, "#<builtin_fn@%p>", (void *) v->value.builtin_fn);
-        str = str_append(str, strlen(str), partial, strlen(partial));
-        free(partial);
-        break;
+    } else {
+        value_write(out, args);
     }
-    return str;
+    return !exc_is_pending();
 }
 
 Value *core_str_outer(const Value *args, bool printable)
 {
-    if (!args)
-        return value_new_string("");
-
-    char *str = calloc(1, sizeof(char));
-    if (args->type == VALUE_LIST) {
-        const List *list = LIST(args);
-        Value *head;
-        while ((head = list_head(list)) != NULL) {
-            str = core_str_inner(str, head);
-            list = list_tail(list);
-            if (printable) {
-                str = str_append(str, strlen(str), " ", 1);
-            }
-        }
-    } else {
-        str = core_str_inner(str, args);
+    StrBuf out;
+    strbuf_init(&out);
+    Value *ret = NULL;
+    if (core_str_write(&out, args, printable)) {
+        ret = value_new_string_len(out.data, out.size);
     }
-    Value *ret = value_new_string(str);
-    free(str);
+    strbuf_destroy(&out);
     return ret;
 }
 
@@ -548,11 +630,55 @@ Value *core_str(const Value *args)
     return core_str_outer(args, false);
 }
 
+Value *core_subs(const Value *args)
+{
+    // (subs s start) or (subs s start end), sharing the contents of s
+    CHECK_ARGLIST(args);
+    if (NARGS(args) != 2 && NARGS(args) != 3) {
+        exc_set(value_make_exception("subs takes two or three arguments"));
+        return NULL;
+    }
+    Value *str = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(str, VALUE_STRING, "First argument to subs must be a string");
+    Value *start = ARG(args, 1);
+    REQUIRE_VALUE_TYPE(start, VALUE_INT, "Second argument to subs must be an integer");
+    size_t length = str->value.string->length;
+    long end = (long) length;
+    if (NARGS(args) == 3) {
+        Value *v = ARG(args, 2);
+        REQUIRE_VALUE_TYPE(v, VALUE_INT, "Third argument to subs must be an integer");
+        end = INT(v);
+    }
+    if (INT(start) < 0 || INT(start) > end || end > (long) length) {
+        exc_set(value_make_exception("Index error"));
+        return NULL;
+    }
+    return value_new_string_view(str, (size_t) INT(start), (size_t) end);
+}
+
+/*
+ * Renders the whole output first and hands it to stdout in one write, so
+ * a print can not interleave with prints on other threads and a print
+ * that fails halfway writes nothing.
+ */
+static Value *core_print(const Value *args, bool newline)
+{
+    StrBuf b;
+    strbuf_init(&b);
+    bool ok = core_str_write(&b, args, true);
+    if (ok && newline) {
+        strbuf_putc(&b, '\n');
+    }
+    if (ok && b.size > 0) {
+        output_write(output_stdout(), b.data, b.size);
+    }
+    strbuf_destroy(&b);
+    return ok ? VALUE_CONST_NIL : NULL;
+}
+
 Value *core_pr(const Value *args)
 {
-    Value *str = core_str_outer(args, true);
-    fprintf(stdout, "%s", str->value.str);
-    return VALUE_CONST_NIL;
+    return core_print(args, false);
 }
 
 
@@ -564,10 +690,14 @@ Value *core_pr_str(const Value *args)
 
 Value *core_prn(const Value *args)
 {
-    Value *str = core_str_outer(args, true);
-    fprintf(stdout, "%s", str->value.str);
-    fprintf(stdout, "\n");
-    fflush(stdout);
+    return core_print(args, true);
+}
+
+Value *core_flush(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 0ul, "flush takes no arguments");
+    output_flush(output_stdout());
     return VALUE_CONST_NIL;
 }
 
@@ -579,256 +709,1827 @@ Value *core_count(const Value *args)
     if (is_nil(list)) {
         return value_new_int(0);
     }
+    if (is_lazy_seq(list) || is_stream(list)) {
+        SeqIter it;
+        seq_iter_init(&it, list, false);
+        Value *v;
+        int n = 0;
+        while (seq_iter_next(&it, &v)) {
+            n++;
+        }
+        return exc_is_pending() ? NULL : value_new_int(n);
+    }
+    if (list->type == VALUE_TRANSIENT && !TRANSIENT(list)->persistent) {
+        return value_new_int((int) TRANSIENT(list)->size);
+    }
+    if (list->type == VALUE_STRING) {
+        return value_new_int((int) list->value.string->length);
+    }
     REQUIRE_VALUE_TYPE(list, VALUE_LIST, "count requires a list argument");
     return value_new_int(NARGS(list));
 }
 
+/* files at least this big are mapped rather than read */
+#define SLURP_MMAP_THRESHOLD (64 * 1024)
+
+static void core_slurp_unmap(void *ptr)
+{
+    Value *v = ptr;
+    filemap_close(STRING(v));
+}
+
 Value *core_slurp(const Value *args)
 {
     CHECK_ARGLIST(args);
     REQUIRE_LIST_CARDINALITY(args, 1ul, "slurp takes exactly one argument");
-    // This is not for binary streams since we're using ftell.
-    // (It's portable, though)
     Value *v = ARG(args, 0);
     REQUIRE_VALUE_TYPE(v, VALUE_STRING, "slurp takes a string argument");
     Value *retval = NULL;
-    FILE *f = NULL;
-    if (!(f = fopen(STRING(v), "r"))) {
+    int fd = open(STRING(v), O_RDONLY);
+    if (fd < 0) {
         exc_set(value_make_exception("Failed to open file %s: %s", STRING(v), strerror(errno)));
         goto out;
     }
-    int ret;
-    if ((ret = fseek(f, 0L, SEEK_END)) != 0) {
-        exc_set(value_make_exception("Failed to determine file size for %s: %s",
-                                     STRING(v), strerror(errno)));
-        goto out_file;
-    }
-    long fsize;
-    if ((fsize = ftell(f)) < 0) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
         exc_set(value_make_exception("Failed to determine file size for %s: %s",
                                      STRING(v), strerror(errno)));
         goto out_file;
     }
-    char *buf = malloc(fsize + 1);
-    if ((ret = fseek(f, 0L, SEEK_SET)) != 0) {
-        exc_set(value_make_exception("Failed to read file %s", STRING(v)));
-        goto out_buf;
+    bool regular = S_ISREG(st.st_mode);
+    if (regular && st.st_size >= SLURP_MMAP_THRESHOLD) {
+        // the string references the mapping, the collector unmaps it
+        char *data = filemap_open(fd, (size_t) st.st_size);
+        if (data) {
+            retval = value_new_string_ext(data, (size_t) st.st_size, core_slurp_unmap);
+            goto out_file;
+        }
+        // fall back to reading, e.g. on file systems without mmap
     }
-    size_t n_read;
-    if ((n_read = fread(buf, 1, fsize, f)) < (size_t) fsize)   {
-        exc_set(value_make_exception("Failed to read file %s", STRING(v)));
-        goto out_buf;
+    // pipes and the like have no size, so the buffer grows as needed; a
+    // regular file fits with room to see EOF without growing
+    size_t capacity = regular ? (size_t) st.st_size + 2 : 4096;
+    char *buf = heap_malloc(capacity);
+    size_t size = 0;
+    while (true) {
+        if (size + 1 == capacity) {
+            capacity *= 2;
+            buf = heap_realloc(buf, capacity);
+        }
+        ssize_t n = read(fd, buf + size, capacity - size - 1);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            exc_set(value_make_exception("Failed to read file %s: %s",
+                                         STRING(v), strerror(errno)));
+            heap_free(buf);
+            goto out_file;
+        }
+        size += (size_t) n;
     }
-    buf[fsize] = '\0';
-    retval = value_new_string(buf); // FIXME: fx value constructors to avoid copy
-out_buf:
-    free(buf);
+    buf[size] = '\0';
+    retval = value_new_string_nocopy(buf, size);
 out_file:
-    fclose(f);
+    close(fd);
 out:
     return retval;
 }
 
 
-Value *core_cons(const Value *args)
-{
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 2ul, "CONS takes exactly two arguments");
-    Value *first = ARG(args, 0);
-    Value *second = ARG(args, 1);
-    REQUIRE_VALUE_TYPE(second, VALUE_LIST, "the second parameter to CONS must be a list");
-    return value_new_list(list_prepend(LIST(second), first));
-}
+/*
+ * Line streams
+ */
+typedef struct {
+    LineReader reader;
+    bool owned;  /* close the file descriptor when done */
+    bool done;
+} CoreLines;
 
-Value *core_concat(const Value *args)
+static void core_lines_close(CoreLines *lines)
 {
-    CHECK_ARGLIST(args);
-    const List *concat = list_new();
-    for (const ListItem *i = LIST(args)->head; i != NULL; i = i->next) {
-        Value *v = i->val;
-        REQUIRE_VALUE_TYPE(v, VALUE_LIST, "all parameters to CONCAT must be lists");
-        for (const ListItem *j = LIST(v)->head; j != NULL; j = j->next) {
-            concat = list_append(concat, j->val);
+    if (!lines->done) {
+        line_reader_destroy(&lines->reader);
+        if (lines->owned) {
+            close(lines->reader.fd);
         }
+        lines->done = true;
     }
-    return value_new_list(concat);
 }
 
-Value *core_map(const Value *args)
+static void core_lines_release(void *ptr)
 {
-    /* (map f '(a b c ...)) */
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 2ul, "MAP takes exactly two parameters");
-    Value *fn = ARG(args, 0);
-    Value *fn_args = ARG(args, 1);
+    core_lines_close(ptr);
+}
 
-    REQUIRE_VALUE_TYPE(fn_args, VALUE_LIST, "The second parameter to MAP must be a list");
-    const List *mapped = list_new();
-    Value *tco_expr = NULL;
-    Environment *tco_env;
-    for (size_t i = 0; i < list_size(LIST(fn_args)); ++i) {
-        Value *result = apply(fn, value_make_list(ARG(fn_args, i)),
-                              &tco_expr, &tco_env);
-        /* apply() may defer to eval() because of TCO support, we
-         * need to catch that and eval the expression */
-        if (tco_expr && !exc_is_pending()) {
-            result = eval(tco_expr, tco_env);
-        }
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
-        }
-        mapped = list_append(mapped, result);
+static Value *core_lines_next(Stream *stream)
+{
+    CoreLines *lines = stream->state;
+    if (lines->done) {
+        return NULL;
     }
-    return value_new_list(mapped);
+    size_t n;
+    char *line = line_reader_next(&lines->reader, &n);
+    if (line) {
+        return value_new_string_len(line, n);
+    }
+    int error = lines->reader.error;
+    // release the file as soon as it is exhausted, not when collected
+    core_lines_close(lines);
+    if (error) {
+        exc_set(value_make_exception("Failed to read line: %s", strerror(error)));
+    }
+    return NULL;
 }
 
-Value *core_apply(const Value *args)
+static Value *core_lines_new(int fd, bool owned)
 {
-    /* (apply f a b c d ...) == (f a b c d ...) */
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY_GE(args, 2ul, "APPLY requires at least two arguments");
-    Value *fn = ARG(args, 0);
-    Value *fn_args = value_new_list(list_tail(LIST(args)));
-    size_t n_args = NARGS(fn_args);
+    CoreLines *lines = heap_malloc_ext(sizeof(CoreLines), core_lines_release);
+    line_reader_init(&lines->reader, fd);
+    lines->owned = owned;
+    lines->done = false;
+    return value_new_stream(core_lines_next, lines);
+}
 
-    /* The last argument may be a list; if it is, we need to prepend
-     * the other args to that list to yield the final list of arguments */
-    if (n_args > 0 && is_list(ARG(fn_args, n_args - 1))) {
-        const List *concat = list_dup(LIST(ARG(fn_args, n_args - 1)));
-        for (size_t i = 0; i < (n_args - 1); ++i) {
-            concat = list_prepend(concat, ARG(fn_args, i));
-        }
-        fn_args = value_new_list(concat);
+/* stdin is shared by line-seq and read-line so that no input is lost */
+static Value *core_stdin_lines()
+{
+    Interpreter *interp = interp_current()->root;
+    heap_lock();
+    if (!interp->stdin_lines) {
+        interp->stdin_lines = core_lines_new(STDIN_FILENO, false);
+        heap_make_static(interp->stdin_lines);
     }
-    Value *tco_expr;
-    Environment *tco_env;
-    Value *result = apply(fn, fn_args, &tco_expr, &tco_env);
-    /* need to call eval since apply defers to eval for TCO support */
-    if (tco_expr && !exc_is_pending()) {
-        result = eval(tco_expr, tco_env);
+    heap_unlock();
+    return interp->stdin_lines;
+}
+
+Value *core_line_seq(const Value *args)
+{
+    /* (line-seq) or (line-seq "path") */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) == 0) {
+        return core_stdin_lines();
     }
-    if (!result) {
-        assert(exc_is_pending());
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "line-seq takes at most one argument");
+    Value *path = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(path, VALUE_STRING, "line-seq takes a string argument");
+    int fd = open(STRING(path), O_RDONLY);
+    if (fd < 0) {
+        exc_set(value_make_exception("Failed to open file %s: %s", STRING(path), strerror(errno)));
         return NULL;
     }
-    return result;
+    return core_lines_new(fd, true);
 }
 
-Value *core_is_nil(const Value *args)
+Value *core_read_line(const Value *args)
 {
+    /* (read-line) reads from stdin, (read-line s) from a line-seq */
     CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "NIL? takes exactly one argument");
-    Value *expr = ARG(args, 0);
-    return value_new_bool(is_nil(expr));
+    Value *stream;
+    if (NARGS(args) == 0) {
+        stream = core_stdin_lines();
+    } else {
+        REQUIRE_LIST_CARDINALITY(args, 1ul, "read-line takes at most one argument");
+        stream = ARG(args, 0);
+        REQUIRE_VALUE_TYPE(stream, VALUE_STREAM, "read-line takes a stream argument");
+    }
+    Value *line = STREAM(stream)->next(STREAM(stream));
+    if (!line && !exc_is_pending()) {
+        return VALUE_CONST_NIL;
+    }
+    return line;
 }
 
-Value *core_is_true(const Value *args)
+
+Value *core_cons(const Value *args)
 {
     CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "TRUE? takes exactly one argument");
-    Value *expr = ARG(args, 0);
-    return value_new_bool(is_true(expr));
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "CONS takes exactly two arguments");
+    Value *first = ARG(args, 0);
+    Value *second = ARG(args, 1);
+    if (is_lazy_seq(second)) {
+        /* consing onto a lazy sequence leaves it unrealized */
+        Value **items = heap_malloc(sizeof(Value *));
+        items[0] = first;
+        return value_new_chunk(items, 1, second);
+    }
+    REQUIRE_VALUE_TYPE(second, VALUE_LIST, "the second parameter to CONS must be a list");
+    return value_new_list(list_prepend(LIST(second), first));
 }
 
-Value *core_is_false(const Value *args)
+Value *core_concat(const Value *args)
 {
     CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "FALSE? takes exactly one argument");
-    Value *expr = ARG(args, 0);
-    return value_new_bool(is_false(expr));
+    ListBuilder concat;
+    list_builder_init(&concat);
+    for (const ListItem *i = LIST(args)->head; i != NULL; i = i->next) {
+        Value *v = (Value *) i->val;
+        if (!is_lazy_seq(v)) {
+            REQUIRE_VALUE_TYPE(v, VALUE_LIST, "all parameters to CONCAT must be lists");
+        }
+        SeqIter it;
+        seq_iter_init(&it, v, false);
+        Value *item;
+        while (seq_iter_next(&it, &item)) {
+            list_builder_append(&concat, item);
+        }
+        if (exc_is_pending()) {
+            return NULL;
+        }
+    }
+    return value_new_list_nocopy(list_builder_finish(&concat));
 }
 
-Value *core_is_symbol(const Value *args)
+/* calls fn with one or two arguments, see apply_call() */
+static Value *core_call1(Value *fn, Value *a)
 {
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "SYMBOL? takes exactly one argument");
-    Value *expr = ARG(args, 0);
-    return value_new_bool(is_symbol(expr));
+    return apply_call(fn, 1, &a);
 }
 
-Value *core_symbol(const Value *args)
+static Value *core_call2(Value *fn, Value *a, Value *b)
 {
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "SYMBOL takes exactly one argument");
-    Value *expr = ARG(args, 0);
-    return value_new_symbol(STRING(expr));
+    Value *argv[2] = { a, b };
+    return apply_call(fn, 2, argv);
 }
 
-Value *core_assert(const Value *args)
+typedef struct {
+    Value *fn;
+    Stream *source;
+} CoreMapped;
+
+static Value *core_mapped_next(Stream *stream)
 {
-    CHECK_ARGLIST(args);
-    size_t nargs = NARGS(args);
-    if (nargs < 1 || nargs > 2) {
-        exc_set(value_make_exception("Invalid argument list in core function: "
-                                     "core_assert takes 1 or 2 arguments."));
+    CoreMapped *mapped = stream->state;
+    Value *v = mapped->source->next(mapped->source);
+    if (!v) {
         return NULL;
     }
-    const Value *arg0 = ARG(args, 0);
-    const Value *arg1 = NULL;
-    if (nargs == 2) {
-        arg1 = ARG(args, 1);
-        REQUIRE_VALUE_TYPE(arg1, VALUE_STRING,
-                           "Second argument to assert must be a string");
-    }
-    if (is_truthy(arg0)) {
-        return VALUE_CONST_NIL;
+    return core_call1(mapped->fn, v);
+}
+
+static Value *core_xform_new(XformKind kind, Value *fn, long n)
+{
+    XformStage *stage = heap_malloc(sizeof(XformStage));
+    stage->kind = kind;
+    stage->fn = fn;
+    stage->n = n;
+    return value_new_transducer(stage, 1);
+}
+
+/*
+ * Lazy sequence operations
+ *
+ * Each realization takes a chunk from its source and leaves the rest of
+ * the source to the next realization. Chunks take whatever the source
+ * has at hand, but at least one element, so chunked sources such as
+ * range stay chunked and element-wise ones are not realized ahead.
+ */
+typedef struct {
+    Value *fn;
+    Value *source;
+    long n;
+} CoreLazyOp;
+
+/*
+ * Builtins without side effects whose results depend on their arguments
+ * only. A lazy sequence is pure if it calls nothing else: it may call
+ * any other function, user functions in particular, at most once per
+ * element, so it has to cache what it produced.
+ */
+static bool core_is_pure_fn(const Value *fn)
+{
+    if (!fn) {
+        return true;
     }
-    if (nargs == 1) {
-        exc_set(value_make_exception("Assert failed: %s is not true.",
-                                     core_pr_str(arg0)->value.str));
-    } else {
-        exc_set(value_make_exception("Assert failed: %s", STRING(arg1)));
+    if (fn->type != VALUE_BUILTIN_FN) {
+        return false;
     }
-    return NULL;
+    Value *(*f)(const Value *) = BUILTIN_FN(fn);
+    return f == core_add || f == core_sub || f == core_mul || f == core_div
+           || f == core_eq || f == core_lt || f == core_leq || f == core_gt
+           || f == core_geq || f == core_is_nil || f == core_is_true
+           || f == core_is_false || f == core_is_symbol || f == core_is_keyword
+           || f == core_is_list;
 }
 
-Value *core_throw(const Value *args)
+static Value *core_lazy_op(bool (*realize)(LazySeq *, bool), Value *fn,
+                           Value *source, long n)
 {
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "THROW takes exactly one argument");
-    Value *value = ARG(args, 0);
-    exc_set(value); // FIXME: we expect .string to be valid...
-    return NULL;
+    CoreLazyOp *op = heap_malloc(sizeof(CoreLazyOp));
+    op->fn = fn;
+    op->source = source;
+    op->n = n;
+    // reading a stream again would not give the same elements
+    return value_new_lazy_seq(realize, op, !is_stream(source) && core_is_pure_fn(fn));
 }
 
-Value *core_nth(const Value *args)
+static Value **core_chunk_new()
 {
-    // (nth collection index)
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 2ul, "NTH takes exactly two arguments");
-    Value *coll = ARG(args, 0);
-    REQUIRE_VALUE_TYPE(coll, VALUE_LIST, "First argument to nth must be a collection");
-    Value *pos = ARG(args, 1);
-    REQUIRE_VALUE_TYPE(pos, VALUE_INT, "Second argument to nth must be an integer");
-    if (INT(pos) < 0 || (unsigned) INT(pos) >= NARGS(coll)) {
-        exc_set(value_make_exception("Index error"));
-        return NULL;
+    return heap_malloc(LAZY_SEQ_CHUNK_SIZE * sizeof(Value *));
+}
+
+static bool core_lazy_map_realize(LazySeq *seq, bool cache)
+{
+    CoreLazyOp *op = seq->state;
+    SeqIter it;
+    seq_iter_init(&it, op->source, cache);
+    seq->items = core_chunk_new();
+    seq->count = 0;
+    seq->rest = NULL;
+    Value *v;
+    while (seq->count < LAZY_SEQ_CHUNK_SIZE
+            && (seq->count == 0 || seq_iter_buffered(&it))) {
+        if (!seq_iter_next(&it, &v)) {
+            return !exc_is_pending();
+        }
+        if (!(seq->items[seq->count++] = core_call1(op->fn, v))) {
+            return false;
+        }
     }
-    return ARG(coll, (unsigned) INT(pos));
+    seq->rest = core_lazy_op(core_lazy_map_realize, op->fn, seq_iter_rest(&it), 0);
+    return true;
 }
 
-Value *core_first(const Value *args)
+static bool core_lazy_filter_realize(LazySeq *seq, bool cache)
 {
-    // (first coll)
-    CHECK_ARGLIST(args);
-    REQUIRE_LIST_CARDINALITY(args, 1ul, "FIRST takes exactly one argument");
-    Value *coll = ARG(args, 0);
-    if (is_nil(coll) || NARGS(coll) == 0) {
-        return VALUE_CONST_NIL;
+    CoreLazyOp *op = seq->state;
+    SeqIter it;
+    seq_iter_init(&it, op->source, cache);
+    seq->items = core_chunk_new();
+    seq->count = 0;
+    seq->rest = NULL;
+    Value *v;
+    // an empty chunk is fine, the rest continues the search
+    for (size_t n = 0; n < LAZY_SEQ_CHUNK_SIZE && (n == 0 || seq_iter_buffered(&it)); ++n) {
+        if (!seq_iter_next(&it, &v)) {
+            return !exc_is_pending();
+        }
+        Value *keep = core_call1(op->fn, v);
+        if (!keep) {
+            return false;
+        }
+        // n is set for remove, which keeps what the predicate rejects
+        if (is_truthy(keep) != (op->n != 0)) {
+            seq->items[seq->count++] = v;
+        }
     }
-    REQUIRE_VALUE_TYPE(coll, VALUE_LIST, "Argument to FIRST must be a collection or NIL");
-    return ARG(coll, 0);
+    seq->rest = core_lazy_op(core_lazy_filter_realize, op->fn, seq_iter_rest(&it), op->n);
+    return true;
 }
 
-Value *core_rest(const Value *args)
+static bool core_lazy_take_realize(LazySeq *seq, bool cache)
 {
-    // (rest coll)
-    CHECK_ARGLIST(args);
+    CoreLazyOp *op = seq->state;
+    seq->count = 0;
+    seq->rest = NULL;
+    if (op->n <= 0) {
+        return true;
+    }
+    SeqIter it;
+    seq_iter_init(&it, op->source, cache);
+    seq->items = core_chunk_new();
+    Value *v;
+    while ((long) seq->count < op->n && seq->count < LAZY_SEQ_CHUNK_SIZE
+            && (seq->count == 0 || seq_iter_buffered(&it))) {
+        if (!seq_iter_next(&it, &v)) {
+            return !exc_is_pending();
+        }
+        seq->items[seq->count++] = v;
+    }
+    if ((long) seq->count < op->n) {
+        seq->rest = core_lazy_op(core_lazy_take_realize, NULL, seq_iter_rest(&it),
+                                 op->n - (long) seq->count);
+    }
+    return true;
+}
+
+static bool core_lazy_drop_realize(LazySeq *seq, bool cache)
+{
+    CoreLazyOp *op = seq->state;
+    SeqIter it;
+    seq_iter_init(&it, op->source, cache);
+    seq->count = 0;
+    seq->rest = NULL;
+    Value *v;
+    for (long i = 0; i < op->n; ++i) {
+        if (!seq_iter_next(&it, &v)) {
+            return !exc_is_pending();
+        }
+    }
+    seq->rest = seq_iter_rest(&it);
+    return true;
+}
+
+typedef struct {
+    long start;
+    long end;
+    long step;
+    bool bounded;
+} CoreRange;
+
+static Value *core_range_new(long start, long end, long step, bool bounded);
+
+static bool core_range_realize(LazySeq *seq, bool cache)
+{
+    (void) cache;
+    CoreRange *range = seq->state;
+    seq->items = core_chunk_new();
+    seq->count = 0;
+    seq->rest = NULL;
+    long x = range->start;
+    while (seq->count < LAZY_SEQ_CHUNK_SIZE) {
+        if (range->bounded && (range->step > 0 ? x >= range->end : x <= range->end)) {
+            return true;
+        }
+        seq->items[seq->count++] = value_new_int((int) x);
+        x += range->step;
+    }
+    seq->rest = core_range_new(x, range->end, range->step, range->bounded);
+    return true;
+}
+
+static Value *core_range_new(long start, long end, long step, bool bounded)
+{
+    CoreRange *range = heap_malloc(sizeof(CoreRange));
+    range->start = start;
+    range->end = end;
+    range->step = step;
+    range->bounded = bounded;
+    return value_new_lazy_seq(core_range_realize, range, true);
+}
+
+static bool core_iterate_realize(LazySeq *seq, bool cache)
+{
+    (void) cache;
+    CoreLazyOp *op = seq->state;
+    Value *x = op->source;
+    // n tells whether the element still has to be computed from source
+    if (op->n && !(x = core_call1(op->fn, x))) {
+        return false;
+    }
+    seq->items = heap_malloc(sizeof(Value *));
+    seq->items[0] = x;
+    seq->count = 1;
+    CoreLazyOp *next = heap_malloc(sizeof(CoreLazyOp));
+    next->fn = op->fn;
+    next->source = x;
+    next->n = 1;
+    seq->rest = value_new_lazy_seq(core_iterate_realize, next, core_is_pure_fn(op->fn));
+    return true;
+}
+
+static bool core_lazy_partition_realize(LazySeq *seq, bool cache)
+{
+    CoreLazyOp *op = seq->state;
+    SeqIter it;
+    seq_iter_init(&it, op->source, cache);
+    seq->count = 0;
+    seq->rest = NULL;
+    ListBuilder part;
+    list_builder_init(&part);
+    Value *v;
+    long n = 0;
+    for (; n < op->n && seq_iter_next(&it, &v); ++n) {
+        list_builder_append(&part, v);
+    }
+    if (exc_is_pending()) {
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    seq->items = heap_malloc(sizeof(Value *));
+    seq->items[0] = value_new_list_nocopy(list_builder_finish(&part));
+    seq->count = 1;
+    if (n == op->n) {
+        seq->rest = core_lazy_op(core_lazy_partition_realize, NULL, seq_iter_rest(&it), op->n);
+    }
+    return true;
+}
+
+Value *core_map(const Value *args)
+{
+    /* (map f '(a b c ...)), or (map f) as a transducer */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) == 1) {
+        return core_xform_new(XFORM_MAP, ARG(args, 0), 0);
+    }
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "MAP takes one or two parameters");
+    Value *fn = ARG(args, 0);
+    Value *fn_args = ARG(args, 1);
+
+    if (is_stream(fn_args)) {
+        /* mapping a stream yields a stream, elements are mapped as they
+         * are consumed */
+        CoreMapped *mapped = heap_malloc(sizeof(CoreMapped));
+        mapped->fn = fn;
+        mapped->source = STREAM(fn_args);
+        return value_new_stream(core_mapped_next, mapped);
+    }
+    if (is_lazy_seq(fn_args)) {
+        return core_lazy_op(core_lazy_map_realize, fn, fn_args, 0);
+    }
+    REQUIRE_VALUE_TYPE(fn_args, VALUE_LIST, "The second parameter to MAP must be a list");
+    ListBuilder mapped;
+    list_builder_init(&mapped);
+    for (ListItem *item = LIST(fn_args)->head; item; item = item->next) {
+        Value *result = core_call1(fn, item->val);
+        if (!result) {
+            assert(exc_is_pending());
+            return NULL;
+        }
+        list_builder_append(&mapped, result);
+    }
+    return value_new_list_nocopy(list_builder_finish(&mapped));
+}
+
+static Value *core_filter_remove(const Value *args, XformKind kind, const char *name)
+{
+    CHECK_ARGLIST(args);
+    if (NARGS(args) == 1) {
+        return core_xform_new(kind, ARG(args, 0), 0);
+    }
+    if (NARGS(args) != 2) {
+        exc_set(value_make_exception("%s takes one or two parameters", name));
+        return NULL;
+    }
+    Value *coll = ARG(args, 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The second parameter to %s must be a sequence", name));
+        return NULL;
+    }
+    return core_lazy_op(core_lazy_filter_realize, ARG(args, 0), coll, kind == XFORM_REMOVE);
+}
+
+Value *core_filter(const Value *args)
+{
+    /* (filter pred coll), or (filter pred) as a transducer */
+    return core_filter_remove(args, XFORM_FILTER, "FILTER");
+}
+
+Value *core_remove(const Value *args)
+{
+    /* (remove pred coll), or (remove pred) as a transducer */
+    return core_filter_remove(args, XFORM_REMOVE, "REMOVE");
+}
+
+static Value *core_take_drop(const Value *args, bool (*realize)(LazySeq *, bool),
+                             XformKind kind, const char *name)
+{
+    CHECK_ARGLIST(args);
+    if (NARGS(args) == 1 && ARG(args, 0)->type == VALUE_INT) {
+        return core_xform_new(kind, NULL, INT(ARG(args, 0)));
+    }
+    if (NARGS(args) != 2) {
+        exc_set(value_make_exception("%s takes one or two parameters", name));
+        return NULL;
+    }
+    Value *n = ARG(args, 0);
+    Value *coll = ARG(args, 1);
+    if (n->type != VALUE_INT || !is_seq(coll)) {
+        exc_set(value_make_exception("%s requires a count and a sequence", name));
+        return NULL;
+    }
+    return core_lazy_op(realize, NULL, coll, INT(n));
+}
+
+Value *core_take(const Value *args)
+{
+    /* (take n coll) */
+    return core_take_drop(args, core_lazy_take_realize, XFORM_TAKE, "TAKE");
+}
+
+Value *core_drop(const Value *args)
+{
+    /* (drop n coll) */
+    return core_take_drop(args, core_lazy_drop_realize, XFORM_DROP, "DROP");
+}
+
+Value *core_range(const Value *args)
+{
+    /* (range), (range end), (range start end) or (range start end step) */
+    CHECK_ARGLIST(args);
+    size_t n = NARGS(args);
+    if (n > 3) {
+        exc_set(value_make_exception("RANGE takes at most three parameters"));
+        return NULL;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        REQUIRE_VALUE_TYPE(ARG(args, i), VALUE_INT, "RANGE requires integer parameters");
+    }
+    if (n == 0) {
+        return core_range_new(0, 0, 1, false);
+    }
+    long start = n == 1 ? 0 : INT(ARG(args, 0));
+    long end = n == 1 ? INT(ARG(args, 0)) : INT(ARG(args, 1));
+    long step = n == 3 ? INT(ARG(args, 2)) : 1;
+    if (step == 0) {
+        exc_set(value_make_exception("RANGE requires a non-zero step"));
+        return NULL;
+    }
+    return core_range_new(start, end, step, true);
+}
+
+Value *core_iterate(const Value *args)
+{
+    /* (iterate f x) is x, (f x), (f (f x)), ... */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "ITERATE takes exactly two parameters");
+    CoreLazyOp *op = heap_malloc(sizeof(CoreLazyOp));
+    op->fn = ARG(args, 0);
+    op->source = ARG(args, 1);
+    op->n = 0;
+    return value_new_lazy_seq(core_iterate_realize, op, core_is_pure_fn(op->fn));
+}
+
+Value *core_reduce(const Value *args)
+{
+    /* (reduce f coll) or (reduce f init coll) */
+    CHECK_ARGLIST(args);
+    size_t n = NARGS(args);
+    if (n != 2 && n != 3) {
+        exc_set(value_make_exception("REDUCE takes two or three parameters"));
+        return NULL;
+    }
+    Value *fn = ARG(args, 0);
+    Value *coll = ARG(args, n - 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The last parameter to REDUCE must be a sequence"));
+        return NULL;
+    }
+    Value *acc = n == 3 ? ARG(args, 1) : NULL;
+    SeqIter it;
+    seq_iter_init(&it, coll, false);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        if (!acc) {
+            acc = v;
+            continue;
+        }
+        if (!(acc = core_call2(fn, acc, v))) {
+            assert(exc_is_pending());
+            return NULL;
+        }
+    }
+    if (exc_is_pending()) {
+        return NULL;
+    }
+    if (!acc) {
+        /* like Clojure, reducing nothing without an initial value calls
+         * f with no arguments */
+        return apply_call(fn, 0, NULL);
+    }
+    return acc;
+}
+
+static Value *core_some_every(const Value *args, bool every, const char *name)
+{
+    CHECK_ARGLIST(args);
+    if (NARGS(args) != 2) {
+        exc_set(value_make_exception("%s takes two parameters", name));
+        return NULL;
+    }
+    Value *pred = ARG(args, 0);
+    Value *coll = ARG(args, 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The second parameter to %s must be a sequence", name));
+        return NULL;
+    }
+    SeqIter it;
+    seq_iter_init(&it, coll, false);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        Value *result = core_call1(pred, v);
+        if (!result) {
+            return NULL;
+        }
+        if (is_truthy(result) != every) {
+            return every ? VALUE_CONST_FALSE : result;
+        }
+    }
+    if (exc_is_pending()) {
+        return NULL;
+    }
+    return every ? VALUE_CONST_TRUE : VALUE_CONST_NIL;
+}
+
+Value *core_some(const Value *args)
+{
+    /* (some pred coll): the first truthy (pred x), or nil */
+    return core_some_every(args, false, "SOME");
+}
+
+Value *core_every(const Value *args)
+{
+    /* (every? pred coll) */
+    return core_some_every(args, true, "EVERY?");
+}
+
+/*
+ * Transducers
+ *
+ * A reduction through a transducer pushes every element through all
+ * stages in turn and on to the reducing step, so a pipeline makes a
+ * single pass without intermediate sequences. take stops the input once
+ * it is exhausted; partition-all passes its last, partial group on when
+ * the input ends.
+ */
+typedef struct {
+    const Transducer *xform;
+    long *counts;       /* elements seen by take and drop stages */
+    ListBuilder *parts; /* groups collected by partition-all stages */
+    bool done;
+    Value *rf;          /* reducing function, or NULL to collect into */
+    ListBuilder *into;
+    Value *acc;
+} CoreXformRun;
+
+static bool core_xform_step(CoreXformRun *run, size_t stage, Value *v)
+{
+    for (; stage < run->xform->count; ++stage) {
+        const XformStage *s = &run->xform->stages[stage];
+        switch (s->kind) {
+        case XFORM_MAP:
+            if (!(v = core_call1(s->fn, v))) {
+                return false;
+            }
+            break;
+        case XFORM_FILTER:
+        case XFORM_REMOVE: {
+            Value *keep = core_call1(s->fn, v);
+            if (!keep) {
+                return false;
+            }
+            if (is_truthy(keep) == (s->kind == XFORM_REMOVE)) {
+                return true;
+            }
+            break;
+        }
+        case XFORM_TAKE:
+            if (run->counts[stage] >= s->n) {
+                run->done = true;
+                return true;
+            }
+            if (++run->counts[stage] == s->n) {
+                run->done = true;
+            }
+            break;
+        case XFORM_DROP:
+            if (run->counts[stage] < s->n) {
+                run->counts[stage]++;
+                return true;
+            }
+            break;
+        case XFORM_PARTITION_ALL: {
+            ListBuilder *part = &run->parts[stage];
+            list_builder_append(part, v);
+            if ((long) part->list->size < s->n) {
+                return true;
+            }
+            v = value_new_list_nocopy(list_builder_finish(part));
+            list_builder_init(part);
+            break;
+        }
+        }
+    }
+    if (!run->rf) {
+        list_builder_append(run->into, v);
+        return true;
+    }
+    return (run->acc = core_call2(run->rf, run->acc, v)) != NULL;
+}
+
+/* reduces coll through xform, either with rf or into the builder */
+static Value *core_xform_run(const Transducer *xform, Value *rf, Value *acc,
+                             ListBuilder *into, Value *coll)
+{
+    CoreXformRun run = {
+        .xform = xform,
+        .counts = heap_calloc(xform->count, sizeof(long)),
+        .parts = heap_calloc(xform->count, sizeof(ListBuilder)),
+        .done = false,
+        .rf = rf,
+        .into = into,
+        .acc = acc
+    };
+    for (size_t i = 0; i < xform->count; ++i) {
+        list_builder_init(&run.parts[i]);
+    }
+    SeqIter it;
+    seq_iter_init(&it, coll, false);
+    Value *v;
+    while (!run.done && seq_iter_next(&it, &v)) {
+        if (!core_xform_step(&run, 0, v)) {
+            return NULL;
+        }
+    }
+    if (exc_is_pending()) {
+        return NULL;
+    }
+    // hand on partial groups, upstream stages first
+    for (size_t i = 0; i < xform->count; ++i) {
+        ListBuilder *part = &run.parts[i];
+        if (part->list->size > 0) {
+            v = value_new_list_nocopy(list_builder_finish(part));
+            list_builder_init(part);
+            if (!core_xform_step(&run, i + 1, v)) {
+                return NULL;
+            }
+        }
+    }
+    return rf ? run.acc : VALUE_CONST_NIL;
+}
+
+Value *core_partition_all(const Value *args)
+{
+    /* (partition-all n coll), or (partition-all n) as a transducer */
+    CHECK_ARGLIST(args);
+    size_t n = NARGS(args);
+    if (n != 1 && n != 2) {
+        exc_set(value_make_exception("PARTITION-ALL takes one or two parameters"));
+        return NULL;
+    }
+    Value *size = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(size, VALUE_INT, "PARTITION-ALL requires an integer size");
+    if (INT(size) <= 0) {
+        exc_set(value_make_exception("PARTITION-ALL requires a positive size"));
+        return NULL;
+    }
+    if (n == 1) {
+        return core_xform_new(XFORM_PARTITION_ALL, NULL, INT(size));
+    }
+    Value *coll = ARG(args, 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The second parameter to PARTITION-ALL must be a sequence"));
+        return NULL;
+    }
+    return core_lazy_op(core_lazy_partition_realize, NULL, coll, INT(size));
+}
+
+Value *core_comp(const Value *args)
+{
+    /* (comp xf1 xf2 ...) applies xf1 first, like Clojure's transducers */
+    CHECK_ARGLIST(args);
+    size_t count = 0;
+    for (ListItem *item = LIST(args)->head; item; item = item->next) {
+        REQUIRE_VALUE_TYPE(item->val, VALUE_TRANSDUCER, "COMP composes transducers");
+        count += TRANSDUCER(item->val)->count;
+    }
+    XformStage *stages = heap_malloc((count ? count : 1) * sizeof(XformStage));
+    size_t i = 0;
+    for (ListItem *item = LIST(args)->head; item; item = item->next) {
+        const Transducer *xform = TRANSDUCER(item->val);
+        memcpy(stages + i, xform->stages, xform->count * sizeof(XformStage));
+        i += xform->count;
+    }
+    return value_new_transducer(stages, count);
+}
+
+Value *core_transduce(const Value *args)
+{
+    /* (transduce xform f coll) or (transduce xform f init coll) */
+    CHECK_ARGLIST(args);
+    size_t n = NARGS(args);
+    if (n != 3 && n != 4) {
+        exc_set(value_make_exception("TRANSDUCE takes three or four parameters"));
+        return NULL;
+    }
+    Value *xform = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(xform, VALUE_TRANSDUCER, "The first parameter to TRANSDUCE must be a transducer");
+    Value *fn = ARG(args, 1);
+    Value *coll = ARG(args, n - 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The last parameter to TRANSDUCE must be a sequence"));
+        return NULL;
+    }
+    Value *init = n == 4 ? ARG(args, 2) : apply_call(fn, 0, NULL);
+    if (!init) {
+        return NULL;
+    }
+    return core_xform_run(TRANSDUCER(xform), fn, init, NULL, coll);
+}
+
+Value *core_into(const Value *args)
+{
+    /* (into to from) or (into to xform from), appends to a copy of to */
+    CHECK_ARGLIST(args);
+    size_t n = NARGS(args);
+    if (n != 2 && n != 3) {
+        exc_set(value_make_exception("INTO takes two or three parameters"));
+        return NULL;
+    }
+    Value *to = ARG(args, 0);
+    Value *from = ARG(args, n - 1);
+    if (!is_nil(to)) {
+        REQUIRE_VALUE_TYPE(to, VALUE_LIST, "The first parameter to INTO must be a list");
+    }
+    if (!is_seq(from)) {
+        exc_set(value_make_exception("The last parameter to INTO must be a sequence"));
+        return NULL;
+    }
+    ListBuilder into;
+    list_builder_init(&into);
+    SeqIter it;
+    seq_iter_init(&it, to, false);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        list_builder_append(&into, v);
+    }
+    if (n == 3) {
+        Value *xform = ARG(args, 1);
+        REQUIRE_VALUE_TYPE(xform, VALUE_TRANSDUCER, "The second parameter to INTO must be a transducer");
+        if (!core_xform_run(TRANSDUCER(xform), NULL, NULL, &into, from)) {
+            return NULL;
+        }
+    } else {
+        seq_iter_init(&it, from, false);
+        while (seq_iter_next(&it, &v)) {
+            list_builder_append(&into, v);
+        }
+        if (exc_is_pending()) {
+            return NULL;
+        }
+    }
+    return value_new_list_nocopy(list_builder_finish(&into));
+}
+
+static void core_transient_push(Transient *t, Value *v)
+{
+    if (t->size == t->capacity) {
+        t->capacity = t->capacity ? 2 * t->capacity : 16;
+        t->items = t->items ? heap_realloc(t->items, t->capacity * sizeof(Value *))
+                   : heap_malloc(t->capacity * sizeof(Value *));
+    }
+    t->items[t->size++] = v;
+}
+
+Value *core_transient(const Value *args)
+{
+    /* (transient coll), a list to build in place from the items of coll */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "TRANSIENT takes a single parameter");
+    Value *coll = ARG(args, 0);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("TRANSIENT requires a sequence"));
+        return NULL;
+    }
+    Value *t = value_new_transient();
+    SeqIter it;
+    seq_iter_init(&it, coll, false);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        core_transient_push(TRANSIENT(t), v);
+    }
+    return exc_is_pending() ? NULL : t;
+}
+
+static Transient *core_transient_arg(const Value *t, const char *name)
+{
+    if (t->type != VALUE_TRANSIENT) {
+        exc_set(value_make_exception("The first parameter to %s must be a transient", name));
+        return NULL;
+    }
+    if (TRANSIENT(t)->persistent) {
+        exc_set(value_make_exception("Transient used after persistent!"));
+        return NULL;
+    }
+    return TRANSIENT(t);
+}
+
+Value *core_conj_bang(const Value *args)
+{
+    /* (conj! t x ...), appends to t in place and returns it */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) < 1) {
+        exc_set(value_make_exception("CONJ! requires a transient"));
+        return NULL;
+    }
+    Transient *t = core_transient_arg(ARG(args, 0), "CONJ!");
+    if (!t) {
+        return NULL;
+    }
+    for (ListItem *item = LIST(args)->head->next; item; item = item->next) {
+        core_transient_push(t, item->val);
+    }
+    return ARG(args, 0);
+}
+
+Value *core_assoc_bang(const Value *args)
+{
+    /* (assoc! t i x), replaces the i-th item of t in place, or appends
+     * if i is the size of t */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 3ul, "ASSOC! takes three parameters");
+    Transient *t = core_transient_arg(ARG(args, 0), "ASSOC!");
+    if (!t) {
+        return NULL;
+    }
+    Value *index = ARG(args, 1);
+    REQUIRE_VALUE_TYPE(index, VALUE_INT, "The index to ASSOC! must be an int");
+    if (INT(index) < 0 || (size_t) INT(index) > t->size) {
+        exc_set(value_make_exception("Index out of bounds"));
+        return NULL;
+    }
+    if ((size_t) INT(index) == t->size) {
+        core_transient_push(t, ARG(args, 2));
+    } else {
+        t->items[INT(index)] = ARG(args, 2);
+    }
+    return ARG(args, 0);
+}
+
+Value *core_persistent_bang(const Value *args)
+{
+    /* (persistent! t), the list built by t, which cannot be used after */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "PERSISTENT! takes a single parameter");
+    Transient *t = core_transient_arg(ARG(args, 0), "PERSISTENT!");
+    if (!t) {
+        return NULL;
+    }
+    t->persistent = true;
+    ListBuilder list;
+    list_builder_init(&list);
+    for (size_t i = 0; i < t->size; ++i) {
+        list_builder_append(&list, t->items[i]);
+    }
+    // the items are not needed anymore
+    t->items = NULL;
+    t->size = t->capacity = 0;
+    return value_new_list_nocopy(list_builder_finish(&list));
+}
+
+/*
+ * Futures and promises
+ */
+static Pool *core_pool()
+{
+    // started on first use, on the thread of the interpreter
+    Interpreter *root = interp_current()->root;
+    if (!root->pool) {
+        root->pool = pool_new(root, 0);
+    }
+    return root->pool;
+}
+
+static void core_future_run(void *arg)
+{
+    Future *f = FUTURE(((Value *) arg));
+    Value *value = apply_call(f->fn, 0, NULL);
+    if (!value) {
+        f->exc = exc_is_pending() ? exc_get()
+                 : value_make_exception("Future failed without an exception");
+        exc_clear();
+    }
+    f->value = value;
+    atomic_store(&f->delivered, true);
+    atomic_store(&f->done, true);
+}
+
+Value *core_future_call(const Value *args)
+{
+    /* (future-call fn), runs (fn) on the worker pool */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "future-call takes exactly one argument");
+    Value *fn = ARG(args, 0);
+    if (fn->type != VALUE_FN && fn->type != VALUE_BUILTIN_FN) {
+        exc_set(value_make_exception("future-call requires a function"));
+        return NULL;
+    }
+    Pool *pool = core_pool();
+    if (!pool) {
+        exc_set(value_make_exception("Failed to start the worker pool"));
+        return NULL;
+    }
+    Value *future = value_new_future(fn);
+    pool_submit(pool, core_future_run, future);
+    return future;
+}
+
+Value *core_promise(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 0ul, "promise takes no arguments");
+    return value_new_future(NULL);
+}
+
+Value *core_deliver(const Value *args)
+{
+    /* (deliver p value), the promise or nil if it was delivered before */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "deliver takes exactly two arguments");
+    Value *p = ARG(args, 0);
+    if (p->type != VALUE_FUTURE || FUTURE(p)->fn) {
+        exc_set(value_make_exception("deliver requires a promise"));
+        return NULL;
+    }
+    Future *f = FUTURE(p);
+    if (atomic_exchange(&f->delivered, true)) {
+        return VALUE_CONST_NIL;
+    }
+    f->value = ARG(args, 1);
+    atomic_store(&f->done, true);
+    // nobody can be waiting on another thread unless there is a pool
+    Pool *pool = interp_current()->root->pool;
+    if (pool) {
+        pool_notify(pool);
+    }
+    return p;
+}
+
+Value *core_deref(const Value *args)
+{
+    /* (deref f), blocks until the future or promise f has a value, or
+     * the current value of an atom */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "deref takes exactly one argument");
+    Value *v = ARG(args, 0);
+    if (v->type == VALUE_ATOM) {
+        return atomic_load(&ATOM(v)->value);
+    }
+    REQUIRE_VALUE_TYPE(v, VALUE_FUTURE, "deref requires a future, promise or atom");
+    Future *f = FUTURE(v);
+    if (!atomic_load(&f->done)) {
+        Pool *pool = core_pool();
+        if (!pool) {
+            exc_set(value_make_exception("Failed to start the worker pool"));
+            return NULL;
+        }
+        // waiting threads run queued tasks meanwhile, futures deref'ing
+        // other futures do not tie up the pool
+        pool_wait(pool, &f->done);
+    }
+    if (f->exc) {
+        exc_set(f->exc);
+        return NULL;
+    }
+    return f->value;
+}
+
+Value *core_is_realized(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "realized? takes exactly one argument");
+    Value *v = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(v, VALUE_FUTURE, "realized? requires a future or promise");
+    return value_new_bool(atomic_load(&FUTURE(v)->done));
+}
+
+/*
+ * Parallel sequence functions split their input into chunks of
+ * consecutive elements that run as tasks on the worker pool. Inputs of
+ * up to one chunk run on the calling thread.
+ */
+#define CORE_PARALLEL_MIN_CHUNK 64
+
+typedef struct CoreParallel CoreParallel;
+
+typedef struct {
+    CoreParallel *job;
+    size_t start;
+    size_t end;
+    Value *result;          /* pfold: the chunk reduced */
+    const Value *exc;
+} CoreChunk;
+
+struct CoreParallel {
+    Value *fn;              /* pmap: f, pfold: reducef */
+    Value *init;            /* pfold only */
+    Value **items;
+    Value **out;            /* pmap only */
+    CoreChunk *chunks;
+    size_t n_chunks;
+    atomic_size_t remaining;
+    atomic_bool done;
+};
+
+static void core_chunk_run(void *arg)
+{
+    CoreChunk *chunk = arg;
+    CoreParallel *job = chunk->job;
+    Value *acc = job->init;
+    for (size_t i = chunk->start; i < chunk->end; ++i) {
+        Value *v = job->init ? core_call2(job->fn, acc, job->items[i])
+                   : core_call1(job->fn, job->items[i]);
+        if (!v) {
+            assert(exc_is_pending());
+            chunk->exc = exc_get();
+            exc_clear();
+            break;
+        }
+        if (job->init) {
+            acc = v;
+        } else {
+            job->out[i] = v;
+        }
+    }
+    chunk->result = acc;
+    if (atomic_fetch_sub(&job->remaining, 1) == 1) {
+        atomic_store(&job->done, true);
+    }
+}
+
+/* runs job over n items in chunks of chunk_size, or a default size if 0 */
+static bool core_parallel_run(CoreParallel *job, size_t n, size_t chunk_size)
+{
+    Pool *pool = NULL;
+    if (n > (chunk_size ? chunk_size : CORE_PARALLEL_MIN_CHUNK)) {
+        pool = core_pool();
+        // with a single worker the calling thread might as well do it all
+        if (pool && pool->n_workers < 2) {
+            pool = NULL;
+        }
+    }
+    if (pool && !chunk_size) {
+        // a few chunks per worker, so that stealing evens out the load
+        chunk_size = (n + 4 * pool->n_workers - 1) / (4 * pool->n_workers);
+        if (chunk_size < CORE_PARALLEL_MIN_CHUNK) {
+            chunk_size = CORE_PARALLEL_MIN_CHUNK;
+        }
+    }
+    job->n_chunks = pool ? (n + chunk_size - 1) / chunk_size : 1;
+    job->chunks = heap_calloc(job->n_chunks, sizeof(CoreChunk));
+    for (size_t k = 0; k < job->n_chunks; ++k) {
+        job->chunks[k].job = job;
+        job->chunks[k].start = pool ? k * chunk_size : 0;
+        job->chunks[k].end = pool && (k + 1) * chunk_size < n ? (k + 1) * chunk_size : n;
+    }
+    atomic_init(&job->remaining, job->n_chunks);
+    atomic_init(&job->done, false);
+    if (pool) {
+        for (size_t k = 0; k < job->n_chunks; ++k) {
+            pool_submit(pool, core_chunk_run, &job->chunks[k]);
+        }
+        pool_wait(pool, &job->done);
+    } else {
+        core_chunk_run(&job->chunks[0]);
+    }
+    for (size_t k = 0; k < job->n_chunks; ++k) {
+        if (job->chunks[k].exc) {
+            exc_set(job->chunks[k].exc);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the elements of a sequence in an array, NULL with a pending exception */
+static Value **core_seq_items(const Value *coll, size_t *n)
+{
+    size_t capacity = 64;
+    Value **items = heap_malloc(capacity * sizeof(Value *));
+    *n = 0;
+    SeqIter it;
+    seq_iter_init(&it, coll, false);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        if (*n == capacity) {
+            capacity *= 2;
+            items = heap_realloc(items, capacity * sizeof(Value *));
+        }
+        items[(*n)++] = v;
+    }
+    return exc_is_pending() ? NULL : items;
+}
+
+/* the optional chunk size argument, 0 if absent and -1 on error */
+static long core_chunk_size_arg(const Value *args, size_t index)
+{
+    if (NARGS(args) <= index) {
+        return 0;
+    }
+    Value *v = ARG(args, index);
+    if (v->type != VALUE_INT || INT(v) <= 0) {
+        exc_set(value_make_exception("Chunk size must be a positive integer"));
+        return -1;
+    }
+    return INT(v);
+}
+
+Value *core_pmap(const Value *args)
+{
+    /* (pmap f coll) or (pmap f coll chunk-size) */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) != 2 && NARGS(args) != 3) {
+        exc_set(value_make_exception("PMAP takes two or three parameters"));
+        return NULL;
+    }
+    Value *coll = ARG(args, 1);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The second parameter to PMAP must be a sequence"));
+        return NULL;
+    }
+    long chunk_size = core_chunk_size_arg(args, 2);
+    if (chunk_size < 0) {
+        return NULL;
+    }
+    CoreParallel job = { .fn = ARG(args, 0), .init = NULL };
+    size_t n;
+    if (!(job.items = core_seq_items(coll, &n))) {
+        return NULL;
+    }
+    job.out = heap_malloc((n ? n : 1) * sizeof(Value *));
+    if (!core_parallel_run(&job, n, (size_t) chunk_size)) {
+        return NULL;
+    }
+    ListBuilder out;
+    list_builder_init(&out);
+    for (size_t i = 0; i < n; ++i) {
+        list_builder_append(&out, job.out[i]);
+    }
+    return value_new_list_nocopy(list_builder_finish(&out));
+}
+
+static Value *core_fold(Value *combinef, Value *reducef, Value *init,
+                        const Value *coll, long chunk_size)
+{
+    CoreParallel job = { .fn = reducef, .init = init };
+    size_t n;
+    if (!(job.items = core_seq_items(coll, &n))) {
+        return NULL;
+    }
+    if (!core_parallel_run(&job, n, (size_t) chunk_size)) {
+        return NULL;
+    }
+    // the chunks in order, f need not be commutative
+    Value *acc = job.chunks[0].result;
+    for (size_t k = 1; k < job.n_chunks; ++k) {
+        if (!(acc = core_call2(combinef, acc, job.chunks[k].result))) {
+            return NULL;
+        }
+    }
+    return acc;
+}
+
+Value *core_pfold(const Value *args)
+{
+    /* (pfold combinef reducef init coll) or (... chunk-size), init must be
+     * an identity of combinef, which must be associative */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) != 4 && NARGS(args) != 5) {
+        exc_set(value_make_exception("PFOLD takes four or five parameters"));
+        return NULL;
+    }
+    Value *coll = ARG(args, 3);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The fourth parameter to PFOLD must be a sequence"));
+        return NULL;
+    }
+    long chunk_size = core_chunk_size_arg(args, 4);
+    if (chunk_size < 0) {
+        return NULL;
+    }
+    return core_fold(ARG(args, 0), ARG(args, 1), ARG(args, 2), coll, chunk_size);
+}
+
+Value *core_preduce(const Value *args)
+{
+    /* (preduce f init coll) or (... chunk-size), f associative with
+     * identity init */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) != 3 && NARGS(args) != 4) {
+        exc_set(value_make_exception("PREDUCE takes three or four parameters"));
+        return NULL;
+    }
+    Value *coll = ARG(args, 2);
+    if (!is_seq(coll)) {
+        exc_set(value_make_exception("The third parameter to PREDUCE must be a sequence"));
+        return NULL;
+    }
+    long chunk_size = core_chunk_size_arg(args, 3);
+    if (chunk_size < 0) {
+        return NULL;
+    }
+    Value *fn = ARG(args, 0);
+    return core_fold(fn, fn, ARG(args, 1), coll, chunk_size);
+}
+
+/*
+ * Atoms
+ */
+Value *core_atom(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "atom takes exactly one argument");
+    return value_new_atom(ARG(args, 0));
+}
+
+Value *core_reset_bang(const Value *args)
+{
+    /* (reset! a value), sets the atom a to value and returns value */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "reset! takes exactly two arguments");
+    Value *a = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(a, VALUE_ATOM, "reset! requires an atom");
+    Value *value = ARG(args, 1);
+    atomic_store(&ATOM(a)->value, value);
+    return value;
+}
+
+Value *core_swap_bang(const Value *args)
+{
+    /* (swap! a f x y ...), sets a to (f current x y ...) and returns the
+     * new value. f runs again if another thread changed a meanwhile, so
+     * it should be free of side effects */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY_GE(args, 2ul, "swap! takes at least two arguments");
+    Value *a = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(a, VALUE_ATOM, "swap! requires an atom");
+    size_t argc = NARGS(args) - 1;
+    Value **argv = heap_malloc(argc * sizeof(Value *));
+    size_t i = 1;
+    for (const ListItem *item = LIST(args)->head->next->next; item; item = item->next) {
+        argv[i++] = (Value *) item->val;
+    }
+    Value *fn = ARG(args, 1);
+    Value *current = atomic_load(&ATOM(a)->value);
+    Value *next;
+    do {
+        // a failed exchange reloads current
+        argv[0] = current;
+        if (!(next = apply_call(fn, argc, argv))) {
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak(&ATOM(a)->value, &current, next));
+    return next;
+}
+
+Value *core_compare_and_set_bang(const Value *args)
+{
+    /* (compare-and-set! a old new), sets a to new if its value is equal
+     * to old, returns whether it did */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 3ul, "compare-and-set! takes exactly three arguments");
+    Value *a = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(a, VALUE_ATOM, "compare-and-set! requires an atom");
+    Value *old = ARG(args, 1);
+    Value *current = atomic_load(&ATOM(a)->value);
+    do {
+        // numbers are boxed, so equal rather than identical values match
+        Value *equal = current == old ? VALUE_CONST_TRUE : cmp_eq(current, old);
+        if (!equal) {
+            return NULL;
+        }
+        if (!is_truthy(equal)) {
+            return VALUE_CONST_FALSE;
+        }
+    } while (!atomic_compare_exchange_weak(&ATOM(a)->value, &current, ARG(args, 2)));
+    return VALUE_CONST_TRUE;
+}
+
+/*
+ * Go blocks and channels
+ */
+Value *core_chan(const Value *args)
+{
+    /* (chan) or (chan n), a channel buffering up to n values */
+    CHECK_ARGLIST(args);
+    if (NARGS(args) > 1) {
+        exc_set(value_make_exception("chan takes zero or one arguments"));
+        return NULL;
+    }
+    long capacity = 0;
+    if (NARGS(args) == 1) {
+        Value *n = ARG(args, 0);
+        if (n->type != VALUE_INT || INT(n) < 0) {
+            exc_set(value_make_exception("Channel buffer size must be a non-negative integer"));
+            return NULL;
+        }
+        capacity = INT(n);
+    }
+    return value_new_channel(capacity);
+}
+
+/* parses an operation of alts!, a channel to take from or (chan value) */
+static bool core_chan_op(const Value *op, GreenOp *out)
+{
+    if (op->type == VALUE_LIST && list_size(LIST(op)) == 2) {
+        out->chan = list_nth(LIST(op), 0);
+        out->value = list_nth(LIST(op), 1);
+    } else {
+        out->chan = (Value *) op;
+        out->value = NULL;
+    }
+    if (out->chan->type != VALUE_CHANNEL) {
+        exc_set(value_make_exception("Channel operations require a channel"));
+        return false;
+    }
+    if (out->value && out->value->type == VALUE_NIL) {
+        exc_set(value_make_exception("Cannot put nil on a channel"));
+        return false;
+    }
+    return true;
+}
+
+Value *core_chan_put(const Value *args)
+{
+    /* (>! chan value), parks until taken or buffered, false if closed */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 2ul, ">! takes exactly two arguments");
+    GreenOp op;
+    if (!core_chan_op(args, &op)) {
+        return NULL;
+    }
+    Value *chan;
+    return green_alts(&op, 1, &chan);
+}
+
+Value *core_chan_take(const Value *args)
+{
+    /* (<! chan), parks until there is a value, nil once closed and drained */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "<! takes exactly one argument");
+    GreenOp op;
+    if (!core_chan_op(ARG(args, 0), &op)) {
+        return NULL;
+    }
+    Value *chan;
+    return green_alts(&op, 1, &chan);
+}
+
+Value *core_alts(const Value *args)
+{
+    /* (alts! ops), completes the first ready of the takes and puts in
+     * ops and returns (value chan) */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "alts! takes exactly one argument");
+    Value *ops = ARG(args, 0);
+    if (ops->type != VALUE_LIST || list_size(LIST(ops)) == 0) {
+        exc_set(value_make_exception("alts! requires a list of channel operations"));
+        return NULL;
+    }
+    size_t n = list_size(LIST(ops));
+    GreenOp *parsed = heap_malloc(n * sizeof(GreenOp));
+    size_t i = 0;
+    for (const ListItem *item = LIST(ops)->head; item; item = item->next) {
+        if (!core_chan_op(item->val, &parsed[i++])) {
+            return NULL;
+        }
+    }
+    Value *chan;
+    Value *value = green_alts(parsed, n, &chan);
+    if (!value) {
+        return NULL;
+    }
+    return value_new_list(list_append(list_append(list_new(), value), chan));
+}
+
+Value *core_close(const Value *args)
+{
+    /* (close! chan), parked and later takes get nil, puts false */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "close! takes exactly one argument");
+    Value *chan = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(chan, VALUE_CHANNEL, "close! requires a channel");
+    green_close(chan);
+    return exc_is_pending() ? NULL : VALUE_CONST_NIL;
+}
+
+Value *core_timeout(const Value *args)
+{
+    /* (timeout ms), a channel that closes after ms milliseconds */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "timeout takes exactly one argument");
+    Value *ms = ARG(args, 0);
+    REQUIRE_VALUE_TYPE(ms, VALUE_INT, "timeout requires milliseconds");
+    return green_timeout(INT(ms));
+}
+
+Value *core_apply_spread(const Value *args, Value **fn)
+{
+    /* the arguments of (apply f a b c d ...), with the last one spread */
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY_GE(args, 2ul, "APPLY requires at least two arguments");
+    *fn = ARG(args, 0);
+    Value *fn_args = value_new_list(list_tail(LIST(args)));
+    size_t n_args = NARGS(fn_args);
+
+    Value *last = n_args > 0 ? ARG(fn_args, n_args - 1) : NULL;
+    if (last && is_lazy_seq(last)) {
+        /* lazy sequences are spread like lists */
+        ListBuilder spread;
+        list_builder_init(&spread);
+        for (size_t i = 0; i < n_args - 1; ++i) {
+            list_builder_append(&spread, ARG(fn_args, i));
+        }
+        const List *elements = value_seq_list(last, false);
+        if (exc_is_pending()) {
+            return NULL;
+        }
+        list_builder_append(&spread, value_new_list(elements));
+        fn_args = value_new_list_nocopy(list_builder_finish(&spread));
+    }
+    /* The last argument may be a list; if it is, we need to prepend
+     * the other args to that list to yield the final list of arguments */
+    if (n_args > 0 && is_list(ARG(fn_args, n_args - 1))) {
+        const List *concat = LIST(ARG(fn_args, n_args - 1));
+        for (size_t i = n_args - 1; i > 0; --i) {
+            concat = list_prepend(concat, ARG(fn_args, i - 1));
+        }
+        fn_args = value_new_list(concat);
+    }
+    return fn_args;
+}
+
+Value *core_apply(const Value *args)
+{
+    /* (apply f a b c d ...) == (f a b c d ...) */
+    Value *fn;
+    Value *fn_args = core_apply_spread(args, &fn);
+    if (!fn_args) {
+        return NULL;
+    }
+    Value *tco_expr;
+    Environment *tco_env;
+    Value *result = apply(fn, fn_args, &tco_expr, &tco_env);
+    /* need to call eval since apply defers to eval for TCO support */
+    if (tco_expr && !exc_is_pending()) {
+        result = eval(tco_expr, tco_env);
+    }
+    if (!result) {
+        assert(exc_is_pending());
+        return NULL;
+    }
+    return result;
+}
+
+Value *core_is_nil(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "NIL? takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_bool(is_nil(expr));
+}
+
+Value *core_is_true(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "TRUE? takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_bool(is_true(expr));
+}
+
+Value *core_is_false(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "FALSE? takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_bool(is_false(expr));
+}
+
+Value *core_is_symbol(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "SYMBOL? takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_bool(is_symbol(expr));
+}
+
+Value *core_symbol(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "SYMBOL takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_symbol(STRING(expr));
+}
+
+Value *core_is_keyword(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "KEYWORD? takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    return value_new_bool(is_keyword(expr));
+}
+
+Value *core_keyword(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "KEYWORD takes exactly one argument");
+    Value *expr = ARG(args, 0);
+    if (!(expr->type == VALUE_STRING || is_symbol(expr) || is_keyword(expr))) {
+        exc_set(value_make_exception("KEYWORD requires a string or a symbol"));
+        return NULL;
+    }
+    return value_new_keyword(STRING(expr));
+}
+
+Value *core_assert(const Value *args)
+{
+    CHECK_ARGLIST(args);
+    size_t nargs = NARGS(args);
+    if (nargs < 1 || nargs > 2) {
+        exc_set(value_make_exception("Invalid argument list in core function: "
+                                     "core_assert takes 1 or 2 arguments."));
+        return NULL;
+    }
+    const Value *arg0 = ARG(args, 0);
+    const Value *arg1 = NULL;
+    if (nargs == 2) {
+        arg1 = ARG(args, 1);
+        REQUIRE_VALUE_TYPE(arg1, VALUE_STRING,
+                           "Second argument to assert must be a string");
+    }
+    if (is_truthy(arg0)) {
+        return VALUE_CONST_NIL;
+    }
+    if (nargs == 1) {
+        exc_set(value_make_exception("Assert failed: %s is not true.",
+                                     STRING(core_pr_str(arg0))));
+    } else {
+        exc_set(value_make_exception("Assert failed: %s", STRING(arg1)));
+    }
+    return NULL;
+}
+
+Value *core_throw(const Value *args)
+{
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "THROW takes exactly one argument");
+    Value *value = ARG(args, 0);
+    exc_set(value); // FIXME: we expect .string to be valid...
+    return NULL;
+}
+
+Value *core_nth(const Value *args)
+{
+    // (nth collection index)
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 2ul, "NTH takes exactly two arguments");
+    Value *coll = ARG(args, 0);
+    Value *pos = ARG(args, 1);
+    if (is_lazy_seq(coll)) {
+        REQUIRE_VALUE_TYPE(pos, VALUE_INT, "Second argument to nth must be an integer");
+        SeqIter it;
+        seq_iter_init(&it, coll, true);
+        Value *v;
+        for (int i = 0; seq_iter_next(&it, &v); ++i) {
+            if (i == INT(pos)) {
+                return v;
+            }
+        }
+        if (!exc_is_pending()) {
+            exc_set(value_make_exception("Index error"));
+        }
+        return NULL;
+    }
+    REQUIRE_VALUE_TYPE(coll, VALUE_LIST, "First argument to nth must be a collection");
+    REQUIRE_VALUE_TYPE(pos, VALUE_INT, "Second argument to nth must be an integer");
+    if (INT(pos) < 0 || (unsigned) INT(pos) >= NARGS(coll)) {
+        exc_set(value_make_exception("Index error"));
+        return NULL;
+    }
+    return ARG(coll, (unsigned) INT(pos));
+}
+
+Value *core_first(const Value *args)
+{
+    // (first coll)
+    CHECK_ARGLIST(args);
+    REQUIRE_LIST_CARDINALITY(args, 1ul, "FIRST takes exactly one argument");
+    Value *coll = ARG(args, 0);
+    if (is_lazy_seq(coll)) {
+        SeqIter it;
+        seq_iter_init(&it, coll, true);
+        Value *v;
+        if (seq_iter_next(&it, &v)) {
+            return v;
+        }
+        return exc_is_pending() ? NULL : VALUE_CONST_NIL;
+    }
+    if (is_nil(coll)) {
+        return VALUE_CONST_NIL;
+    }
+    REQUIRE_VALUE_TYPE(coll, VALUE_LIST, "Argument to FIRST must be a collection or NIL");
+    if (NARGS(coll) == 0) {
+        return VALUE_CONST_NIL;
+    }
+    return ARG(coll, 0);
+}
+
+Value *core_rest(const Value *args)
+{
+    // (rest coll)
+    CHECK_ARGLIST(args);
     REQUIRE_LIST_CARDINALITY(args, 1ul, "REST takes exactly one argument");
     Value *coll = ARG(args, 0);
-    if (is_nil(coll) || NARGS(coll) <= 1) {
+    if (is_lazy_seq(coll)) {
+        SeqIter it;
+        seq_iter_init(&it, coll, true);
+        Value *v;
+        if (!seq_iter_next(&it, &v) && exc_is_pending()) {
+            return NULL;
+        }
+        return seq_iter_rest(&it);
+    }
+    if (is_nil(coll)) {
         return value_new_list(NULL);
     }
     REQUIRE_VALUE_TYPE(coll, VALUE_LIST, "Argument to REST must be a collection or NIL");
+    if (NARGS(coll) <= 1) {
+        return value_new_list(NULL);
+    }
     return value_new_list(list_tail(LIST(coll)));
 }
@@ -51,3 +51,15 @@ unsigned long djb2(char *str)
     return hash;
 }
 
+unsigned long djb2_n(const char *str, size_t n)
+{
+    const unsigned char *s = (const unsigned char *) str;
+    unsigned long hash = 5381;
+
+    for (size_t i = 0; i < n; ++i) {
+        hash = ((hash << 5) + hash) + s[i]; /* hash * 33 + c */
+    }
+
+    return hash;
+}
+
@@ -1,29 +1,121 @@
 #include "env.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "djb2.h"
 #include "gc.h"
+#include "interp.h"
 #include "log.h"
 #include "value.h"
 
 Environment *env_new(Environment *parent)
 {
-    Environment *env = gc_malloc(&gc, sizeof(Environment));
+    Environment *env = heap_malloc(sizeof(Environment));
     env->parent = parent;
-    env->map = map_new(32);
+    // loop frames may never need a map, and function frames a small one
+    env->map = NULL;
+    env->globals = parent ? NULL : cmap_new(256);
+    env->slot_names = NULL;
+    env->slots = NULL;
+    env->nslots = 0;
+    env->slot_capacity = 0;
+    env->captured = false;
+    return env;
+}
+
+Environment *env_new_frame(Environment *parent, size_t nslots)
+{
+    Environment *env = env_new(parent);
+    if (nslots > 0) {
+        env->slot_names = heap_malloc(nslots * sizeof(char *));
+        env->slots = heap_malloc(nslots * sizeof(Value *));
+        env->slot_capacity = nslots;
+    }
+    return env;
+}
+
+static Value **env_slot(Environment *env, char *symbol)
+{
+    // later bindings shadow earlier ones of the same name
+    for (size_t i = env->nslots; i > 0; --i) {
+        if (strcmp(env->slot_names[i - 1], symbol) == 0) {
+            return &env->slots[i - 1];
+        }
+    }
+    return NULL;
+}
+
+void env_bind(Environment *env, char *symbol, const Value *value)
+{
+    assert(env->nslots < env->slot_capacity);
+    env->slot_names[env->nslots] = heap_strdup(symbol);
+    env->slots[env->nslots++] = (Value *) value;
+}
+
+void env_capture(Environment *env)
+{
+    // the parents of a captured environment are captured already
+    for (; env && !env->captured; env = env->parent) {
+        env->captured = true;
+    }
+}
+
+Environment *env_rebind_frame(const Environment *frame, Value **slots)
+{
+    Environment *env = env_new(frame->parent);
+    // all names are bound, so they are never written again
+    env->slot_names = frame->slot_names;
+    env->slots = slots;
+    env->nslots = frame->nslots;
+    env->slot_capacity = frame->nslots;
     return env;
 }
 
 void env_set(Environment *env, char *symbol, const Value *value)
 {
-    map_put(env->map, symbol, (void *) value, sizeof(Value));
+    Value **slot = env_slot(env, symbol);
+    if (slot) {
+        *slot = (Value *) value;
+        return;
+    }
+    if (env->globals) {
+        cmap_put(env->globals, symbol, (Value *) value);
+        return;
+    }
+    if (!env->map) {
+        env->map = map_new(8);
+    }
+    // the map holds pointers, values may not be copied: strings keep their
+    // contents in the same allocation
+    map_put(env->map, symbol, &value, sizeof(Value *));
 }
 
 Value *env_get(Environment *env, char *symbol)
+{
+    return env_get_hashed(env, symbol, djb2(symbol));
+}
+
+Value *env_lookup(Environment *env, const Value *symbol)
+{
+    return env_get_hashed(env, SYMBOL(symbol), string_hash(symbol->value.string));
+}
+
+Value *env_get_hashed(Environment *env, char *symbol, unsigned long hash)
 {
     Environment *cur_env = env;
-    Value *value;
+    Value **value;
     while(cur_env) {
+        Value **slot = env_slot(cur_env, symbol);
+        if (slot) {
+            return *slot;
+        }
+        if (cur_env->globals) {
+            return cmap_get_hashed(cur_env->globals, symbol, hash);
+        }
         if (cur_env->map) {
-            if ((value = (Value *) map_get(cur_env->map, symbol))) {
-                return value;
+            if ((value = (Value **) map_get_hashed(cur_env->map, symbol, hash))) {
+                return *value;
             }
         }
         cur_env = cur_env->parent;
@@ -8,14 +8,19 @@
 #include "log.h"
 #include "core.h"
 #include "exc.h"
+#include "green.h"
+#include "interp.h"
 
 static bool is_self_evaluating(const Value *value)
 {
     return value->type == VALUE_FLOAT
            || value->type == VALUE_INT
            || value->type == VALUE_STRING
+           || value->type == VALUE_KEYWORD
            || value->type == VALUE_NIL
-           || value->type == VALUE_FN;
+           || value->type == VALUE_FN
+           || value->type == VALUE_LAZY_SEQ
+           || value->type == VALUE_STREAM;
 }
 
 static bool is_variable(const Value *value)
@@ -90,6 +95,36 @@ static bool is_try(const Value *value)
     return is_list_that_starts_with(value, "try", 3);
 }
 
+static bool is_lazy_seq_form(const Value *value)
+{
+    // (lazy-seq body)
+    return is_list_that_starts_with(value, "lazy-seq", 9);
+}
+
+static bool is_future(const Value *value)
+{
+    // (future body)
+    return is_list_that_starts_with(value, "future", 7);
+}
+
+static bool is_go(const Value *value)
+{
+    // (go body)
+    return is_list_that_starts_with(value, "go", 3);
+}
+
+static bool is_loop(const Value *value)
+{
+    // (loop (n1 v1 n2 v2 ...) body)
+    return is_list_that_starts_with(value, "loop", 5);
+}
+
+static bool is_recur(const Value *value)
+{
+    // (recur v1 v2 ...)
+    return is_list_that_starts_with(value, "recur", 6);
+}
+
 static Value *get_macro_fn(const Value *form, Environment *env)
 {
     /*
@@ -100,7 +135,7 @@ static Value *get_macro_fn(const Value *form, Environment *env)
     if (is_list(form)) {
         Value *first = list_head(LIST(form));
         if (first && is_symbol(first)) {
-            Value *fn = env_get(env, SYMBOL(first));
+            Value *fn = env_lookup(env, first);
             if (fn && is_macro(fn))
                 return fn;
         }
@@ -127,7 +162,7 @@ static bool has_cardinality(const Value *expr, const size_t cardinality)
 static Value *lookup_variable_value(Value *expr, Environment *env)
 {
     Value *sym = NULL;
-    if ((sym = env_get(env, SYMBOL(expr))) == NULL) {
+    if ((sym = env_lookup(env, expr)) == NULL) {
         exc_set(value_make_exception("Unknown name: %s", SYMBOL(expr)));
         return NULL;
     }
@@ -144,47 +179,6 @@ static Value *eval_quote(Value *expr)
     return NULL;
 }
 
-static Value *eval_assignment(Value *expr, Environment *env)
-{
-    // (set! var value)
-    if (has_cardinality(expr, 3)) {
-        Value *name = list_nth(LIST(expr), 1);
-        if (env_contains(env, SYMBOL(name))) {
-            Value *value = list_nth(LIST(expr), 2);
-            value = eval(value, env);
-            if (!value) {
-                assert(exc_is_pending());
-                return NULL;
-            }
-            env_set(env, SYMBOL(name), value);
-            return value;
-        }
-        exc_set(value_make_exception("Could not find symbol %s.", SYMBOL(name)));
-        return NULL;
-    }
-    exc_set(value_make_exception("set! requires 2 args"));
-    return NULL;
-}
-
-static Value *eval_definition(Value *expr, Environment *env)
-{
-    // (def name value)
-    assert(expr);
-    if (has_cardinality(expr, 3)) {
-        Value *name = list_nth(LIST(expr), 1);
-        Value *value = list_nth(LIST(expr), 2);
-        value = eval(value, env);
-        if (!value) {
-            assert(exc_is_pending());
-            return NULL;
-        }
-        env_set(env, SYMBOL(name), value);
-        return value;
-    }
-    exc_set(value_make_exception("def requires 2 args"));
-    return NULL;
-}
-
 static Value *eval_macro_definition(Value *expr, Environment *env)
 {
     // (defmacro name parameters expr)
@@ -192,6 +186,7 @@ static Value *eval_macro_definition(Value *expr, Environment *env)
         Value *name = list_nth(LIST(expr), 1);
         Value *args = list_nth(LIST(expr), 2);
         Value *body = list_nth(LIST(expr), 3);
+        env_capture(env);
         Value *macro = value_new_macro(args, body, env);
         env_set(env, SYMBOL(name), macro);
         return macro;
@@ -200,88 +195,66 @@ static Value *eval_macro_definition(Value *expr, Environment *env)
     return NULL;
 }
 
-static Value *eval_let(Value *expr, Environment *env, Value **tco_expr, Environment **tco_env)
+typedef struct {
+    Value *body;
+    Environment *env;
+} LazySeqThunk;
+
+static bool eval_lazy_seq_realize(LazySeq *seq, bool cache)
 {
-    // (let (n1 v1 n2 v2 ...) (body))
-    if (has_cardinality(expr, 3)) {
-        Environment *inner = env_new(env);
-        Value *assignments = list_nth(LIST(expr), 1);
-        if (!is_list(assignments) || list_size(LIST(assignments)) % 2 != 0) {
-            exc_set(value_make_exception("Invalid assignment list in let"));
-            return NULL;
-        }
-        const List *list = LIST(assignments);
-        Value *name = list_head(list);
-        Value *value = list_head(list_tail(list));
-        Value *evaluated_value;
-        while (name) {
-            evaluated_value = eval(value, inner);
-            if (!evaluated_value) {
-                assert(exc_is_pending());
-                return NULL;
-            }
-            env_set(inner, SYMBOL(name), evaluated_value);
-            list = list_tail(list_tail(list)); // +2
-            name = list_head(list);
-            value = name ? list_head(list_tail(list)) : NULL;
-        }
-        // TCO
-        *tco_expr = list_nth(LIST(expr), 2);
-        *tco_env = inner;
-        return NULL; // tco must return NULL
+    (void) cache;
+    LazySeqThunk *thunk = seq->state;
+    Value *result = eval(thunk->body, thunk->env);
+    if (!result) {
+        assert(exc_is_pending());
+        return false;
+    }
+    if (!is_seq(result)) {
+        exc_set(value_make_exception("lazy-seq body must return a sequence"));
+        return false;
+    }
+    // the body's sequence is the rest of an empty chunk
+    seq->count = 0;
+    seq->rest = result;
+    return true;
+}
+
+static Value *eval_lazy_seq(Value *expr, Environment *env)
+{
+    // (lazy-seq body), body is evaluated once, on first use
+    if (has_cardinality(expr, 2)) {
+        LazySeqThunk *thunk = heap_malloc(sizeof(LazySeqThunk));
+        thunk->body = list_nth(LIST(expr), 1);
+        thunk->env = env;
+        env_capture(env);
+        return value_new_lazy_seq(eval_lazy_seq_realize, thunk, false);
     }
-    exc_set(value_make_exception("Invalid let declaration, require 2 args"));
+    exc_set(value_make_exception("Invalid lazy-seq declaration, require 1 argument"));
     return NULL;
 }
 
-static Value *eval_if(Value *expr, Environment *env, Value **tco_expr, Environment **tco_env)
+static Value *eval_future(Value *expr, Environment *env)
 {
-    // (if predicate consequent alternative)
-    if (has_cardinality(expr, 4)) {
-        Value *predicate = eval(list_nth(LIST(expr), 1), env);
-        if (!predicate) {
-            assert(exc_is_pending());
-            return NULL;
-        }
-        if (is_truthy(predicate)) {
-            *tco_expr = list_nth(LIST(expr), 2);
-        } else {
-            *tco_expr = list_nth(LIST(expr), 3);
-        }
-        *tco_env = env;
-        return NULL; // tco must return NULL
+    // (future body) is (future-call (lambda () body))
+    if (has_cardinality(expr, 2)) {
+        Value *params = value_new_list_nocopy(list_new());
+        env_capture(env);
+        Value *fn = value_new_fn(params, list_nth(LIST(expr), 1), env);
+        return core_future_call(value_make_list(fn));
     }
-    exc_set(value_make_exception("Invalid if declaration, require 3 args"));
+    exc_set(value_make_exception("Invalid future declaration, require 1 argument"));
     return NULL;
 }
 
-static Value *eval_try(Value *expr, Environment *env)
+static Value *eval_go(Value *expr, Environment *env)
 {
-    // (try sexpr (catch ex sexpr))
-    if (has_cardinality(expr, 3)) {
-        Value *catch_form = list_nth(LIST(expr), 2);
-        if (!has_cardinality(catch_form, 3)) {
-            exc_set(value_make_exception("Invalid catch declaration, require 2 arguments"));
-            return NULL;
-        }
-        Value *result = eval(list_nth(LIST(expr), 1), env);
-        if (!result) {
-            assert(exc_is_pending());
-            // LOG_CRITICAL("Caught exception: %s", EXCEPTION(exc_get()));
-            Environment *ex_env = env_new(env);
-            Value *name = list_nth(LIST(catch_form), 1);
-            env_set(ex_env, STRING(name), exc_get());
-            exc_clear();
-            result = eval(list_nth(LIST(catch_form), 2), ex_env);
-            if (!result) {
-                // catch threw an exception
-                assert(exc_is_pending());
-                return NULL;
-            }
-        }
-        return result;
+    // (go body) runs (lambda () body) as a go block
+    if (has_cardinality(expr, 2)) {
+        Value *params = value_new_list_nocopy(list_new());
+        env_capture(env);
+        return green_go(value_new_fn(params, list_nth(LIST(expr), 1), env));
     }
-    exc_set(value_make_exception("Invalid try declaration, require 2 arguments"));
+    exc_set(value_make_exception("Invalid go declaration, require 1 argument"));
     return NULL;
 }
 
@@ -291,6 +264,7 @@ static Value *declare_fn(Value *expr, Environment *env)
     if (has_cardinality(expr, 3)) {
         Value *args = list_nth(LIST(expr), 1);
         Value *body = list_nth(LIST(expr), 2);
+        env_capture(env);
         Value *fn = value_new_fn(args, body, env);
         return fn;
     }
@@ -298,28 +272,6 @@ static Value *declare_fn(Value *expr, Environment *env)
     return NULL;
 }
 
-static Value *eval_do(Value *expr, Environment *env, Value **tco_expr, Environment **tco_env)
-{
-    // (do sexpr sexpr ...)
-    Value *head;
-    const List *list = list_tail(LIST(expr));
-    while((head = list_head(list)) != NULL) {
-        list = list_tail(list);
-        if (list_size(list) == 0) {
-            *tco_expr = head;
-            *tco_env = env;
-            return NULL;
-        }
-        Value *result = eval(head, env);
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
-        }
-    }
-    assert(0); // unreachable
-    return NULL;
-}
-
 static Value *_quasiquote(Value *arg)
 {
     /*
@@ -397,28 +349,6 @@ static Value *eval_quasiquote(Value *expr, Environment *env,
     return NULL;
 }
 
-static Value *operator(Value *expr)
-{
-    Value *op = NULL;
-    if (expr && is_list(expr)) {
-        op = list_head(LIST(expr));
-        if (!op) {
-            exc_set(value_make_exception("Could not find operator in list"));
-            return NULL;
-        }
-    }
-    return op;
-}
-
-static Value *operands(Value *expr)
-{
-    Value *ops = NULL;
-    if (expr && is_list(expr)) {
-        ops = value_new_list(list_tail(LIST(expr)));
-    }
-    return ops;
-}
-
 static Value *macroexpand(Value *form, Environment *env)
 {
     assert(form && env);
@@ -448,146 +378,537 @@ static Value *macroexpand_1(Value *expr, Environment *env)
     return macroexpand(args, env);
 }
 
-static Value *eval_all(Value *expr, Environment *env)
+static bool check_recur(const Value *expr, Environment *env, bool tail, size_t arity);
+
+static bool check_bindings(const Value *bindings, Environment *env)
 {
-    // eval every element of a list
+    // recur is never in tail position in a binding value
+    if (!is_list(bindings)) {
+        return true;
+    }
+    const ListItem *item = LIST(bindings)->head;
+    for (; item && item->next; item = item->next->next) {
+        if (!check_recur(item->next->val, env, false, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_recur(const Value *expr, Environment *env, bool tail, size_t arity)
+{
+    /*
+     * Checks the body of a loop before it first runs: recur may only
+     * appear in tail position, where eval() reaches it by jumping rather
+     * than by calling itself, and must rebind every loop name. Macro calls
+     * are not expanded, eval() checks the recur forms they produce when it
+     * reaches them. Nested loops check their own bodies.
+     */
+    if (!is_list(expr) || list_size(LIST(expr)) == 0
+            || is_quoted(expr) || is_quasiquoted(expr)) {
+        return true;
+    }
     const List *list = LIST(expr);
-    const List *evaluated_list = list_new();
-    Value *head;
-    Value *evaluated_head;
-    while ((head = list_head(list)) != NULL) {
-        evaluated_head = eval(head, env);
-        if (!evaluated_head) {
+    if (is_recur(expr)) {
+        if (!tail) {
+            exc_set(value_make_exception("recur must be in tail position"));
+            return false;
+        }
+        if (list_size(list) - 1 != arity) {
+            exc_set(value_make_exception("recur requires %zu args, got %zu",
+                                         arity, list_size(list) - 1));
+            return false;
+        }
+        tail = false;
+    } else if (is_loop(expr)) {
+        return check_bindings(list_nth(list, 1), env);
+    } else if (is_let(expr)) {
+        return check_bindings(list_nth(list, 1), env)
+               && check_recur(list_nth(list, 2), env, tail, arity);
+    } else if (is_if(expr)) {
+        return check_recur(list_nth(list, 1), env, false, arity)
+               && check_recur(list_nth(list, 2), env, tail, arity)
+               && check_recur(list_nth(list, 3), env, tail, arity);
+    } else if (get_macro_fn(expr, env)) {
+        return true;
+    } else if (!is_do(expr)) {
+        tail = false;
+    }
+    // the last form of a do keeps the tail position
+    for (const ListItem *item = list->head; item; item = item->next) {
+        if (!check_recur(item->val, env, tail && !item->next, arity)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    Environment *frame;
+    Value *body;
+    Value **values; /* recur args, evaluated before any name is rebound */
+} Loop;
+
+static Loop *loop_new(Value *expr, Environment *env)
+{
+    // (loop (n1 v1 n2 v2 ...) body), eval() binds the names
+    if (!has_cardinality(expr, 3)) {
+        exc_set(value_make_exception("Invalid loop declaration, require 2 args"));
+        return NULL;
+    }
+    Value *bindings = list_nth(LIST(expr), 1);
+    if (!is_list(bindings) || list_size(LIST(bindings)) % 2 != 0) {
+        exc_set(value_make_exception("Invalid binding list in loop"));
+        return NULL;
+    }
+    size_t n = list_size(LIST(bindings)) / 2;
+    Value *body = list_nth(LIST(expr), 2);
+    // once per form, the check neither depends on nor changes the bindings
+    if (!atomic_load_explicit(&expr->checked, memory_order_relaxed)) {
+        if (!check_recur(body, env, true, n)) {
             assert(exc_is_pending());
             return NULL;
         }
-        evaluated_list = list_append(evaluated_list, evaluated_head);
-        list = list_tail(list);
+        atomic_store_explicit(&expr->checked, true, memory_order_relaxed);
     }
-    LIST(expr) = evaluated_list;
-    return value_new_list(evaluated_list);
+    Loop *loop = heap_malloc(sizeof(Loop));
+    loop->frame = env_new_frame(env, n);
+    loop->body = body;
+    loop->values = n > 0 ? heap_malloc(n * sizeof(Value *)) : NULL;
+    return loop;
+}
+
+
+/*
+ * The continuation stack
+ *
+ * eval() does not call itself for subexpressions. Before it evaluates a
+ * subexpression that is not in tail position, it pushes a frame that
+ * says what to do with the value, and pops the frame once the value is
+ * there. Past a few frames the stack moves to the heap, so the depth of
+ * non-tail recursion is only limited by memory. Builtins that call back
+ * into the evaluator, like map, start a nested eval() of their own.
+ */
+typedef enum {
+    CONT_APPLY,             /* the operator and operands of an application */
+    CONT_IF,                /* the predicate of an if */
+    CONT_DO,                /* a form of a do, but the last */
+    CONT_LET,               /* a binding of a let */
+    CONT_DEF,               /* the value of a def or set! */
+    CONT_TRY,               /* the body of a try */
+    CONT_LOOP,              /* a binding of a loop */
+    CONT_RECUR,             /* an argument of a recur */
+    CONT_MACRO              /* the expansion of a macro call */
+} ContKind;
+
+typedef struct {
+    ContKind kind;
+    Value *expr;            /* the form the frame evaluates */
+    Environment *env;
+    Loop *loop;             /* the loop in tail position, CONT_LOOP's own */
+    const ListItem *item;   /* the subform being evaluated */
+    ListBuilder values;     /* CONT_APPLY's operator and operands */
+    size_t index;           /* CONT_RECUR's argument */
+} Cont;
+
+#define EVAL_INLINE_FRAMES 8
+
+typedef struct {
+    Cont *frames;
+    size_t size;
+    size_t capacity;
+    Cont inline_frames[EVAL_INLINE_FRAMES];
+} ContStack;
+
+static Cont *cont_push(ContStack *stack, ContKind kind, Value *expr,
+                       Environment *env, Loop *loop, const ListItem *item)
+{
+    if (stack->size == stack->capacity) {
+        Cont *frames = heap_malloc(2 * stack->capacity * sizeof(Cont));
+        memcpy(frames, stack->frames, stack->size * sizeof(Cont));
+        if (stack->frames != stack->inline_frames) {
+            heap_free(stack->frames);
+        }
+        stack->frames = frames;
+        stack->capacity *= 2;
+    }
+    Cont *k = &stack->frames[stack->size++];
+    k->kind = kind;
+    k->expr = expr;
+    k->env = env;
+    k->loop = loop;
+    k->item = item;
+    return k;
 }
 
+#define EVAL_FAIL(...) do {\
+    exc_set(value_make_exception(__VA_ARGS__));\
+    value = NULL;\
+    goto ret;\
+} while (0)
+
+/* counts evaluations on this thread up to the next yield point and safepoint */
+static _Thread_local unsigned eval_ticks = 0;
 
 Value *eval(Value *expr, Environment *env)
 {
+    ContStack stack;
+    stack.frames = stack.inline_frames;
+    stack.size = 0;
+    stack.capacity = EVAL_INLINE_FRAMES;
+    Value *value = NULL;
+    Value *fn = NULL;
+    Value *args = NULL;
     Value *tco_expr = NULL;
-    Value *ret = NULL;
     Environment *tco_env = NULL;
+    Loop *loop = NULL; // the loop whose body is in tail position
+    Cont *k;
+    const ListItem *item;
 tco:
     if (!expr) {
         assert(exc_is_pending());
-        return NULL;
+        value = NULL;
+        goto ret;
+    }
+    if (++eval_ticks == GREEN_YIELD_INTERVAL) {
+        eval_ticks = 0;
+        green_yield();
+        heap_safepoint();
     }
     if (is_self_evaluating(expr)) {
-        return expr;
+        value = expr;
+        goto ret;
     } else if (is_variable(expr)) {
-        ret = lookup_variable_value(expr, env);
-        return ret;
+        value = lookup_variable_value(expr, env);
+        goto ret;
+    } else if (!is_list(expr)) {
+        value = expr;
+        goto ret;
     }
-    expr = macroexpand(expr, env);
-    if (!expr) {
-        LOG_CRITICAL("Macro expansion failed.");
-        assert(exc_is_pending());
-        return expr;
+    if ((fn = get_macro_fn(expr, env)) != NULL) {
+        // evaluate the expansion, then the form it expanded to
+        apply(fn, value_new_list(list_tail(LIST(expr))), &tco_expr, &tco_env);
+        if (exc_is_pending()) {
+            value = NULL;
+            goto ret;
+        }
+        cont_push(&stack, CONT_MACRO, expr, env, loop, NULL);
+        expr = tco_expr;
+        env = tco_env;
+        loop = NULL;
+        goto tco;
     }
-    if (!is_list(expr)) goto tco;
     if (is_quoted(expr)) {
-        return eval_quote(expr);
+        value = eval_quote(expr);
+        goto ret;
     } else if (is_quasiquoted(expr)) {
         tco_expr = NULL;
         tco_env = NULL;
-        Value *result = eval_quasiquote(expr, env, &tco_expr, &tco_env);
+        value = eval_quasiquote(expr, env, &tco_expr, &tco_env);
         if (tco_expr && tco_env) {
             expr = tco_expr;
             env = tco_env;
             goto tco;
         }
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
-        }
-        return result;
+        goto ret;
     } else if (is_assignment(expr)) {
-        return eval_assignment(expr, env);
+        // (set! var value)
+        if (!has_cardinality(expr, 3)) {
+            EVAL_FAIL("set! requires 2 args");
+        }
+        Value *name = list_nth(LIST(expr), 1);
+        if (!env_contains(env, SYMBOL(name))) {
+            EVAL_FAIL("Could not find symbol %s.", SYMBOL(name));
+        }
+        cont_push(&stack, CONT_DEF, expr, env, loop, NULL);
+        expr = list_nth(LIST(expr), 2);
+        loop = NULL;
+        goto tco;
     } else if (is_macro_definition(expr)) {
-        return eval_macro_definition(expr, env);
+        value = eval_macro_definition(expr, env);
+        goto ret;
     } else if (is_definition(expr)) {
-        return eval_definition(expr, env);
+        // (def name value)
+        if (!has_cardinality(expr, 3)) {
+            EVAL_FAIL("def requires 2 args");
+        }
+        cont_push(&stack, CONT_DEF, expr, env, loop, NULL);
+        expr = list_nth(LIST(expr), 2);
+        loop = NULL;
+        goto tco;
     } else if (is_let(expr)) {
-        tco_expr = NULL;
-        tco_env = NULL;
-        Value *result = eval_let(expr, env, &tco_expr, &tco_env);
-        if (tco_expr && tco_env) {
-            expr = tco_expr;
-            env = tco_env;
-            goto tco;
+        // (let (n1 v1 n2 v2 ...) (body))
+        if (!has_cardinality(expr, 3)) {
+            EVAL_FAIL("Invalid let declaration, require 2 args");
         }
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
+        Value *bindings = list_nth(LIST(expr), 1);
+        if (!is_list(bindings) || list_size(LIST(bindings)) % 2 != 0) {
+            EVAL_FAIL("Invalid assignment list in let");
         }
-        return result;
-    } else if (is_if(expr)) {
-        tco_expr = NULL;
-        tco_env = NULL;
-        Value *result = eval_if(expr, env, &tco_expr, &tco_env);
-        if (tco_expr && tco_env) {
-            expr = tco_expr;
-            env = tco_env;
-            goto tco;
+        env = env_new(env);
+        if ((item = LIST(bindings)->head)) {
+            cont_push(&stack, CONT_LET, expr, env, loop, item);
+            expr = item->next->val;
+            loop = NULL;
+        } else {
+            expr = list_nth(LIST(expr), 2);
         }
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
+        goto tco;
+    } else if (is_if(expr)) {
+        // (if predicate consequent alternative)
+        if (!has_cardinality(expr, 4)) {
+            EVAL_FAIL("Invalid if declaration, require 3 args");
         }
-        return result;
+        cont_push(&stack, CONT_IF, expr, env, loop, NULL);
+        expr = list_nth(LIST(expr), 1);
+        loop = NULL;
+        goto tco;
     } else if (is_do(expr)) {
-        tco_expr = NULL;
-        tco_env = NULL;
-        Value *result = eval_do(expr, env, &tco_expr, &tco_env);
-        if (tco_expr && tco_env) {
-            expr = tco_expr;
-            env = tco_env;
+        // (do sexpr sexpr ...), the last one in tail position
+        if (!(item = LIST(expr)->head->next)) {
+            value = VALUE_CONST_NIL;
+            goto ret;
+        }
+        if (item->next) {
+            cont_push(&stack, CONT_DO, expr, env, loop, item);
+            loop = NULL;
+        }
+        expr = (Value *) item->val;
+        goto tco;
+    } else if (is_loop(expr)) {
+        Loop *inner = loop_new(expr, env);
+        if (!inner) {
+            value = NULL;
+            goto ret;
+        }
+        // bound in order, like let
+        if ((item = LIST(list_nth(LIST(expr), 1))->head)) {
+            if (!is_symbol(item->val)) {
+                EVAL_FAIL("Loop binding names must be symbols");
+            }
+            cont_push(&stack, CONT_LOOP, expr, inner->frame, inner, item);
+            expr = item->next->val;
+            env = inner->frame;
+            loop = NULL;
             goto tco;
         }
-        if (!result) {
-            assert(exc_is_pending());
-            return NULL;
+        loop = inner;
+        expr = loop->body;
+        env = loop->frame;
+        goto tco;
+    } else if (is_recur(expr)) {
+        // (recur v1 v2 ...), rebinds the names of the loop frame once all
+        // values are there
+        if (!loop) {
+            // loop_new() rejects the recur forms of the body itself, this
+            // catches those that macros expand to. A frame that was pushed
+            // in tail position of a loop body means this recur is in the
+            // body, but not in tail position
+            for (size_t i = stack.size; i > 0; --i) {
+                if (stack.frames[i - 1].loop) {
+                    EVAL_FAIL("recur must be in tail position");
+                }
+            }
+            EVAL_FAIL("recur outside of loop");
         }
-        return result;
+        if (list_size(LIST(expr)) - 1 != loop->frame->nslots) {
+            EVAL_FAIL("recur requires %zu args, got %zu", loop->frame->nslots,
+                      list_size(LIST(expr)) - 1);
+        }
+        if ((item = LIST(expr)->head->next)) {
+            k = cont_push(&stack, CONT_RECUR, expr, env, loop, item);
+            k->index = 0;
+            expr = (Value *) item->val;
+            loop = NULL;
+            goto tco;
+        }
+        expr = loop->body;
+        env = loop->frame;
+        goto tco;
     } else if (is_try(expr)) {
-        return eval_try(expr, env);
+        // (try sexpr (catch ex sexpr))
+        if (!has_cardinality(expr, 3)) {
+            EVAL_FAIL("Invalid try declaration, require 2 arguments");
+        }
+        if (!has_cardinality(list_nth(LIST(expr), 2), 3)) {
+            EVAL_FAIL("Invalid catch declaration, require 2 arguments");
+        }
+        cont_push(&stack, CONT_TRY, expr, env, loop, NULL);
+        expr = list_nth(LIST(expr), 1);
+        loop = NULL;
+        goto tco;
+    } else if (is_lazy_seq_form(expr)) {
+        value = eval_lazy_seq(expr, env);
+        goto ret;
+    } else if (is_future(expr)) {
+        value = eval_future(expr, env);
+        goto ret;
+    } else if (is_go(expr)) {
+        value = eval_go(expr, env);
+        goto ret;
     } else if (is_lambda(expr)) {
-        return declare_fn(expr, env);
+        value = declare_fn(expr, env);
+        goto ret;
     } else if (is_macro_expansion(expr)) {
-        return macroexpand_1(expr, env);
+        value = macroexpand_1(expr, env);
+        goto ret;
     } else if (is_application(expr)) {
-        tco_expr = NULL;
-        tco_env = NULL;
-        Value *fn = eval(operator(expr), env);
-        if (!fn) {
-            assert(exc_is_pending());
-            return NULL;
+        if (!(item = LIST(expr)->head)) {
+            EVAL_FAIL("Could not find operator in list");
         }
-        Value *args = eval_all(operands(expr), env);
-        if (!args) {
-            assert(exc_is_pending());
-            return NULL;
+        k = cont_push(&stack, CONT_APPLY, expr, env, loop, item);
+        list_builder_init(&k->values);
+        expr = (Value *) item->val;
+        loop = NULL;
+        goto tco;
+    }
+    LOG_CRITICAL("Unknown expression: %d", expr->type);
+    EVAL_FAIL("Unknown expression");
+
+apply:
+    if (fn->type == VALUE_BUILTIN_FN && BUILTIN_FN(fn) == core_apply) {
+        // continue with the fn that apply calls, rather than in a nested eval()
+        if (!(args = core_apply_spread(args, &fn))) {
+            value = NULL;
+            goto ret;
         }
-        ret = apply(fn, args, &tco_expr, &tco_env);
-        if (tco_expr && tco_env) {
-            expr = tco_expr;
-            env = tco_env;
+        goto apply;
+    }
+    tco_expr = NULL;
+    tco_env = NULL;
+    value = apply(fn, args, &tco_expr, &tco_env);
+    if (tco_expr && tco_env && !exc_is_pending()) {
+        // a fn body cannot recur to the loop of its caller
+        loop = NULL;
+        expr = tco_expr;
+        env = tco_env;
+        goto tco;
+    }
+    if (exc_is_pending()) {
+        value = NULL;
+    }
+
+ret:
+    if (!value) {
+        // unwind to the innermost try
+        assert(exc_is_pending());
+        while (stack.size > 0) {
+            k = &stack.frames[--stack.size];
+            if (k->kind == CONT_TRY) {
+                Value *catch_form = list_nth(LIST(k->expr), 2);
+                env = env_new(k->env);
+                env_set(env, SYMBOL(list_nth(LIST(catch_form), 1)), exc_get());
+                exc_clear();
+                expr = list_nth(LIST(catch_form), 2);
+                loop = NULL;
+                goto tco;
+            }
+        }
+    }
+    if (stack.size == 0) {
+        if (stack.frames != stack.inline_frames) {
+            heap_free(stack.frames);
+        }
+        return value;
+    }
+    // hand the value to the frame on top
+    k = &stack.frames[stack.size - 1];
+    switch (k->kind) {
+    case CONT_APPLY:
+        list_builder_append(&k->values, value);
+        if ((item = k->item->next)) {
+            k->item = item;
+            expr = (Value *) item->val;
+            env = k->env;
             goto tco;
         }
-        if (!ret) {
-            assert(exc_is_pending());
-            return NULL;
+        stack.size--;
+        const List *evaluated = list_builder_finish(&k->values);
+        fn = list_head(evaluated);
+        args = value_new_list_nocopy(list_tail(evaluated));
+        env = k->env;
+        loop = k->loop;
+        goto apply;
+    case CONT_IF:
+        stack.size--;
+        expr = list_nth(LIST(k->expr), is_truthy(value) ? 2 : 3);
+        env = k->env;
+        loop = k->loop;
+        goto tco;
+    case CONT_DO:
+        item = k->item->next;
+        env = k->env;
+        if (item->next) {
+            k->item = item;
+        } else {
+            stack.size--;
+            loop = k->loop;
         }
-        return ret;
+        expr = (Value *) item->val;
+        goto tco;
+    case CONT_LET:
+        env_set(k->env, SYMBOL(k->item->val), value);
+        env = k->env;
+        if ((item = k->item->next->next)) {
+            k->item = item;
+            expr = item->next->val;
+        } else {
+            stack.size--;
+            expr = list_nth(LIST(k->expr), 2);
+            loop = k->loop;
+        }
+        goto tco;
+    case CONT_DEF:
+        stack.size--;
+        env_set(k->env, SYMBOL(list_nth(LIST(k->expr), 1)), value);
+        goto ret;
+    case CONT_TRY:
+        stack.size--;
+        goto ret;
+    case CONT_LOOP:
+        env_bind(k->env, SYMBOL(k->item->val), value);
+        env = k->env;
+        if ((item = k->item->next->next)) {
+            if (!is_symbol(item->val)) {
+                EVAL_FAIL("Loop binding names must be symbols");
+            }
+            k->item = item;
+            expr = item->next->val;
+            goto tco;
+        }
+        stack.size--;
+        loop = k->loop;
+        expr = loop->body;
+        goto tco;
+    case CONT_RECUR:
+        k->loop->values[k->index++] = value;
+        if ((item = k->item->next)) {
+            k->item = item;
+            expr = (Value *) item->val;
+            env = k->env;
+            goto tco;
+        }
+        stack.size--;
+        loop = k->loop;
+        if (loop->frame->captured) {
+            // closures, lazy sequences and futures of the last iteration
+            // keep its frame
+            loop->frame = env_rebind_frame(loop->frame, loop->values);
+            loop->values = heap_malloc(loop->frame->nslots * sizeof(Value *));
+        } else {
+            memcpy(loop->frame->slots, loop->values,
+                   loop->frame->nslots * sizeof(Value *));
+        }
+        expr = loop->body;
+        env = loop->frame;
+        goto tco;
+    case CONT_MACRO:
+        stack.size--;
+        expr = value;
+        env = k->env;
+        loop = k->loop;
+        goto tco;
     }
-    LOG_CRITICAL("Unknown expression: %d", expr->type);
-    exc_set(value_new_exception("Unknown expression"));
+    assert(0); // unreachable
     return NULL;
 }
@@ -1,32 +1,31 @@
 #include "exc.h"
+#include "interp.h"
 #include "log.h"
 
 #include <assert.h>
 
-static const Value *exc_current = NULL;
-
 void exc_set(const Value *error)
 {
     if (exc_is_pending()) {
         LOG_CRITICAL(
             "Raised exception: '%s' but cannot raise without handling existing exception '%s'",
-            STRING(error), STRING(exc_current));
+            STRING(error), STRING(exc_get()));
         assert(0);
     }
-    exc_current = error;
+    interp_current()->exc = error;
 }
 
 const Value *exc_get()
 {
-    return exc_current;
+    return interp_current()->exc;
 }
 
 void exc_clear()
 {
-    exc_current = NULL;
+    interp_current()->exc = NULL;
 }
 
 bool exc_is_pending()
 {
-    return exc_current != NULL;
+    return interp_current()->exc != NULL;
 }
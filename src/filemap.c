@@ -0,0 +1,50 @@
+#include "filemap.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * A mapping is laid out as
+ *
+ *   [header page][file pages ...][zero page]
+ *
+ * where the header records the length of the whole region. The kernel
+ * zero-fills the tail of the last file page; if the file ends on a page
+ * boundary, the anonymous page after it provides the terminating NUL.
+ */
+typedef struct {
+    size_t length;
+} FilemapHeader;
+
+static size_t filemap_page_size()
+{
+    return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+char *filemap_open(int fd, size_t size)
+{
+    size_t page = filemap_page_size();
+    size_t length = page + (size / page + 1) * page;
+    char *base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    char *data = base + page;
+    if (size > 0) {
+        if (mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(base, length);
+            return NULL;
+        }
+        // only a hint, failure is harmless
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    ((FilemapHeader *) base)->length = length;
+    return data;
+}
+
+void filemap_close(char *data)
+{
+    char *base = data - filemap_page_size();
+    munmap(base, ((FilemapHeader *) base)->length);
+}
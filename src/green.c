@@ -0,0 +1,476 @@
+#include "green.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "apply.h"
+#include "exc.h"
+#include "interp.h"
+#include "log.h"
+
+/*
+ * Switching contexts
+ *
+ * The interpreter's own code (the host) runs on the thread's stack, each
+ * go block on a stack mapped when it first runs. Switching swaps the
+ * registers with swapcontext(), only the host switches to go blocks and
+ * go blocks only switch back to the host.
+ */
+
+/* an address below everything the caller has on the stack */
+static __attribute__((noinline)) char *green_stack_pointer()
+{
+    return __builtin_frame_address(0);
+}
+
+static Green *green_self()
+{
+    return interp_current()->root->green;
+}
+
+static void green_chan_close(Green *g, Value *chan);
+static bool green_try_put(Green *g, Value *chan, Value *value, Value **ok);
+
+/* puts value into the result channel of task and closes it */
+static void green_finish(Green *g, GreenTask *task, Value *value)
+{
+    // the result channel has room for the value, nil just closes it
+    Value *ok;
+    if (value->type != VALUE_NIL) {
+        green_try_put(g, task->result, value, &ok);
+    }
+    green_chan_close(g, task->result);
+    task->finished = true;
+}
+
+static void green_task_main()
+{
+    Green *g = green_self();
+    GreenTask *task = g->current;
+    Value *value = apply_call(task->fn, 0, NULL);
+    if (!value) {
+        value = exc_is_pending() ? (Value *) exc_get()
+                : value_make_exception("Go block failed without an exception");
+        exc_clear();
+    }
+    green_finish(g, task, value);
+    g->current = NULL;
+    setcontext(&g->host);
+    LOG_CRITICAL("Failed to switch back from a go block");
+    abort();
+}
+
+/*
+ * Maps the stack of task and prepares its context, false if that fails.
+ * The started go blocks stay reachable, so their stacks stay scanned.
+ */
+static bool green_start(Green *g, GreenTask *task)
+{
+    size_t guard = (size_t) sysconf(_SC_PAGESIZE);
+    char *stack = mmap(NULL, GREEN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return false;
+    }
+    if (mprotect(stack, guard, PROT_NONE) != 0 || getcontext(&task->ctx) != 0) {
+        munmap(stack, GREEN_STACK_SIZE);
+        return false;
+    }
+    task->stack = stack;
+    task->ctx.uc_stack.ss_sp = stack;
+    task->ctx.uc_stack.ss_size = GREEN_STACK_SIZE;
+    task->ctx.uc_link = NULL;
+    makecontext(&task->ctx, green_task_main, 0);
+    task->scan.top = task->scan.bottom = stack + GREEN_STACK_SIZE;
+    heap_stack_add(&task->scan);
+    task->prev_started = NULL;
+    task->next_started = g->started;
+    if (g->started) {
+        g->started->prev_started = task;
+    }
+    g->started = task;
+    return true;
+}
+
+/* unmaps the stack of a finished go block, once the host runs again */
+static void green_end(Green *g, GreenTask *task)
+{
+    if (task->prev_started) {
+        task->prev_started->next_started = task->next_started;
+    } else {
+        g->started = task->next_started;
+    }
+    if (task->next_started) {
+        task->next_started->prev_started = task->prev_started;
+    }
+    heap_stack_remove(&task->scan);
+    munmap(task->stack, GREEN_STACK_SIZE);
+    task->stack = NULL;
+}
+
+static Green *green_get()
+{
+    Interpreter *interp = interp_current();
+    Green *g = interp->root->green;
+    if (interp != interp->root || (g && !pthread_equal(g->thread, pthread_self()))) {
+        exc_set(value_make_exception("Go blocks and channels only work on "
+                                     "the thread of the interpreter"));
+        return NULL;
+    }
+    if (!g) {
+        // referenced by parked go blocks only, the collector needs a root
+        g = heap_make_static(heap_calloc(1, sizeof(Green)));
+        g->thread = pthread_self();
+        interp->green = g;
+    }
+    return g;
+}
+
+/*
+ * Scheduling
+ */
+static void green_runq_push(Green *g, GreenTask *task)
+{
+    task->next = NULL;
+    if (g->runq_tail) {
+        g->runq_tail->next = task;
+    } else {
+        g->runq_head = task;
+    }
+    g->runq_tail = task;
+}
+
+static GreenTask *green_runq_pop(Green *g)
+{
+    GreenTask *task = g->runq_head;
+    if (task) {
+        g->runq_head = task->next;
+        if (!g->runq_head) {
+            g->runq_tail = NULL;
+        }
+    }
+    return task;
+}
+
+static void green_run(Green *g, GreenTask *task)
+{
+    // the host collects between the turns of the go blocks
+    heap_safepoint();
+    if (!task->stack && !green_start(g, task)) {
+        green_finish(g, task, value_make_exception("Failed to map the stack of a go block"));
+        return;
+    }
+    g->current = task;
+    heap_stack_switch(&task->scan);
+    swapcontext(&g->host, &task->ctx);
+    heap_stack_switch(NULL);
+    if (task->finished) {
+        green_end(g, task);
+    }
+}
+
+/* parks the current go block until something queues it again */
+static __attribute__((noinline)) void green_park(Green *g)
+{
+    GreenTask *task = g->current;
+    g->current = NULL;
+    task->scan.top = green_stack_pointer();
+    swapcontext(&task->ctx, &g->host);
+}
+
+static bool green_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+static void green_fire_timers(Green *g)
+{
+    if (!g->timers) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (g->timers && green_before(&g->timers->deadline, &now)) {
+        GreenTimer *timer = g->timers;
+        g->timers = timer->next;
+        green_chan_close(g, timer->chan);
+    }
+}
+
+/*
+ * Runs go blocks on the host until alt is done, sleeping while only
+ * timers are left. Returns false if nothing is left that could complete
+ * alt.
+ */
+static bool green_run_until(Green *g, GreenAlt *alt)
+{
+    while (!alt->done) {
+        green_fire_timers(g);
+        if (alt->done) {
+            break;
+        }
+        GreenTask *task = green_runq_pop(g);
+        if (task) {
+            green_run(g, task);
+        } else if (g->timers) {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &g->timers->deadline, NULL);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* gives each go block that can run one turn on the host */
+static void green_run_round(Green *g)
+{
+    green_fire_timers(g);
+    GreenTask *last = g->runq_tail;
+    GreenTask *task;
+    while (last && (task = green_runq_pop(g))) {
+        green_run(g, task);
+        if (task == last) {
+            break;
+        }
+    }
+}
+
+void green_yield()
+{
+    Interpreter *interp = interp_current();
+    Green *g = interp->root->green;
+    if (!g || interp != interp->root || !pthread_equal(g->thread, pthread_self())
+            || exc_is_pending()) {
+        return;
+    }
+    // a go block also yields to let the host collect
+    if (g->current) {
+        green_runq_push(g, g->current);
+        green_park(g);
+    } else if (g->runq_head || g->timers) {
+        green_run_round(g);
+    }
+}
+
+/*
+ * Channels
+ */
+static void green_wait_on(GreenWaiter **head, GreenWaiter **tail,
+                          GreenAlt *alt, Value *value)
+{
+    GreenWaiter *w = heap_malloc(sizeof(GreenWaiter));
+    w->alt = alt;
+    w->value = value;
+    w->next = NULL;
+    if (*tail) {
+        (*tail)->next = w;
+    } else {
+        *head = w;
+    }
+    *tail = w;
+}
+
+/* the first waiter whose alt is not done yet, dropping the others */
+static GreenWaiter *green_waiter_pop(GreenWaiter **head, GreenWaiter **tail)
+{
+    while (*head) {
+        GreenWaiter *w = *head;
+        *head = w->next;
+        if (!*head) {
+            *tail = NULL;
+        }
+        if (!w->alt->done) {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static void green_waiter_remove(GreenWaiter **head, GreenWaiter **tail,
+                                const GreenAlt *alt)
+{
+    GreenWaiter *prev = NULL;
+    for (GreenWaiter *w = *head; w; w = w->next) {
+        if (w->alt == alt) {
+            if (prev) {
+                prev->next = w->next;
+            } else {
+                *head = w->next;
+            }
+            if (*tail == w) {
+                *tail = prev;
+            }
+        } else {
+            prev = w;
+        }
+    }
+}
+
+static void green_complete(Green *g, GreenAlt *alt, Value *value, Value *chan)
+{
+    alt->done = true;
+    alt->value = value;
+    alt->chan = chan;
+    if (alt->task) {
+        green_runq_push(g, alt->task);
+    }
+}
+
+static bool green_try_take(Green *g, Value *chan, Value **value)
+{
+    Channel *c = CHANNEL(chan);
+    GreenWaiter *putter;
+    if (c->count > 0) {
+        *value = c->buf[c->head];
+        c->head = (c->head + 1) % c->capacity;
+        c->count--;
+        // a parked put can go through now
+        if ((putter = green_waiter_pop(&c->putters, &c->putters_tail))) {
+            c->buf[(c->head + c->count++) % c->capacity] = putter->value;
+            green_complete(g, putter->alt, VALUE_CONST_TRUE, chan);
+        }
+        return true;
+    }
+    if ((putter = green_waiter_pop(&c->putters, &c->putters_tail))) {
+        *value = putter->value;
+        green_complete(g, putter->alt, VALUE_CONST_TRUE, chan);
+        return true;
+    }
+    if (c->closed) {
+        *value = VALUE_CONST_NIL;
+        return true;
+    }
+    return false;
+}
+
+static bool green_try_put(Green *g, Value *chan, Value *value, Value **ok)
+{
+    Channel *c = CHANNEL(chan);
+    GreenWaiter *taker;
+    if (c->closed) {
+        *ok = VALUE_CONST_FALSE;
+        return true;
+    }
+    if ((taker = green_waiter_pop(&c->takers, &c->takers_tail))) {
+        green_complete(g, taker->alt, value, chan);
+        *ok = VALUE_CONST_TRUE;
+        return true;
+    }
+    if (c->count < c->capacity) {
+        c->buf[(c->head + c->count++) % c->capacity] = value;
+        *ok = VALUE_CONST_TRUE;
+        return true;
+    }
+    return false;
+}
+
+static void green_chan_close(Green *g, Value *chan)
+{
+    Channel *c = CHANNEL(chan);
+    if (c->closed) {
+        return;
+    }
+    c->closed = true;
+    // buffered values can still be taken, so only an empty buffer has takers
+    GreenWaiter *w;
+    while ((w = green_waiter_pop(&c->takers, &c->takers_tail))) {
+        green_complete(g, w->alt, VALUE_CONST_NIL, chan);
+    }
+    while ((w = green_waiter_pop(&c->putters, &c->putters_tail))) {
+        green_complete(g, w->alt, VALUE_CONST_FALSE, chan);
+    }
+}
+
+Value *green_alts(const GreenOp *ops, size_t n, Value **chan)
+{
+    Green *g = green_get();
+    if (!g) {
+        return NULL;
+    }
+    Value *value;
+    for (size_t i = 0; i < n; ++i) {
+        bool ready = ops[i].value ? green_try_put(g, ops[i].chan, ops[i].value, &value)
+                     : green_try_take(g, ops[i].chan, &value);
+        if (ready) {
+            *chan = ops[i].chan;
+            return value;
+        }
+    }
+    // the alt outlives this frame while the go block is parked
+    GreenAlt *alt = heap_calloc(1, sizeof(GreenAlt));
+    alt->task = g->current;
+    for (size_t i = 0; i < n; ++i) {
+        Channel *c = CHANNEL(ops[i].chan);
+        if (ops[i].value) {
+            green_wait_on(&c->putters, &c->putters_tail, alt, ops[i].value);
+        } else {
+            green_wait_on(&c->takers, &c->takers_tail, alt, NULL);
+        }
+    }
+    bool done = true;
+    if (g->current) {
+        green_park(g);
+    } else {
+        done = green_run_until(g, alt);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        Channel *c = CHANNEL(ops[i].chan);
+        green_waiter_remove(&c->takers, &c->takers_tail, alt);
+        green_waiter_remove(&c->putters, &c->putters_tail, alt);
+    }
+    if (!done) {
+        exc_set(value_make_exception("Deadlock: no go block can complete the "
+                                     "channel operation"));
+        return NULL;
+    }
+    *chan = alt->chan;
+    return alt->value;
+}
+
+void green_close(Value *chan)
+{
+    Green *g = green_get();
+    if (g) {
+        green_chan_close(g, chan);
+    }
+}
+
+Value *green_go(Value *fn)
+{
+    Green *g = green_get();
+    if (!g) {
+        return NULL;
+    }
+    GreenTask *task = heap_calloc(1, sizeof(GreenTask));
+    task->fn = fn;
+    task->result = value_new_channel(1);
+    green_runq_push(g, task);
+    return task->result;
+}
+
+Value *green_timeout(long ms)
+{
+    Green *g = green_get();
+    if (!g) {
+        return NULL;
+    }
+    GreenTimer *timer = heap_malloc(sizeof(GreenTimer));
+    clock_gettime(CLOCK_MONOTONIC, &timer->deadline);
+    if (ms > 0) {
+        timer->deadline.tv_sec += ms / 1000;
+        timer->deadline.tv_nsec += (ms % 1000) * 1000000L;
+        if (timer->deadline.tv_nsec >= 1000000000L) {
+            timer->deadline.tv_sec++;
+            timer->deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    timer->chan = value_new_channel(0);
+    GreenTimer **at = &g->timers;
+    while (*at && green_before(&(*at)->deadline, &timer->deadline)) {
+        at = &(*at)->next;
+    }
+    timer->next = *at;
+    *at = timer;
+    return timer->chan;
+}
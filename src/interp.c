@@ -0,0 +1,509 @@
+#include "interp.h"
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+static Interpreter interp_default = {
+    .gc = &gc,
+    .root = &interp_default
+};
+
+static _Thread_local Interpreter *interp_current_ = NULL;
+
+Interpreter *interp_new(void *bos)
+{
+    Interpreter *interp = calloc(1, sizeof(Interpreter));
+    if (!interp) {
+        return NULL;
+    }
+    gc_start(&interp->heap, bos);
+    interp->gc = &interp->heap;
+    interp->root = interp;
+    return interp;
+}
+
+void interp_delete(Interpreter *interp)
+{
+    if (interp->pool) {
+        pool_delete(interp->pool);
+    }
+    if (interp_current_ == interp) {
+        interp_current_ = NULL;
+    }
+    gc_stop(interp->gc);
+    if (interp->shared) {
+        pthread_cond_destroy(&interp->safepoint_changed);
+        pthread_mutex_destroy(&interp->safepoint_lock);
+        pthread_mutex_destroy(&interp->lock);
+    }
+    free(interp);
+}
+
+Interpreter *interp_current()
+{
+    return interp_current_ ? interp_current_ : &interp_default;
+}
+
+Interpreter *interp_enter(Interpreter *interp)
+{
+    Interpreter *prev = interp_current();
+    interp_current_ = interp;
+    return prev;
+}
+
+void interp_share(Interpreter *root)
+{
+    if (!root->shared) {
+        // recursive, the heap is also used while holding it for other state
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&root->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        pthread_mutex_init(&root->safepoint_lock, NULL);
+        pthread_cond_init(&root->safepoint_changed, NULL);
+        atomic_init(&root->collecting, false);
+        atomic_init(&root->allocated, 0);
+        atomic_init(&root->live, 0);
+        // from now on the heap only collects in heap_collect
+        gc_pause(root->gc);
+        root->shared = true;
+    }
+}
+
+void interp_attach(Interpreter *interp, void *bos)
+{
+    Interpreter *root = interp->root;
+    interp->stack_bottom = bos;
+    interp->stack_top = NULL;
+    pthread_mutex_lock(&root->safepoint_lock);
+    // a running collection counts the threads it has to stop
+    while (atomic_load(&root->collecting)) {
+        pthread_cond_wait(&root->safepoint_changed, &root->safepoint_lock);
+    }
+    interp->next_thread = root->threads;
+    root->threads = interp;
+    root->n_threads++;
+    pthread_mutex_unlock(&root->safepoint_lock);
+}
+
+static void heap_cache_release(Interpreter *interp);
+
+void interp_detach(Interpreter *interp)
+{
+    Interpreter *root = interp->root;
+    heap_cache_release(interp);
+    pthread_mutex_lock(&root->safepoint_lock);
+    Interpreter **t = &root->threads;
+    while (*t != interp) {
+        t = &(*t)->next_thread;
+    }
+    *t = interp->next_thread;
+    root->n_threads--;
+    // a collection may be waiting for this thread to stop
+    pthread_cond_broadcast(&root->safepoint_changed);
+    pthread_mutex_unlock(&root->safepoint_lock);
+}
+
+/*
+ * The stopped part of heap_block(): everything above top stays untouched
+ * until the running collection, which copies it, ends.
+ */
+static __attribute__((noinline)) void heap_block_wait(Interpreter *interp, char *top,
+        pthread_mutex_t *mutex, pthread_cond_t *cond)
+{
+    Interpreter *root = interp->root;
+    pthread_mutex_lock(&root->safepoint_lock);
+    interp->stack_top = top;
+    root->n_stopped++;
+    pthread_cond_broadcast(&root->safepoint_changed);
+    pthread_mutex_unlock(&root->safepoint_lock);
+    if (cond) {
+        pthread_cond_wait(cond, mutex);
+    } else if (mutex) {
+        pthread_mutex_lock(mutex);
+    }
+    pthread_mutex_lock(&root->safepoint_lock);
+    while (atomic_load(&root->collecting)) {
+        // other threads may need mutex to get to their safepoints
+        if (mutex) {
+            pthread_mutex_unlock(mutex);
+        }
+        pthread_cond_wait(&root->safepoint_changed, &root->safepoint_lock);
+        if (mutex) {
+            pthread_mutex_unlock(&root->safepoint_lock);
+            pthread_mutex_lock(mutex);
+            pthread_mutex_lock(&root->safepoint_lock);
+        }
+    }
+    root->n_stopped--;
+    interp->stack_top = NULL;
+    pthread_mutex_unlock(&root->safepoint_lock);
+}
+
+/*
+ * Blocks the calling thread, which is not the root and does not hold
+ * the heap lock, on cond, or on mutex if cond is NULL, or until the
+ * running collection ends if both are. Meanwhile the collector scans
+ * what the thread has on its stack.
+ */
+static void heap_block(Interpreter *interp, pthread_mutex_t *mutex, pthread_cond_t *cond)
+{
+    // the registers of the callers, where the collector sees them; the
+    // waiting happens below, so the collector's copy does not race with it
+    jmp_buf regs;
+    setjmp(regs);
+    heap_block_wait(interp, (char *) regs, mutex, cond);
+}
+
+/*
+ * The heap only becomes shared on the thread of the root, before other
+ * threads use it, so checking shared without the lock is safe.
+ */
+static Interpreter *heap_enter()
+{
+    Interpreter *interp = interp_current();
+    Interpreter *root = interp->root;
+    if (root->shared) {
+        if (interp == root || interp->locked > 0) {
+            pthread_mutex_lock(&root->lock);
+        } else if (pthread_mutex_trylock(&root->lock) != 0) {
+            // the root may be holding it while it waits for this thread to stop
+            heap_block(interp, &root->lock, NULL);
+        }
+        interp->locked++;
+    }
+    return root;
+}
+
+static void heap_leave(Interpreter *root)
+{
+    if (root->shared) {
+        interp_current()->locked--;
+        pthread_mutex_unlock(&root->lock);
+    }
+}
+
+void heap_collect()
+{
+    Interpreter *root = heap_enter();
+    assert(root == interp_current() && "Only the root collects");
+    assert(!root->running && "The collector only runs on the thread's own stack");
+    if (!root->shared) {
+        gc_run(root->gc);
+        heap_leave(root);
+        return;
+    }
+    pthread_mutex_lock(&root->safepoint_lock);
+    atomic_store(&root->collecting, true);
+    while (root->n_stopped < root->n_threads) {
+        pthread_cond_wait(&root->safepoint_changed, &root->safepoint_lock);
+    }
+    pthread_mutex_unlock(&root->safepoint_lock);
+    // the collector scans the root's stack itself, the stacks of the
+    // other threads and the root's other stacks and the arguments of
+    // queued tasks in a copy
+    size_t size = 0;
+    for (Interpreter *t = root->threads; t; t = t->next_thread) {
+        size += (size_t) (t->stack_bottom - t->stack_top);
+    }
+    for (HeapStack *stack = root->stacks; stack; stack = stack->next) {
+        size += (size_t) (stack->bottom - stack->top);
+    }
+    size_t n_pending = root->pool ? pool_pending(root->pool, NULL) : 0;
+    char *copy = gc_malloc_static(root->gc, size + (n_pending + 1) * sizeof(void *), NULL);
+    if (copy) {
+        char *p = copy;
+        for (Interpreter *t = root->threads; t; t = t->next_thread) {
+            memcpy(p, t->stack_top, (size_t) (t->stack_bottom - t->stack_top));
+            p += t->stack_bottom - t->stack_top;
+        }
+        for (HeapStack *stack = root->stacks; stack; stack = stack->next) {
+            memcpy(p, stack->top, (size_t) (stack->bottom - stack->top));
+            p += stack->bottom - stack->top;
+        }
+        if (n_pending) {
+            pool_pending(root->pool, (void **) p);
+        }
+        size_t freed = gc_run(root->gc);
+        gc_free(root->gc, copy);
+        // the next collection is due once the heap doubled
+        size_t total = atomic_load(&root->live) + atomic_exchange(&root->allocated, 0);
+        atomic_store(&root->live, total > freed ? total - freed : 0);
+    }
+    heap_leave(root);
+    pthread_mutex_lock(&root->safepoint_lock);
+    atomic_store(&root->collecting, false);
+    pthread_cond_broadcast(&root->safepoint_changed);
+    pthread_mutex_unlock(&root->safepoint_lock);
+}
+
+/* whether a shared heap that allocated this much since the last collection is due */
+static bool heap_collection_due(Interpreter *root, size_t allocated)
+{
+    return allocated >= HEAP_COLLECT_MIN
+           && allocated >= atomic_load_explicit(&root->live, memory_order_relaxed)
+           && atomic_load_explicit(&root->paused, memory_order_relaxed) == 0;
+}
+
+void heap_pause()
+{
+    Interpreter *root = interp_current();
+    if (root == root->root && atomic_fetch_add(&root->paused, 1) == 0
+            && !root->shared) {
+        gc_pause(root->gc);
+    }
+}
+
+void heap_resume()
+{
+    Interpreter *root = interp_current();
+    // a shared heap stays paused, it only collects at safepoints
+    if (root == root->root && atomic_fetch_sub(&root->paused, 1) == 1
+            && !root->shared) {
+        gc_resume(root->gc);
+    }
+}
+
+void heap_safepoint()
+{
+    Interpreter *interp = interp_current();
+    Interpreter *root = interp->root;
+    if (!root->shared) {
+        return;
+    }
+    if (interp == root) {
+        // switched to another stack, the collection waits for the thread's own
+        if (!root->running && heap_collection_due(root, atomic_load_explicit(
+                    &root->allocated, memory_order_relaxed))) {
+            heap_collect();
+        }
+    } else if (interp->locked == 0
+               && atomic_load_explicit(&root->collecting, memory_order_acquire)) {
+        heap_block(interp, NULL, NULL);
+    }
+}
+
+void heap_stack_add(HeapStack *stack)
+{
+    Interpreter *root = interp_current();
+    assert(root == root->root && "Only the root switches stacks");
+    interp_share(root);
+    stack->prev = NULL;
+    stack->next = root->stacks;
+    if (root->stacks) {
+        root->stacks->prev = stack;
+    }
+    root->stacks = stack;
+}
+
+void heap_stack_remove(HeapStack *stack)
+{
+    Interpreter *root = interp_current();
+    if (stack->prev) {
+        stack->prev->next = stack->next;
+    } else {
+        root->stacks = stack->next;
+    }
+    if (stack->next) {
+        stack->next->prev = stack->prev;
+    }
+}
+
+void heap_stack_switch(HeapStack *stack)
+{
+    interp_current()->running = stack;
+}
+
+void heap_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    Interpreter *interp = interp_current();
+    if (interp->root->shared && interp != interp->root) {
+        heap_block(interp, mutex, cond);
+    } else {
+        pthread_cond_wait(cond, mutex);
+    }
+}
+
+/* counts what a shared heap allocated, waking up the root when it should collect */
+static void heap_allocated(Interpreter *root, size_t size)
+{
+    size_t allocated = atomic_fetch_add_explicit(&root->allocated, size,
+                       memory_order_relaxed) + size;
+    if (interp_current() == root) {
+        heap_safepoint();
+    } else if (root->pool && heap_collection_due(root, allocated)
+               && !heap_collection_due(root, allocated - size)) {
+        // the root may be waiting for the pool
+        pool_notify(root->pool);
+    }
+}
+
+static const size_t heap_cache_sizes[HEAP_CACHE_CLASSES] = { 16, 32, 64, 128, 256 };
+
+/* the cache for blocks of size, -1 if there is none */
+static int heap_cache_class(size_t size)
+{
+    for (int k = 0; k < HEAP_CACHE_CLASSES; ++k) {
+        if (size <= heap_cache_sizes[k]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* a zeroed block of class k from the cache of the calling thread */
+static void *heap_cache_take(Interpreter *interp, int k)
+{
+    HeapCache *cache = &interp->cache;
+    if (cache->count[k] == 0) {
+        size_t n = HEAP_CACHE_REFILL / heap_cache_sizes[k];
+        Interpreter *root = heap_enter();
+        if (!cache->blocks[k]) {
+            cache->blocks[k] = gc_calloc(root->gc, n, sizeof(void *));
+            if (cache->blocks[k]) {
+                gc_make_static(root->gc, cache->blocks[k]);
+            }
+        }
+        while (cache->blocks[k] && cache->count[k] < n) {
+            void *ptr = gc_calloc(root->gc, 1, heap_cache_sizes[k]);
+            if (!ptr) {
+                break;
+            }
+            cache->blocks[k][cache->count[k]++] = ptr;
+        }
+        heap_leave(root);
+        heap_allocated(root, HEAP_CACHE_REFILL);
+        if (cache->count[k] == 0) {
+            return NULL;
+        }
+    }
+    void *ptr = cache->blocks[k][--cache->count[k]];
+    cache->blocks[k][cache->count[k]] = NULL;
+    return ptr;
+}
+
+/* frees the cache of a thread that stops using the heap */
+static void heap_cache_release(Interpreter *interp)
+{
+    Interpreter *root = heap_enter();
+    for (int k = 0; k < HEAP_CACHE_CLASSES; ++k) {
+        if (interp->cache.blocks[k]) {
+            // the blocks left are garbage now
+            gc_free(root->gc, interp->cache.blocks[k]);
+            interp->cache.blocks[k] = NULL;
+            interp->cache.count[k] = 0;
+        }
+    }
+    heap_leave(root);
+}
+
+/* a block from the cache if the heap is shared and size fits, or NULL */
+static void *heap_cache_malloc(size_t size)
+{
+    Interpreter *interp = interp_current();
+    int k;
+    if (!interp->root->shared || (k = heap_cache_class(size)) < 0) {
+        return NULL;
+    }
+    return heap_cache_take(interp, k);
+}
+
+void *heap_malloc(size_t size)
+{
+    void *ptr = heap_cache_malloc(size);
+    if (ptr) {
+        return ptr;
+    }
+    Interpreter *root = heap_enter();
+    ptr = gc_malloc(root->gc, size);
+    heap_leave(root);
+    if (root->shared) {
+        heap_allocated(root, size);
+    }
+    return ptr;
+}
+
+void *heap_malloc_ext(size_t size, void (*dtor)(void *))
+{
+    Interpreter *root = heap_enter();
+    void *ptr = gc_malloc_ext(root->gc, size, dtor);
+    heap_leave(root);
+    if (root->shared) {
+        heap_allocated(root, size);
+    }
+    return ptr;
+}
+
+void *heap_calloc(size_t count, size_t size)
+{
+    // cached blocks are zeroed
+    void *ptr = size && count <= SIZE_MAX / size ? heap_cache_malloc(count * size) : NULL;
+    if (ptr) {
+        return ptr;
+    }
+    Interpreter *root = heap_enter();
+    ptr = gc_calloc(root->gc, count, size);
+    heap_leave(root);
+    if (root->shared) {
+        heap_allocated(root, count * size);
+    }
+    return ptr;
+}
+
+void *heap_realloc(void *ptr, size_t size)
+{
+    Interpreter *root = heap_enter();
+    ptr = gc_realloc(root->gc, ptr, size);
+    heap_leave(root);
+    if (root->shared) {
+        heap_allocated(root, size);
+    }
+    return ptr;
+}
+
+void heap_free(void *ptr)
+{
+    Interpreter *root = heap_enter();
+    gc_free(root->gc, ptr);
+    heap_leave(root);
+}
+
+char *heap_strdup(const char *s)
+{
+    size_t size = strlen(s) + 1;
+    char *ptr = heap_cache_malloc(size);
+    if (ptr) {
+        return memcpy(ptr, s, size);
+    }
+    Interpreter *root = heap_enter();
+    ptr = gc_strdup(root->gc, s);
+    heap_leave(root);
+    if (root->shared) {
+        heap_allocated(root, size);
+    }
+    return ptr;
+}
+
+void *heap_make_static(void *ptr)
+{
+    Interpreter *root = heap_enter();
+    ptr = gc_make_static(root->gc, ptr);
+    heap_leave(root);
+    return ptr;
+}
+
+void heap_lock()
+{
+    heap_enter();
+}
+
+void heap_unlock()
+{
+    heap_leave(interp_current()->root);
+}
@@ -1,4 +1,5 @@
 #include "ir.h"
+#include "interp.h"
 #include "log.h"
 
 Value *ir_from_ast(AstSexpr *ast)
@@ -29,59 +30,94 @@ Value *ir_from_ast_atom(AstAtom *atom)
     return v;
 }
 
-Value *ir_from_ast_list(AstList *ast_list)
+/*
+ * The AST is converted without recursion: every open list or quote is a
+ * frame on an explicit stack, and list elements are appended in order.
+ */
+typedef struct {
+    ListBuilder items;
+    bool quote;     /* completes after a single quoted sexpr */
+    AstList *rest;  /* elements of a list that are still to be converted */
+} IrFrame;
+
+static const char *ir_quote_symbol(AstNodeType type)
 {
-    if (ast_list->node.type == AST_LIST_EMPTY) {
-        return value_new_list(NULL);
+    switch (type) {
+    case AST_SEXPR_QUOTE:
+        return "quote";
+    case AST_SEXPR_QUASIQUOTE:
+        return "quasiquote";
+    case AST_SEXPR_UNQUOTE:
+        return "unquote";
+    default:
+        return "splice-unquote";
     }
-    Value *sexpr = ir_from_ast_sexpr(ast_list->as.compound.sexpr);
-    Value *list = ir_from_ast_list(ast_list->as.compound.list);
-    list->value.list = list_prepend(list->value.list, sexpr);
-    return list;
+}
+
+Value *ir_from_ast_list(AstList *ast_list)
+{
+    AstSexpr sexpr = {
+        .node = { .type = AST_SEXPR_LIST },
+        .as = { .list = ast_list }
+    };
+    return ir_from_ast_sexpr(&sexpr);
 }
 
 Value *ir_from_ast_sexpr(AstSexpr *ast)
 {
     if (!ast) return NULL;
-    Value *result;
-    Value *quote;
-    Value *sexpr;
-    switch (ast->node.type) {
-    case AST_SEXPR_ATOM:
-        result = ir_from_ast_atom(ast->as.atom);
-        break;
-    case AST_SEXPR_LIST:
-        result =  ir_from_ast_list(ast->as.list);
-        break;
-    case AST_SEXPR_QUOTE:
-        result = value_new_list(NULL);
-        sexpr = ir_from_ast_sexpr(ast->as.quoted);
-        quote = value_new_symbol("quote");
-        result->value.list = list_append(result->value.list, quote);
-        result->value.list = list_append(result->value.list, sexpr);
-        break;
-    case AST_SEXPR_QUASIQUOTE:
-        result = value_new_list(NULL);
-        sexpr = ir_from_ast_sexpr(ast->as.quoted);
-        quote = value_new_symbol("quasiquote");
-        result->value.list = list_append(result->value.list, quote);
-        result->value.list = list_append(result->value.list, sexpr);
-        break;
-    case AST_SEXPR_UNQUOTE:
-        result = value_new_list(NULL);
-        sexpr = ir_from_ast_sexpr(ast->as.quoted);
-        quote = value_new_symbol("unquote");
-        result->value.list = list_append(result->value.list, quote);
-        result->value.list = list_append(result->value.list, sexpr);
-        break;
-    case AST_SEXPR_SPLICE_UNQUOTE:
-        result = value_new_list(NULL);
-        sexpr = ir_from_ast_sexpr(ast->as.quoted);
-        quote = value_new_symbol("splice-unquote");
-        result->value.list = list_append(result->value.list, quote);
-        result->value.list = list_append(result->value.list, sexpr);
-        break;
+    // GC-allocated so the partially built lists stay reachable
+    size_t size = 0, capacity = 16;
+    IrFrame *frames = heap_malloc(capacity * sizeof(IrFrame));
+    Value *result = NULL;
+    while (true) {
+        if (size == capacity) {
+            capacity *= 2;
+            frames = heap_realloc(frames, capacity * sizeof(IrFrame));
+        }
+        // descend until a value is complete or a new list is opened
+        bool complete = false;
+        IrFrame *f = &frames[size];
+        switch (ast->node.type) {
+        case AST_SEXPR_ATOM:
+            result = ir_from_ast_atom(ast->as.atom);
+            complete = true;
+            break;
+        case AST_SEXPR_LIST:
+            list_builder_init(&f->items);
+            f->quote = false;
+            f->rest = ast->as.list;
+            size++;
+            break;
+        default:
+            list_builder_init(&f->items);
+            f->quote = true;
+            f->rest = NULL;
+            size++;
+            list_builder_append(&f->items, value_new_symbol(ir_quote_symbol(ast->node.type)));
+            ast = ast->as.quoted;
+            continue;
+        }
+        // ascend, handing complete values to the enclosing frames
+        while (size > 0) {
+            f = &frames[size - 1];
+            if (complete) {
+                list_builder_append(&f->items, result);
+            }
+            if (!f->quote && f->rest->node.type == AST_LIST_COMPOUND) {
+                ast = f->rest->as.compound.sexpr;
+                f->rest = f->rest->as.compound.list;
+                break;
+            }
+            result = value_new_list(NULL);
+            result->value.list = list_builder_finish(&f->items);
+            size--;
+            complete = true;
+        }
+        if (size == 0) {
+            break;
+        }
     }
+    heap_free(frames);
     return result;
 }
-
@@ -1,5 +1,7 @@
 #include "lexer.h"
+#include "number.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -15,10 +17,11 @@ const char *token_type_names[] = {
     "LEXER_TOK_QUASIQUOTE",
     "LEXER_TOK_UNQUOTE",
     "LEXER_TOK_SPLICE_UNQUOTE",
+    "LEXER_TOK_KEYWORD",
     "LEXER_TOK_EOF"
 };
 
-static char *symbol_chars = "!&*+-0123456789<=>?@"
+static char *symbol_chars = "!&*+-/0123456789<=>?@"
                             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                             "abcdefghijklmnopqrstuvwxyz";
 
@@ -32,6 +35,8 @@ typedef enum {
     KEY_CR  = 13
 } EscapeChars;
 
+static LexerToken *lexer_get_token_from_buffer(Lexer *l);
+
 Lexer *lexer_new(FILE *fp)
 {
     Lexer *lexer = (Lexer *) malloc(sizeof(Lexer));
@@ -44,6 +49,22 @@ Lexer *lexer_new(FILE *fp)
     return lexer;
 }
 
+Lexer *lexer_new_from_buffer(const char *buf, size_t size)
+{
+    Lexer *lexer = (Lexer *) malloc(sizeof(Lexer));
+    *lexer = (Lexer) {
+        .fp = NULL,
+        .state = LEXER_STATE_ZERO,
+        .line_no = 1,
+        .char_no = 0,
+        .buf = buf,
+        .size = size,
+        .pos = 0,
+        .line_start = 0
+    };
+    return lexer;
+}
+
 void lexer_delete(Lexer *l)
 {
     free(l);
@@ -66,6 +87,7 @@ void lexer_delete_token(LexerToken *t)
         case LEXER_TOK_QUASIQUOTE:
         case LEXER_TOK_UNQUOTE:
         case LEXER_TOK_SPLICE_UNQUOTE:
+        case LEXER_TOK_KEYWORD:
             free(t->as.str);
             break;
         }
@@ -84,10 +106,10 @@ static LexerToken *lexer_make_token(const Lexer *l,
         tok->column = l->char_no;
         switch(token_type) {
         case LEXER_TOK_INT:
-            tok->as.int_ = atoi(buf);
+            tok->as.int_ = number_parse_int(buf, strlen(buf));
             break;
         case LEXER_TOK_FLOAT:
-            tok->as.double_ = atof(buf);
+            tok->as.double_ = number_parse_float(buf, strlen(buf));
             break;
         case LEXER_TOK_STRING:
         case LEXER_TOK_ERROR:
@@ -98,6 +120,7 @@ static LexerToken *lexer_make_token(const Lexer *l,
         case LEXER_TOK_QUASIQUOTE:
         case LEXER_TOK_UNQUOTE:
         case LEXER_TOK_SPLICE_UNQUOTE:
+        case LEXER_TOK_KEYWORD:
             tok->as.str = strdup(buf);
             break;
         case LEXER_TOK_EOF:
@@ -121,6 +144,9 @@ static void lexer_advance_next_line(Lexer *l)
 
 LexerToken *lexer_get_token(Lexer *l)
 {
+    if (l->buf) {
+        return lexer_get_token_from_buffer(l);
+    }
     char buf[1024] = {0};
     size_t bufpos = 0;
     int c;
@@ -159,6 +185,11 @@ LexerToken *lexer_get_token(Lexer *l)
                 /* don't put c in the buffer */
                 l->state = LEXER_STATE_STRING;
                 break;
+            /* start a keyword */
+            case ':':
+                /* don't put c in the buffer either */
+                l->state = LEXER_STATE_KEYWORD;
+                break;
             /* start  number */
             case '0' ... '9':
                 buf[bufpos++] = c;
@@ -386,6 +417,19 @@ LexerToken *lexer_get_token(Lexer *l)
                 return lexer_make_token(l, LEXER_TOK_SYMBOL, buf);
             }
             break;
+        case LEXER_STATE_KEYWORD:
+            pos = strchr(symbol_chars, c);
+            if (pos != NULL) {
+                buf[bufpos++] = c;
+            } else {
+                ungetc(c, l->fp);
+                l->char_no--;
+                l->state = LEXER_STATE_ZERO;
+                /* a colon on its own is not a keyword */
+                return bufpos > 0 ? lexer_make_token(l, LEXER_TOK_KEYWORD, buf)
+                       : lexer_make_token(l, LEXER_TOK_ERROR, ":");
+            }
+            break;
         default:
             buf[bufpos++] = c;
             return lexer_make_token(l, LEXER_TOK_ERROR, buf);
@@ -405,8 +449,297 @@ LexerToken *lexer_get_token(Lexer *l)
     case LEXER_STATE_SYMBOL:
         l->state = LEXER_STATE_ZERO;
         return lexer_make_token(l, LEXER_TOK_SYMBOL, buf);
+    case LEXER_STATE_KEYWORD:
+        l->state = LEXER_STATE_ZERO;
+        return bufpos > 0 ? lexer_make_token(l, LEXER_TOK_KEYWORD, buf)
+               : lexer_make_token(l, LEXER_TOK_ERROR, ":");
     default:
         return lexer_make_token(l, LEXER_TOK_ERROR, buf);
     }
 }
 
+/*
+ * Buffer mode
+ *
+ * Scans a contiguous source buffer and yields tokens as slices into that
+ * buffer. The token grammar is identical to the stream lexer above, but
+ * instead of a per-character state machine we dispatch on character
+ * classes and scan whole tokens in tight loops.
+ */
+
+enum {
+    CC_SPACE        = 1 << 0, /* skipped between tokens */
+    CC_DELIMITER    = 1 << 1, /* may directly follow a number */
+    CC_DIGIT        = 1 << 2,
+    CC_SYMBOL_START = 1 << 3, /* may start a symbol */
+    CC_SYMBOL       = 1 << 4, /* may continue a symbol */
+    CC_MINUS_SYMBOL = 1 << 5  /* turns a leading '-' into a symbol */
+};
+
+#define N 0
+#define W (CC_SPACE | CC_DELIMITER)
+#define P (CC_DELIMITER)
+#define D (CC_DIGIT | CC_SYMBOL)
+#define L (CC_SYMBOL_START | CC_SYMBOL | CC_MINUS_SYMBOL)
+#define F (CC_SYMBOL_START | CC_MINUS_SYMBOL)
+#define A (CC_SYMBOL_START | CC_SYMBOL)
+#define C (CC_SYMBOL)
+
+static const unsigned char char_class[256] = {
+    /* 0x00 */ N, N, N, N, N, N, N, N, N, W, W, N, N, W, N, N,
+    /* 0x10 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0x20 */ W, C, N, N, N, N, A, N, P, P, L, L, N, C, N, L,
+    /* 0x30 */ D, D, D, D, D, D, D, D, D, D, N, N, L, L, L, C,
+    /* 0x40 */ C, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    /* 0x50 */ L, L, L, L, L, L, L, L, L, L, L, N, N, N, N, N,
+    /* 0x60 */ N, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    /* 0x70 */ L, L, L, L, L, L, L, L, L, L, L, N, N, N, N, N,
+    /* 0x80 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0x90 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xa0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xb0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xc0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xd0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xe0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 0xf0 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N
+};
+
+#undef N
+#undef W
+#undef P
+#undef D
+#undef L
+#undef F
+#undef A
+#undef C
+
+/* single character tokens; everything else maps to LEXER_TOK_ERROR */
+static const unsigned char char_token[256] = {
+    ['('] = LEXER_TOK_LPAREN,
+    [')'] = LEXER_TOK_RPAREN,
+    ['\''] = LEXER_TOK_QUOTE,
+    ['`'] = LEXER_TOK_QUASIQUOTE
+};
+
+static size_t scan_digits(const unsigned char *s, size_t n, size_t pos)
+{
+    while (pos < n && (char_class[s[pos]] & CC_DIGIT)) pos++;
+    return pos;
+}
+
+static size_t scan_symbol(const unsigned char *s, size_t n, size_t pos)
+{
+    while (pos < n && (char_class[s[pos]] & CC_SYMBOL)) pos++;
+    return pos;
+}
+
+static TokenType scan_number(const unsigned char *s, size_t n, size_t *pos)
+{
+    /* [-]digits[.digits] or -.digits, *pos is past the sign */
+    TokenType type = LEXER_TOK_INT;
+    size_t p = scan_digits(s, n, *pos);
+    if (p < n && s[p] == '.') {
+        type = LEXER_TOK_FLOAT;
+        p = scan_digits(s, n, p + 1);
+    }
+    if (p < n && !(char_class[s[p]] & CC_DELIMITER)) {
+        /* junk after the number, make it part of the error token */
+        type = LEXER_TOK_ERROR;
+        p++;
+    }
+    *pos = p;
+    return type;
+}
+
+void lexer_next_slice(Lexer *l, LexerSlice *tok)
+{
+    const unsigned char *s = (const unsigned char *) l->buf;
+    const size_t n = l->size;
+    size_t pos = l->pos;
+
+    /* skip whitespace and comments */
+    while (pos < n) {
+        if (char_class[s[pos]] & CC_SPACE) {
+            if (s[pos] == '\n') {
+                l->line_no++;
+                l->line_start = pos + 1;
+            }
+            pos++;
+        } else if (s[pos] == ';') {
+            const unsigned char *eol = memchr(s + pos, '\n', n - pos);
+            pos = eol ? (size_t) (eol - s) : n;
+        } else {
+            break;
+        }
+    }
+
+    size_t start = pos;
+    tok->line = l->line_no;
+    tok->column = start - l->line_start + 1;
+    if (pos == n) {
+        tok->type = LEXER_TOK_EOF;
+    } else {
+        unsigned char c = s[pos];
+        unsigned char cls = char_class[c];
+        if (cls & CC_DIGIT) {
+            tok->type = scan_number(s, n, &pos);
+        } else if (cls & CC_SYMBOL_START) {
+            tok->type = LEXER_TOK_SYMBOL;
+            pos = scan_symbol(s, n, pos + 1);
+        } else if (c == '-') {
+            /* symbols that start with a dash ("-main"), negative numbers
+             * (-1, -2.4, -.7), and the subtraction operator (- 3 1) */
+            pos++;
+            if (pos == n) {
+                tok->type = LEXER_TOK_ERROR;
+            } else if (char_class[s[pos]] & CC_DIGIT || s[pos] == '.') {
+                tok->type = scan_number(s, n, &pos);
+            } else if (char_class[s[pos]] & CC_MINUS_SYMBOL) {
+                tok->type = LEXER_TOK_SYMBOL;
+                pos = scan_symbol(s, n, pos);
+            } else if (char_class[s[pos]] & CC_SPACE) {
+                tok->type = LEXER_TOK_SYMBOL;
+            } else {
+                tok->type = LEXER_TOK_ERROR;
+                pos++;
+            }
+        } else if (c == '"') {
+            /* the slice excludes the quotes */
+            start = ++pos;
+            while (pos < n && s[pos] != '"') {
+                if (s[pos] == '\\') pos++;
+                if (pos < n && s[pos] == '\n') {
+                    l->line_no++;
+                    l->line_start = pos + 1;
+                }
+                pos++;
+            }
+            if (pos < n) {
+                tok->type = LEXER_TOK_STRING;
+                tok->offset = start;
+                tok->length = pos - start;
+                l->pos = pos + 1;
+                l->char_no = l->pos - l->line_start;
+                return;
+            }
+            tok->type = LEXER_TOK_ERROR;
+            pos = n;
+        } else if (c == ':') {
+            /* the slice excludes the colon */
+            start = ++pos;
+            pos = scan_symbol(s, n, pos);
+            tok->type = pos > start ? LEXER_TOK_KEYWORD : LEXER_TOK_ERROR;
+        } else if (c == '~') {
+            pos++;
+            if (pos == n) {
+                tok->type = LEXER_TOK_ERROR;
+            } else if (s[pos] == '@') {
+                tok->type = LEXER_TOK_SPLICE_UNQUOTE;
+                pos++;
+            } else {
+                tok->type = LEXER_TOK_UNQUOTE;
+            }
+        } else {
+            tok->type = char_token[c];
+            pos++;
+        }
+    }
+    tok->offset = start;
+    tok->length = pos - start;
+    l->pos = pos;
+    l->char_no = pos - l->line_start;
+}
+
+int lexer_slice_int(const Lexer *l, const LexerSlice *tok)
+{
+    return number_parse_int(l->buf + tok->offset, tok->length);
+}
+
+double lexer_slice_float(const Lexer *l, const LexerSlice *tok)
+{
+    return number_parse_float(l->buf + tok->offset, tok->length);
+}
+
+size_t lexer_slice_str(const Lexer *l, const LexerSlice *tok, char *dst)
+{
+    const char *src = l->buf + tok->offset;
+    size_t n = tok->length;
+    if (tok->type != LEXER_TOK_STRING) {
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+        return n;
+    }
+    /* supports all C escape sequences except for hex and octal */
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (src[i] != '\\' || i + 1 == n) {
+            dst[len++] = src[i];
+            continue;
+        }
+        switch (src[++i]) {
+        case '\n':
+            /* ignore escaped line feeds */
+            break;
+        case '\\':
+        case '"':
+            dst[len++] = src[i];
+            break;
+        case 'a':
+            dst[len++] = KEY_BEL;
+            break;
+        case 'b':
+            dst[len++] = KEY_BS;
+            break;
+        case 'f':
+            dst[len++] = KEY_FF;
+            break;
+        case 'n':
+            dst[len++] = KEY_LF;
+            break;
+        case 'r':
+            dst[len++] = KEY_CR;
+            break;
+        case 't':
+            dst[len++] = KEY_HT;
+            break;
+        case 'v':
+            dst[len++] = KEY_VT;
+            break;
+        default:
+            /* invalid escape sequence, keep it */
+            dst[len++] = '\\';
+            dst[len++] = src[i];
+            break;
+        }
+    }
+    dst[len] = '\0';
+    return len;
+}
+
+static LexerToken *lexer_get_token_from_buffer(Lexer *l)
+{
+    LexerSlice slice;
+    lexer_next_slice(l, &slice);
+    LexerToken *tok = (LexerToken *) malloc(sizeof(LexerToken));
+    if (tok) {
+        tok->type = slice.type;
+        tok->line = slice.line;
+        tok->column = slice.column;
+        switch(slice.type) {
+        case LEXER_TOK_INT:
+            tok->as.int_ = lexer_slice_int(l, &slice);
+            break;
+        case LEXER_TOK_FLOAT:
+            tok->as.double_ = lexer_slice_float(l, &slice);
+            break;
+        case LEXER_TOK_EOF:
+            tok->as.str = NULL;
+            break;
+        default:
+            tok->as.str = (char *) malloc(slice.length + 1);
+            lexer_slice_str(l, &slice, tok->as.str);
+            break;
+        }
+    }
+    return tok;
+}
@@ -0,0 +1,86 @@
+#include "linereader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void line_reader_init(LineReader *r, int fd)
+{
+    r->fd = fd;
+    r->capacity = LINE_READER_BUFFER_SIZE;
+    r->data = malloc(r->capacity);
+    r->start = r->scanned = r->end = 0;
+    r->eof = false;
+    r->error = 0;
+}
+
+void line_reader_destroy(LineReader *r)
+{
+    free(r->data);
+    r->data = NULL;
+    r->start = r->scanned = r->end = r->capacity = 0;
+}
+
+/*
+ * Makes room after the buffered input, first by dropping the lines that
+ * were already returned, then by growing the buffer for long lines.
+ */
+static void line_reader_reserve(LineReader *r)
+{
+    if (r->start > 0) {
+        memmove(r->data, r->data + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->scanned -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->capacity) {
+        r->capacity *= 2;
+        r->data = realloc(r->data, r->capacity);
+    }
+}
+
+static char *line_reader_take(LineReader *r, size_t end, size_t next, size_t *n)
+{
+    char *line = r->data + r->start;
+    if (end > r->start && r->data[end - 1] == '\r') {
+        end--;
+    }
+    r->data[end] = '\0';
+    *n = end - r->start;
+    r->start = r->scanned = next;
+    return line;
+}
+
+char *line_reader_next(LineReader *r, size_t *n)
+{
+    while (true) {
+        char *newline = memchr(r->data + r->scanned, '\n', r->end - r->scanned);
+        if (newline) {
+            size_t end = newline - r->data;
+            return line_reader_take(r, end, end + 1, n);
+        }
+        r->scanned = r->end;
+        if (r->eof || r->error) {
+            if (r->start == r->end) {
+                return NULL;
+            }
+            // the last line has no newline that could hold the NUL
+            if (r->end == r->capacity) {
+                line_reader_reserve(r);
+            }
+            return line_reader_take(r, r->end, r->end, n);
+        }
+        if (r->end == r->capacity) {
+            line_reader_reserve(r);
+        }
+        ssize_t k = read(r->fd, r->data + r->end, r->capacity - r->end);
+        if (k > 0) {
+            r->end += (size_t) k;
+        } else if (k == 0) {
+            r->eof = true;
+        } else if (errno != EINTR) {
+            r->error = errno;
+        }
+    }
+}
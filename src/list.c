@@ -1,5 +1,6 @@
 #include "list.h"
 #include "gc.h"
+#include "interp.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -15,7 +16,7 @@
  */
 static ListItem *list_item_new(const struct Value *value)
 {
-    ListItem *item = (ListItem *) gc_calloc(&gc, 1, sizeof(ListItem));
+    ListItem *item = (ListItem *) heap_calloc(1, sizeof(ListItem));
     item->val = value;
     return item;
 }
@@ -32,7 +33,7 @@ static ListItem *list_item_new(const struct Value *value)
  */
 static List *list_mutable_copy(const List *l)
 {
-    List *copy = gc_calloc(&gc, 1, sizeof(List));
+    List *copy = heap_calloc(1, sizeof(List));
     ListItem **q = &copy->head;
     ListItem *const *p = &l->head;
     while (*p) {
@@ -46,7 +47,7 @@ static List *list_mutable_copy(const List *l)
 
 const List *list_new()
 {
-    List *list = (List *) gc_calloc(&gc, 1, sizeof(List));
+    List *list = (List *) heap_calloc(1, sizeof(List));
     return list;
 }
 
@@ -70,13 +71,35 @@ const List *list_append(const List *l, const struct Value *value)
 
 const List *list_prepend(const List *l, const struct Value *value)
 {
-    // O(1) prepend at start of list
-    List *copy = list_mutable_copy(l);
+    // O(1) prepend at start of list, sharing the items of l, which is
+    // fine since the items of a list are never modified
+    List *list = (List *) heap_calloc(1, sizeof(List));
     ListItem *item = list_item_new(value);
-    item->next = copy->head;
-    copy->head = item;
-    copy->size++;
-    return copy;
+    item->next = l->head;
+    list->head = item;
+    list->size = l->size + 1;
+    return list;
+}
+
+void list_builder_init(ListBuilder *b)
+{
+    b->list = (List *) heap_calloc(1, sizeof(List));
+    b->tail = &b->list->head;
+}
+
+void list_builder_append(ListBuilder *b, const struct Value *value)
+{
+    *b->tail = list_item_new(value);
+    b->tail = &(*b->tail)->next;
+    b->list->size++;
+}
+
+const List *list_builder_finish(ListBuilder *b)
+{
+    const List *l = b->list;
+    b->list = NULL;
+    b->tail = NULL;
+    return l;
 }
 
 const struct Value *list_head(const List *l)
@@ -89,7 +112,7 @@ const List *list_tail(const List *l)
 {
     if (l) {
         // flat copy
-        List *tail = (List *) gc_calloc(&gc, 1, sizeof(List));
+        List *tail = (List *) heap_calloc(1, sizeof(List));
         if (l->size > 1) {
             tail->head = l->head->next;
             tail->size = l->size - 1;
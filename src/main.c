@@ -11,6 +11,7 @@
 #include "eval.h"
 #include "exc.h"
 #include "gc.h"
+#include "interp.h"
 #include "list.h"
 #include "log.h"
 #include "parser.h"
@@ -18,9 +19,7 @@
 
 Value *core_read_string(const Value *args);
 Value *core_eval(const Value *str);
-
-/* The global environment */
-Environment *ENV;
+Value *core_load_file(const Value *args);
 
 Environment *global_env()
 {
@@ -33,10 +32,13 @@ Environment *global_env()
     env_set(env, "true?", value_new_builtin_fn(core_is_true));
     env_set(env, "false?", value_new_builtin_fn(core_is_false));
     env_set(env, "symbol?", value_new_builtin_fn(core_is_symbol));
+    env_set(env, "keyword", value_new_builtin_fn(core_keyword));
+    env_set(env, "keyword?", value_new_builtin_fn(core_is_keyword));
 
     env_set(env, "pr", value_new_builtin_fn(core_pr));
     env_set(env, "pr-str", value_new_builtin_fn(core_pr_str));
     env_set(env, "prn", value_new_builtin_fn(core_prn));
+    env_set(env, "flush", value_new_builtin_fn(core_flush));
 
     Value *add = value_new_builtin_fn(core_add);
     env_set(env, "+", add);
@@ -77,44 +79,72 @@ Environment *global_env()
 
     env_set(env, "symbol", value_new_builtin_fn(core_symbol));
     env_set(env, "str", value_new_builtin_fn(core_str));
+    env_set(env, "subs", value_new_builtin_fn(core_subs));
     env_set(env, "slurp", value_new_builtin_fn(core_slurp));
+    env_set(env, "line-seq", value_new_builtin_fn(core_line_seq));
+    env_set(env, "read-line", value_new_builtin_fn(core_read_line));
     env_set(env, "eval", value_new_builtin_fn(core_eval));
     env_set(env, "read-string", value_new_builtin_fn(core_read_string));
+    env_set(env, "load-file", value_new_builtin_fn(core_load_file));
 
     env_set(env, "cons", value_new_builtin_fn(core_cons));
     env_set(env, "concat", value_new_builtin_fn(core_concat));
 
     env_set(env, "map", value_new_builtin_fn(core_map));
+    env_set(env, "reduce", value_new_builtin_fn(core_reduce));
+    env_set(env, "filter", value_new_builtin_fn(core_filter));
+    env_set(env, "remove", value_new_builtin_fn(core_remove));
+    env_set(env, "some", value_new_builtin_fn(core_some));
+    env_set(env, "every?", value_new_builtin_fn(core_every));
+
+    env_set(env, "range", value_new_builtin_fn(core_range));
+    env_set(env, "iterate", value_new_builtin_fn(core_iterate));
+    env_set(env, "take", value_new_builtin_fn(core_take));
+    env_set(env, "drop", value_new_builtin_fn(core_drop));
+    env_set(env, "partition-all", value_new_builtin_fn(core_partition_all));
+
+    env_set(env, "comp", value_new_builtin_fn(core_comp));
+    env_set(env, "transduce", value_new_builtin_fn(core_transduce));
+    env_set(env, "into", value_new_builtin_fn(core_into));
+    env_set(env, "transient", value_new_builtin_fn(core_transient));
+    env_set(env, "conj!", value_new_builtin_fn(core_conj_bang));
+    env_set(env, "assoc!", value_new_builtin_fn(core_assoc_bang));
+    env_set(env, "persistent!", value_new_builtin_fn(core_persistent_bang));
     env_set(env, "apply", value_new_builtin_fn(core_apply));
 
+    env_set(env, "future-call", value_new_builtin_fn(core_future_call));
+    env_set(env, "promise", value_new_builtin_fn(core_promise));
+    env_set(env, "deliver", value_new_builtin_fn(core_deliver));
+    env_set(env, "deref", value_new_builtin_fn(core_deref));
+    env_set(env, "realized?", value_new_builtin_fn(core_is_realized));
+    env_set(env, "atom", value_new_builtin_fn(core_atom));
+    env_set(env, "reset!", value_new_builtin_fn(core_reset_bang));
+    env_set(env, "swap!", value_new_builtin_fn(core_swap_bang));
+    env_set(env, "compare-and-set!", value_new_builtin_fn(core_compare_and_set_bang));
+    env_set(env, "pmap", value_new_builtin_fn(core_pmap));
+    env_set(env, "preduce", value_new_builtin_fn(core_preduce));
+    env_set(env, "pfold", value_new_builtin_fn(core_pfold));
+    env_set(env, "chan", value_new_builtin_fn(core_chan));
+    env_set(env, ">!", value_new_builtin_fn(core_chan_put));
+    env_set(env, "<!", value_new_builtin_fn(core_chan_take));
+    env_set(env, "alts!", value_new_builtin_fn(core_alts));
+    env_set(env, "close!", value_new_builtin_fn(core_close));
+    env_set(env, "timeout", value_new_builtin_fn(core_timeout));
+
     env_set(env, "assert", value_new_builtin_fn(core_assert));
     env_set(env, "throw", value_new_builtin_fn(core_throw));
-
-    // add stutter basics
-    size_t N_EXPRS = 1;
-    const char *exprs[N_EXPRS];
-    exprs[0] = "(def load-file"
-               "  (lambda (path)"
-               "    (eval (read-string (str \"(do \" (slurp path) \")\")))))";
-    for (size_t i = 0; i < N_EXPRS; ++i) {
-        eval(core_read_string(value_make_list(value_new_string(exprs[i]))), env);
-    }
     return env;
 }
 
 Value *read_(char *input)
 {
-    // Get a handle on the input
-    size_t n = strlen(input);
-    FILE *stream = fmemopen(input, n, "r");
-    if (!stream) {
-        printf("%s\n", strerror(errno));
-        return NULL;
-    }
-
     Value *ast = NULL;
-    ParseResult success = parser_parse(stream, &ast);
-    fclose(stream);
+    size_t n = strlen(input);
+    // large inputs (e.g. read-string of a slurped data file) go through
+    // the two-stage reader
+    ParseResult success = n < PARSER_BULK_THRESHOLD
+                          ? parser_parse_buffer(input, n, &ast)
+                          : parser_parse_bulk(input, n, &ast);
     return success == PARSER_SUCCESS ? ast : NULL;
 }
 
@@ -127,6 +157,48 @@ Value *core_read_string(const Value *args)
     return NULL;
 }
 
+/*
+ * Evaluate all forms in a stream, one at a time. Returns the value of the
+ * last form, or NULL with a pending exception.
+ */
+Value *load_(FILE *fp)
+{
+    ParserStream *ps = parser_stream_new(fp);
+    Value *result = VALUE_CONST_NIL;
+    Value *ast = NULL;
+    ParseResult success;
+    while ((success = parser_stream_next(ps, &ast)) == PARSER_SUCCESS) {
+        if (!(result = eval(ast, interp_current()->env))) {
+            break;
+        }
+    }
+    if (success == PARSER_FAIL) {
+        exc_set(value_make_exception("Failed to parse form at line %lu",
+                                     ps->form_line));
+        result = NULL;
+    }
+    parser_stream_delete(ps);
+    return result;
+}
+
+Value *core_load_file(const Value *args)
+{
+    if (!is_list(args) || list_size(LIST(args)) != 1
+            || list_head(LIST(args))->type != VALUE_STRING) {
+        exc_set(value_make_exception("load-file takes a string argument"));
+        return NULL;
+    }
+    const char *path = STRING(list_head(LIST(args)));
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        exc_set(value_make_exception("Failed to open file %s: %s", path,
+                                     strerror(errno)));
+        return NULL;
+    }
+    Value *result = load_(fp);
+    fclose(fp);
+    return result;
+}
 
 Value *core_eval(const Value *args)
 {
@@ -134,11 +206,31 @@ Value *core_eval(const Value *args)
      * Otherwise we should implement it as a special form.
      */
     if (is_list(args)) {
-        return eval(list_head(LIST(args)), ENV);
+        return eval(list_head(LIST(args)), interp_current()->env);
     }
     return NULL;
 }
 
+/*
+ * Prints a result, or the exception raised while evaluating or printing
+ * it. core_prn() renders the whole result before writing, so a result
+ * that fails to print (e.g. a lazy sequence whose realization throws)
+ * leaves nothing partial on stdout.
+ */
+void print_(Value *eval_result)
+{
+    if (eval_result && core_prn(value_make_list(eval_result))) {
+        return;
+    }
+    if (exc_is_pending()) {
+        Value *exc = exc_get();
+        exc_clear();
+        core_prn(exc);
+    } else {
+        LOG_CRITICAL("Eval returned NULL.");
+    }
+}
+
 #define BOLD         "\033[1m"
 #define NO_BOLD      "\033[22m"
 
@@ -172,10 +264,11 @@ void show_help()
 int main(int argc, char *argv[])
 {
     // set up garbage collection, use extended setup for bigger mem limits
-    gc_start_ext(&gc, &argc, 16384, 16384, 0.2, 0.8, 0.5);
+    gc_start_ext(HEAP, &argc, 16384, 16384, 0.2, 0.8, 0.5);
     // create env and tell GC to never collect it
-    ENV = global_env();
-    gc_make_static(&gc, ENV);
+    Interpreter *interp = interp_current();
+    interp->env = global_env();
+    heap_make_static(interp->env);
 
     int c;
     while ((c = getopt(argc, argv, "h")) != -1) {
@@ -191,23 +284,33 @@ int main(int argc, char *argv[])
          * call to avoid interpretation of the filename. */
         Value *src = value_make_list(value_new_symbol("load-file"));
         src = value_new_list(list_append(LIST(src), value_new_string(argv[optind])));
-        Value *eval_result = eval(src, ENV);
-        if (eval_result) {
-            core_prn(value_make_list(eval_result));
-        } else {
-            if (exc_is_pending()) {
-                core_prn(exc_get());
-                exc_clear();
-            } else {
-                LOG_CRITICAL("Eval returned NULL.");
-            }
-        }
+        Value *eval_result = eval(src, interp->env);
+        print_(eval_result);
         if (!eval_result) {
             return 1;
         } else {
             return 0;
         }
     }
+    if (!isatty(fileno(stdin))) {
+        /* Non-interactive input (e.g. a pipe) is read one form at a time
+         * as it arrives and, like in the REPL, every result is printed and
+         * errors do not stop the rest. */
+        ParserStream *ps = parser_stream_new(stdin);
+        Value *ast = NULL;
+        ParseResult success;
+        while ((success = parser_stream_next(ps, &ast)) != PARSER_EOF) {
+            if (success == PARSER_SUCCESS) {
+                print_(eval(ast, interp->env));
+            } else {
+                exc_set(value_make_exception("Failed to parse form at line %lu",
+                                             ps->form_line));
+                print_(NULL);
+            }
+        }
+        parser_stream_delete(ps);
+        return 0;
+    }
 
     // REPL
     if (isatty(fileno(stdin))) {
@@ -226,21 +329,11 @@ int main(int argc, char *argv[])
         add_history(input);
         Value *expr = read_(input);
         if (expr) {
-            Value *eval_result = eval(expr, ENV);
-            if (eval_result) {
-                core_prn(value_make_list(eval_result));
-            } else {
-                if (exc_is_pending()) {
-                    core_prn(exc_get());
-                    exc_clear();
-                } else {
-                    LOG_CRITICAL("Eval returned NULL.");
-                }
-            }
+            print_(eval(expr, interp->env));
         }
         free(input);
     }
-    gc_stop(&gc);
+    gc_stop(HEAP);
     if (isatty(fileno(stdin))) {
         fprintf(stdout, "\n");
     }
@@ -4,6 +4,7 @@
 
 #include "djb2.h"
 #include "gc.h"
+#include "interp.h"
 #include "log.h"
 #include "map.h"
 #include "primes.h"
@@ -16,10 +17,10 @@ static double load_factor(Map *ht)
 
 static MapItem *map_item_new(char *key, void *value, size_t siz)
 {
-    MapItem *item = (MapItem *) gc_malloc(&gc, sizeof(MapItem));
-    item->key = gc_strdup(&gc, key);
+    MapItem *item = (MapItem *) heap_malloc(sizeof(MapItem));
+    item->key = heap_strdup(key);
     item->size = siz;
-    item->value = gc_malloc(&gc, siz);
+    item->value = heap_malloc(siz);
     memcpy(item->value, value, siz);
     item->next = NULL;
     return item;
@@ -28,18 +29,18 @@ static MapItem *map_item_new(char *key, void *value, size_t siz)
 static void map_item_delete(MapItem *item)
 {
     if (item) {
-        gc_free(&gc, item->key);
-        gc_free(&gc, item->value);
-        gc_free(&gc, item);
+        heap_free(item->key);
+        heap_free(item->value);
+        heap_free(item);
     }
 }
 
 Map *map_new(size_t capacity)
 {
-    Map *ht = (Map *) gc_malloc(&gc, sizeof(Map));
+    Map *ht = (Map *) heap_malloc(sizeof(Map));
     ht->capacity = next_prime(capacity);
     ht->size = 0;
-    ht->items = gc_calloc(&gc, ht->capacity, sizeof(MapItem *));
+    ht->items = heap_calloc(ht->capacity, sizeof(MapItem *));
     return ht;
 }
 
@@ -55,8 +56,8 @@ void map_delete(Map *ht)
             }
         }
     }
-    gc_free(&gc, ht->items);
-    gc_free(&gc, ht);
+    heap_free(ht->items);
+    heap_free(ht);
 }
 
 unsigned long map_index(Map *map, char *key)
@@ -102,10 +103,15 @@ void map_put(Map *ht, char *key, void *value, size_t siz)
 
 void *map_get(Map *ht, char *key)
 {
-    unsigned long index = map_index(ht, key);
+    return map_get_hashed(ht, key, djb2(key));
+}
+
+void *map_get_hashed(Map *ht, char *key, unsigned long hash)
+{
+    unsigned long index = hash % ht->capacity;
     MapItem *cur = ht->items[index];
     while(cur != NULL) {
-        if (strncmp(cur->key, key, strlen(cur->key)) == 0) {
+        if (strcmp(cur->key, key) == 0) {
             return cur->value;
         }
         cur = cur->next;
@@ -150,7 +156,7 @@ void map_resize(Map *ht, size_t new_capacity)
     // Replaces the existing items array in the hash table
     // with a resized one and pushes items into the new, correct buckets
     // LOG_DEBUG("Resizing to %lu", new_capacity);
-    MapItem **resized_items = gc_calloc(&gc, new_capacity, sizeof(MapItem *));
+    MapItem **resized_items = heap_calloc(new_capacity, sizeof(MapItem *));
 
     for (size_t i = 0; i < ht->capacity; ++i) {
         MapItem *item = ht->items[i];
@@ -162,7 +168,7 @@ void map_resize(Map *ht, size_t new_capacity)
             item = next_item;
         }
     }
-    gc_free(&gc, ht->items);
+    heap_free(ht->items);
     ht->capacity = new_capacity;
     ht->items = resized_items;
 }
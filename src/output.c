@@ -0,0 +1,65 @@
+#include "output.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void output_init(Output *out, int fd)
+{
+    strbuf_init_fd(&out->buf, fd, OUTPUT_BUFFER_SIZE);
+    out->policy = isatty(fd) ? OUTPUT_FLUSH_LINE : OUTPUT_FLUSH_BLOCK;
+    pthread_mutex_init(&out->lock, NULL);
+}
+
+void output_destroy(Output *out)
+{
+    strbuf_destroy(&out->buf);
+    pthread_mutex_destroy(&out->lock);
+}
+
+void output_write(Output *out, const char *s, size_t n)
+{
+    pthread_mutex_lock(&out->lock);
+    strbuf_append(&out->buf, s, n);
+    if (out->policy == OUTPUT_FLUSH_LINE
+            && memchr(out->buf.data, '\n', out->buf.size)) {
+        strbuf_flush(&out->buf);
+    }
+    pthread_mutex_unlock(&out->lock);
+}
+
+void output_flush(Output *out)
+{
+    pthread_mutex_lock(&out->lock);
+    strbuf_flush(&out->buf);
+    pthread_mutex_unlock(&out->lock);
+}
+
+/*
+ * All threads print into the same buffer, so what they print comes out
+ * in the order they printed it. It is set up on first use and written
+ * out at exit().
+ */
+static Output output_stdout_;
+static pthread_once_t output_stdout_once = PTHREAD_ONCE_INIT;
+
+static void output_stdout_flush()
+{
+    output_flush(&output_stdout_);
+}
+
+static void output_stdout_setup()
+{
+    // anything stdio still buffers has to come first
+    fflush(stdout);
+    output_init(&output_stdout_, STDOUT_FILENO);
+    atexit(output_stdout_flush);
+}
+
+Output *output_stdout()
+{
+    pthread_once(&output_stdout_once, output_stdout_setup);
+    return &output_stdout_;
+}
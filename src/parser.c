@@ -1,7 +1,13 @@
 #include "parser.h"
 
+#include <string.h>
+#include <sys/stat.h>
+
 #include "lexer.h"
+#include "interp.h"
 #include "log.h"
+#include "pool.h"
+#include "scan.h"
 #include "value.h"
 
 /* control debugging verbosity at the file level */
@@ -12,11 +18,27 @@
 
 /*
  * Lexer extension to allow peeking
+ *
+ * Tokens are slices into the source buffer and live in the token stream
+ * itself, so reading a program does not allocate per token. The pointers
+ * returned by tokenstream_peek() and tokenstream_get() are valid until the
+ * next call into the token stream.
  */
 
 typedef struct {
     Lexer *lexer;
-    LexerToken *cur_tok;
+    LexerSlice cur_tok;
+    bool has_cur_tok;
+    char *scratch;  /* NUL-terminated copy of the last string or symbol */
+    size_t scratch_size;
+    /* tape mode: tokens [next, end) of a scan tape, see scan.h */
+    const ScanToken *tape;
+    size_t next;
+    size_t end;
+    size_t atom_end;    /* of the atom the lexer is in */
+    size_t origin;      /* where the lexer's line_no is counted from */
+    ScanTape *scan;     /* scanned a window ahead of the parser, if set */
+    bool quiet;         /* leaves diagnostics to whoever reparses the form */
 } TokenStream;
 
 
@@ -24,43 +46,195 @@ static TokenStream *tokenstream_new(Lexer *l)
 {
     TokenStream *ts = (TokenStream *) malloc(sizeof(TokenStream));
     *ts = (TokenStream) {
-        .lexer = l, .cur_tok = NULL
+        .lexer = l, .has_cur_tok = false, .scratch = NULL, .scratch_size = 0,
+        .tape = NULL, .next = 0, .end = 0, .atom_end = 0, .origin = 0,
+        .scan = NULL, .quiet = false
     };
     return ts;
 }
 
+static TokenStream *tokenstream_new_with_tape(Lexer *l, const ScanToken *tape,
+        size_t n)
+{
+    TokenStream *ts = tokenstream_new(l);
+    ts->tape = tape;
+    ts->end = n;
+    return ts;
+}
+
 static void tokenstream_delete(TokenStream *ts)
 {
     if (ts) {
-        lexer_delete_token(ts->cur_tok);
+        free(ts->scratch);
         free(ts);
     }
 }
 
-static LexerToken *tokenstream_peek(TokenStream *ts)
+/*
+ * Scans the next window of the buffer once the parser has used up the
+ * tokens so far. Consumed tokens are forgotten, so the tape stays small
+ * and warm in the cache however large the buffer is.
+ */
+static void tokenstream_scan_ahead(TokenStream *ts)
 {
-    if (!ts->cur_tok) {
-        ts->cur_tok = lexer_get_token(ts->lexer);
+    ScanTape *tape = ts->scan;
+    size_t size = ts->lexer->size;
+    scan_tape_forget(tape, ts->next);
+    ts->next = 0;
+    do {
+        if (size - tape->scanned > PARSER_TAPE_WINDOW) {
+            scan_tape_extend(tape, ts->lexer->buf,
+                             tape->scanned + PARSER_TAPE_WINDOW);
+        } else {
+            scan_tape_extend(tape, ts->lexer->buf, size);
+            scan_tape_finish(tape, ts->lexer->buf, size);
+            ts->scan = NULL;
+        }
+        ts->end = tape->open == SIZE_MAX ? tape->size : tape->open;
+    } while (ts->scan && ts->end == 0);
+    ts->tape = tape->tokens;
+}
+
+static const TokenType tokenstream_tape_types[] = {
+    [SCAN_LPAREN] = LEXER_TOK_LPAREN,
+    [SCAN_RPAREN] = LEXER_TOK_RPAREN,
+    [SCAN_QUOTE] = LEXER_TOK_QUOTE,
+    [SCAN_QUASIQUOTE] = LEXER_TOK_QUASIQUOTE,
+    [SCAN_UNQUOTE] = LEXER_TOK_UNQUOTE,
+    [SCAN_SPLICE_UNQUOTE] = LEXER_TOK_SPLICE_UNQUOTE,
+    [SCAN_STRING] = LEXER_TOK_STRING,
+    [SCAN_ESCAPED_STRING] = LEXER_TOK_STRING,
+    [SCAN_OPEN_STRING] = LEXER_TOK_ERROR
+};
+
+/*
+ * Tape mode: parens, quotes and strings come off the tape as they are.
+ * Atoms are left to the lexer, which tells numbers, symbols and keywords
+ * apart and splits runs like "a:b" or "12x3" just as it does in place,
+ * so tokens are exactly the ones lexer_next_slice() would produce.
+ */
+static void tokenstream_next_taped(TokenStream *ts, LexerSlice *tok)
+{
+    Lexer *l = ts->lexer;
+    if (l->pos < ts->atom_end) {
+        lexer_next_slice(l, tok);
+        return;
+    }
+    if (ts->next == ts->end && ts->scan) {
+        tokenstream_scan_ahead(ts);
     }
-    return ts->cur_tok;
+    if (ts->next == ts->end) {
+        tok->type = LEXER_TOK_EOF;
+        tok->offset = l->size;
+        tok->length = 0;
+        return;
+    }
+    const ScanToken *t = &ts->tape[ts->next++];
+    if (t->kind == SCAN_ATOM) {
+        l->pos = t->offset;
+        ts->atom_end = t->offset + t->length;
+        lexer_next_slice(l, tok);
+        return;
+    }
+    tok->type = tokenstream_tape_types[t->kind];
+    tok->offset = t->offset;
+    tok->length = t->length;
 }
 
-static LexerToken *tokenstream_get(TokenStream *ts)
+static void tokenstream_next(TokenStream *ts, LexerSlice *tok)
 {
-    LexerToken *tok = ts->cur_tok ? ts->cur_tok : lexer_get_token(ts->lexer);
-    ts->cur_tok = NULL;
-    return tok;
+    if (ts->tape) {
+        tokenstream_next_taped(ts, tok);
+    } else {
+        lexer_next_slice(ts->lexer, tok);
+    }
+}
+
+/*
+ * Location for diagnostics. Tape mode does not track lines while parsing,
+ * so they are recounted on demand.
+ */
+static size_t tokenstream_line(const TokenStream *ts)
+{
+    const Lexer *l = ts->lexer;
+    if (!ts->tape) {
+        return l->line_no;
+    }
+    size_t line = l->line_no;
+    const char *p = l->buf + ts->origin;
+    const char *end = l->buf + ts->cur_tok.offset;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        line++;
+        p++;
+    }
+    return line;
+}
+
+static size_t tokenstream_column(const TokenStream *ts)
+{
+    const Lexer *l = ts->lexer;
+    if (!ts->tape) {
+        return l->char_no;
+    }
+    // where the lexer would be, after the token
+    size_t start = ts->cur_tok.offset;
+    while (start > 0 && l->buf[start - 1] != '\n') {
+        start--;
+    }
+    return ts->cur_tok.offset + ts->cur_tok.length - start;
+}
+
+#define PARSER_CRITICAL(ts, fmt, ...) \
+    do { \
+        if (!(ts)->quiet) { \
+            LOG_CRITICAL("Line %lu, column %lu: " fmt, tokenstream_line(ts), \
+                         tokenstream_column(ts), ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+static LexerSlice *tokenstream_peek(TokenStream *ts)
+{
+    if (!ts->has_cur_tok) {
+        tokenstream_next(ts, &ts->cur_tok);
+        ts->has_cur_tok = true;
+    }
+    return &ts->cur_tok;
+}
+
+static LexerSlice *tokenstream_get(TokenStream *ts)
+{
+    if (!ts->has_cur_tok) {
+        tokenstream_next(ts, &ts->cur_tok);
+    }
+    ts->has_cur_tok = false;
+    return &ts->cur_tok;
 }
 
 static void tokenstream_consume(TokenStream *ts)
 {
-    if (ts->cur_tok) {
-        lexer_delete_token(ts->cur_tok);
-        ts->cur_tok = NULL;
-    } else {
-        LexerToken *tok = tokenstream_get(ts);
-        lexer_delete_token(tok);
+    tokenstream_get(ts);
+}
+
+/* the text of a string, symbol or keyword token, NUL-terminated */
+static const char *tokenstream_str(TokenStream *ts, const LexerSlice *tok)
+{
+    if (tok->length + 1 > ts->scratch_size) {
+        size_t size = ts->scratch_size ? ts->scratch_size : 64;
+        while (size < tok->length + 1) size *= 2;
+        ts->scratch = realloc(ts->scratch, size);
+        ts->scratch_size = size;
+    }
+    lexer_slice_str(ts->lexer, tok, ts->scratch);
+    return ts->scratch;
+}
+
+/* strings without escape sequences on the tape are taken as they are */
+static Value *tokenstream_string(TokenStream *ts, const LexerSlice *tok)
+{
+    if (ts->tape && ts->tape[ts->next - 1].kind == SCAN_STRING) {
+        return value_new_string_len(ts->lexer->buf + tok->offset, tok->length);
     }
+    return value_new_string(tokenstream_str(ts, tok));
 }
 
 /*
@@ -68,8 +242,6 @@ static void tokenstream_consume(TokenStream *ts)
  */
 
 /* forward declarations */
-static ParseResult parser_parse_sexpr(TokenStream *ts, Value **ast);
-static ParseResult parser_parse_list(TokenStream *ts, Value **ast);
 static ParseResult parser_parse_atom(TokenStream *ts, Value **ast);
 static ParseResult parser_parse_program(TokenStream *ts, Value **ast);
 
@@ -78,7 +250,28 @@ const char *QUOTES[] = { "quote", "quasiquote", "unquote", "splice-unquote" };
 
 ParseResult parser_parse(FILE *stream, Value **ast)
 {
-    Lexer *lexer = lexer_new(stream);
+    // read the stream into memory and parse from there
+    size_t capacity = 4096;
+    size_t size = 0;
+    size_t n;
+    char *buf = malloc(capacity);
+    while ((n = fread(buf + size, 1, capacity - size, stream)) > 0) {
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+        }
+    }
+    ParseResult success = parser_parse_buffer(buf, size, ast);
+    free(buf);
+    return success;
+}
+
+static ParseResult parser_parse_lines(const char *buf, size_t size,
+                                      size_t line, Value **ast)
+{
+    Lexer *lexer = lexer_new_from_buffer(buf, size);
+    lexer->line_no = line;
     TokenStream *ts = tokenstream_new(lexer);
     ParseResult success = parser_parse_program(ts, ast);
     tokenstream_delete(ts);
@@ -86,167 +279,638 @@ ParseResult parser_parse(FILE *stream, Value **ast)
     return success;
 }
 
-static ParseResult parser_parse_program(TokenStream *ts, Value **ast)
+ParseResult parser_parse_buffer(const char *buf, size_t size, Value **ast)
 {
-    LexerToken *tok = tokenstream_peek(ts);
-    if (!tok) {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected lexer failure",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        *ast = NULL;
-        return PARSER_FAIL;
+    return parser_parse_lines(buf, size, 1, ast);
+}
+
+/*
+ * Builds the values of the tokens of a tape. All of them end up in the
+ * result, so the heap is not collected meanwhile.
+ */
+static ParseResult parser_parse_tape(TokenStream *ts, Value **ast)
+{
+    heap_pause();
+    ParseResult success = parser_parse_program(ts, ast);
+    heap_resume();
+    return success;
+}
+
+ParseResult parser_parse_bulk(const char *buf, size_t size, Value **ast)
+{
+    ScanTape *tape = scan_tape_new();
+    Lexer *lexer = lexer_new_from_buffer(buf, size);
+    TokenStream *ts = tokenstream_new_with_tape(lexer, tape->tokens, 0);
+    ts->scan = tape;
+    tokenstream_scan_ahead(ts);
+    ParseResult success = parser_parse_tape(ts, ast);
+    tokenstream_delete(ts);
+    lexer_delete(lexer);
+    scan_tape_delete(tape);
+    return success;
+}
+
+/*
+ * Streaming
+ */
+
+static ParserBatch *parser_batch_new();
+static void parser_batch_delete(ParserBatch *b);
+static ParseResult parser_batch_next(ParserStream *ps, Value **ast);
+
+ParserStream *parser_stream_new(FILE *fp)
+{
+    ParserStream *ps = (ParserStream *) malloc(sizeof(ParserStream));
+    *ps = (ParserStream) {
+        .fp = fp,
+        .buf = malloc(PARSER_STREAM_CHUNK),
+        .size = 0,
+        .capacity = PARSER_STREAM_CHUNK,
+        .start = 0,
+        .pos = 0,
+        .line = 1,
+        .form_line = 1,
+        .index = scan_index_new(),
+        .next = 0,
+        .batch = NULL
+    };
+    // regular files can be read ahead without delaying anything
+    struct stat st;
+    int fd = fileno(fp);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        ps->batch = parser_batch_new();
     }
-    switch (tok->type) {
-    case LEXER_TOK_ERROR: {
-        LOG_CRITICAL("Line %lu, column %lu: L -> ? has parse error at \"%s\"",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     tok->as.str);
-        *ast = NULL;
-        return PARSER_FAIL;
+    return ps;
+}
+
+void parser_stream_delete(ParserStream *ps)
+{
+    if (ps) {
+        parser_batch_delete(ps->batch);
+        scan_index_delete(ps->index);
+        free(ps->buf);
+        free(ps);
     }
-    case LEXER_TOK_EOF: {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected EOF",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        *ast = NULL;
-        return PARSER_FAIL;
+}
+
+/* counts the lines up to position to */
+static void parser_stream_count_lines(ParserStream *ps, size_t to)
+{
+    const char *p = ps->buf + ps->pos;
+    const char *end = ps->buf + to;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        ps->line++;
+        p++;
     }
-    case LEXER_TOK_INT:
-    case LEXER_TOK_FLOAT:
-    case LEXER_TOK_STRING:
-    case LEXER_TOK_SYMBOL:
-    case LEXER_TOK_LPAREN:
-    case LEXER_TOK_QUOTE:
-    case LEXER_TOK_QUASIQUOTE:
-    case LEXER_TOK_UNQUOTE:
-    case LEXER_TOK_SPLICE_UNQUOTE: {
-        LOG_DEBUG("Line %lu, column %lu: P -> L $", ts->lexer->line_no, ts->lexer->char_no);
-        ParseResult success;
-        Value *list = NULL;
-        if ((success = parser_parse_list(ts, &list)) != PARSER_SUCCESS) {
-            *ast = NULL;
-            return PARSER_FAIL;
-        }
+    ps->pos = to;
+}
 
-        // consume eof
-        tok = tokenstream_get(ts);
-        if (!tok) {
-            LOG_CRITICAL("Line %lu, column %lu: Unexpected lexer failure",
-                         ts->lexer->line_no, ts->lexer->char_no);
-            *ast = NULL;
-            return PARSER_FAIL;
+/*
+ * Drops the first keep bytes of the buffer, counting the lines in them,
+ * and makes room for want more.
+ */
+static void parser_stream_compact(ParserStream *ps, size_t keep, size_t want)
+{
+    if (keep > 0) {
+        if (ps->pos < keep) {
+            parser_stream_count_lines(ps, keep);
         }
-        if (tok->type != LEXER_TOK_EOF) {
-            LOG_CRITICAL("Line %lu, column %lu: Expected EOF, got: %s",
-                         ts->lexer->line_no, ts->lexer->char_no,
-                         token_type_names[tok->type]);
-            lexer_delete_token(tok);
-            *ast = NULL;
-            return PARSER_FAIL;
+        memmove(ps->buf, ps->buf + keep, ps->size - keep);
+        ps->size -= keep;
+        ps->start -= keep;
+        ps->pos -= keep;
+    }
+    if (ps->capacity - ps->size < want) {
+        while (ps->capacity - ps->size < want) {
+            ps->capacity *= 2;
         }
-        lexer_delete_token(tok);
-        *ast = list_head(LIST(list));
-        return PARSER_SUCCESS;
+        ps->buf = realloc(ps->buf, ps->capacity);
     }
-    default: {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected token %s",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     token_type_names[tok->type]);
-        return PARSER_FAIL;
+}
+
+/*
+ * Drops everything before the current form and reads more input. Reads
+ * at most a line at a time so that pipes are evaluated as they arrive.
+ */
+static bool parser_stream_fill(ParserStream *ps)
+{
+    if (ps->eof) {
+        return false;
     }
+    // the index lets go of complete blocks only
+    size_t keep = ps->start < ps->index->scanned ? ps->start : ps->index->scanned;
+    parser_stream_compact(ps, keep, PARSER_STREAM_CHUNK);
+    ps->next -= scan_index_drop(ps->index, keep);
+    size_t n;
+    if (fgets(ps->buf + ps->size, ps->capacity - ps->size, ps->fp)) {
+        n = strlen(ps->buf + ps->size);
+    } else {
+        n = 0;
+        ps->eof = true;
     }
-    /* unreachable */
-    LOG_CRITICAL("Reached unreachable code. X-(");
-    return PARSER_FAIL;
+    ps->size += n;
+    scan_index_extend(ps->index, ps->buf, ps->size);
+    return n > 0;
 }
 
-static ParseResult parser_parse_list(TokenStream *ts, Value **ast)
+static bool parser_stream_is_atom_char(char c)
 {
-    LexerToken *tok = tokenstream_peek(ts);
-    if (!tok) {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected lexer failure",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        *ast = NULL;
-        return PARSER_FAIL;
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case '(':
+    case ')':
+    case '"':
+    case ';':
+    case '\'':
+    case '`':
+    case '~':
+        return false;
+    default:
+        return true;
     }
-    switch (tok->type) {
-    case LEXER_TOK_ERROR: {
-        LOG_CRITICAL("Line %lu, column %lu: L -> ? has parse error at \"%s\"",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     tok->as.str);
-        *ast = NULL;
-        return PARSER_FAIL;
+}
+
+static void parser_stream_mark(ParserStream *ps, size_t pos)
+{
+    if (!ps->started) {
+        ps->started = true;
+        ps->start = pos;
+        parser_stream_count_lines(ps, pos);
+        ps->form_line = ps->line;
     }
-    case LEXER_TOK_EOF:
-    case LEXER_TOK_RPAREN: {
-        LOG_DEBUG("Line %lu, column %lu: L -> eps", ts->lexer->line_no, ts->lexer->char_no);
-        *ast = value_new_list(NULL);
-        return PARSER_SUCCESS;
+}
+
+/*
+ * Walks the index to the end of the current top-level form. Only finds
+ * the boundary, the form itself is checked by the parser. Returns false
+ * if the form is not complete yet.
+ */
+static bool parser_stream_scan(ParserStream *ps, size_t *end)
+{
+    const ScanIndex *idx = ps->index;
+    const char *s = ps->buf;
+    while (ps->next < idx->size) {
+        size_t pos = idx->offsets[ps->next];
+        parser_stream_mark(ps, pos);
+        switch (s[pos]) {
+        case '(':
+            ps->depth++;
+            ps->next++;
+            break;
+        case ')':
+            ps->next++;
+            if (--ps->depth <= 0) {
+                // a stray paren is a form of its own and fails to parse
+                ps->depth = 0;
+                *end = pos + 1;
+                return true;
+            }
+            break;
+        case '"':
+            // the closing quote is the next entry
+            if (ps->next + 1 == idx->size) {
+                return false;
+            }
+            ps->next += 2;
+            if (ps->depth == 0) {
+                *end = idx->offsets[ps->next - 1] + 1;
+                return true;
+            }
+            break;
+        case '\'':
+        case '`':
+        case '~':
+            ps->next++;
+            break;
+        default: {
+            if (ps->depth > 0) {
+                ps->next++;
+                break;
+            }
+            // the '@' of "~@" starts a run of atom characters in the index
+            bool splice = s[pos] == '@' && pos > 0 && s[pos - 1] == '~';
+            size_t p = splice ? pos + 1 : pos;
+            while (p < ps->size && parser_stream_is_atom_char(s[p])) {
+                p++;
+            }
+            if (splice && p == pos + 1) {
+                ps->next++;
+                break;
+            }
+            if (p == ps->size) {
+                // more of the atom may follow
+                return false;
+            }
+            ps->next++;
+            *end = p;
+            return true;
+        }
+        }
     }
-    case LEXER_TOK_INT:
-    case LEXER_TOK_FLOAT:
-    case LEXER_TOK_STRING:
-    case LEXER_TOK_SYMBOL:
-    case LEXER_TOK_LPAREN:
-    case LEXER_TOK_QUOTE:
-    case LEXER_TOK_QUASIQUOTE:
-    case LEXER_TOK_UNQUOTE:
-    case LEXER_TOK_SPLICE_UNQUOTE: {
-        LOG_DEBUG("Line %lu, column %lu: L -> S L", ts->lexer->line_no, ts->lexer->char_no);
-        Value *sexpr = NULL;
-        ParseResult success;
-        if ((success = parser_parse_sexpr(ts, &sexpr)) != PARSER_SUCCESS) {
+    return false;
+}
+
+/* takes an incomplete form at the end of the stream as it is */
+static size_t parser_stream_finish(ParserStream *ps)
+{
+    ps->depth = 0;
+    ps->next = ps->index->size;
+    return ps->size;
+}
+
+ParseResult parser_stream_next(ParserStream *ps, Value **ast)
+{
+    if (ps->batch) {
+        return parser_batch_next(ps, ast);
+    }
+    size_t end;
+    bool complete;
+    while (!(complete = parser_stream_scan(ps, &end)) && parser_stream_fill(ps))
+        ;
+    if (!complete) {
+        if (!ps->started) {
             *ast = NULL;
-            return PARSER_FAIL;
+            return PARSER_EOF;
         }
-        Value *list2 = NULL;
-        if ((success = parser_parse_list(ts, &list2)) != PARSER_SUCCESS) {
-            *ast = NULL;
-            return PARSER_FAIL;
+        // let the parser report the incomplete form
+        end = parser_stream_finish(ps);
+    }
+    ParseResult success = parser_parse_lines(ps->buf + ps->start,
+                          end - ps->start, ps->form_line, ast);
+    ps->start = end;
+    ps->started = false;
+    return success;
+}
+
+/*
+ * Batch mode
+ *
+ * Regular files are read in large batches that go through the two stages
+ * of parser_parse_bulk(): each batch is scanned into a tape, the tape is
+ * split into top-level forms, and the values of a form are built straight
+ * from its run of tokens. A form that continues in the next batch is kept
+ * along with its tokens, so no input is scanned twice.
+ *
+ * The forms of a large batch are built ahead on the worker pool, a run of
+ * forms per task, into an array that parser_stream_next() hands out in
+ * order. The workers report nothing: a form that failed is parsed again
+ * when its turn comes, so its diagnostics follow the output of the forms
+ * evaluated before it.
+ */
+
+typedef struct {
+    size_t first;   /* tokens [first, last) of the tape */
+    size_t last;
+    size_t end;     /* the first byte after the form */
+    size_t line;
+    ParseResult result;     /* when built ahead */
+} ParserForm;
+
+typedef struct {
+    ParserStream *ps;
+    size_t first;   /* forms [first, last) */
+    size_t last;
+} ParserChunk;
+
+struct ParserBatch {
+    size_t read;        /* bytes read at once */
+    size_t parallel;    /* bytes of forms worth building ahead */
+    ScanTape *tape;
+    size_t split;       /* first token not assigned to a form */
+    size_t first;       /* first token of the current form */
+    ParserForm *forms;
+    size_t n_forms;
+    size_t capacity;
+    size_t next;
+    Pool *pool;         /* the interpreter's, once a batch is large enough */
+    bool ahead;         /* the forms of this batch are built */
+    Value **values;     /* built ahead, a root of the heap */
+    size_t n_values;
+    ParserChunk *chunks;
+    atomic_size_t remaining;
+    atomic_bool done;
+    Lexer *lexer;
+    TokenStream *ts;
+};
+
+static ParserBatch *parser_batch_new()
+{
+    ParserBatch *b = (ParserBatch *) calloc(1, sizeof(ParserBatch));
+    b->read = PARSER_STREAM_BATCH;
+    b->parallel = PARSER_STREAM_PARALLEL;
+    b->tape = scan_tape_new();
+    b->lexer = lexer_new_from_buffer(NULL, 0);
+    b->ts = tokenstream_new(b->lexer);
+    return b;
+}
+
+static void parser_batch_delete(ParserBatch *b)
+{
+    if (b) {
+        free(b->forms);
+        free(b->chunks);
+        heap_free(b->values);
+        tokenstream_delete(b->ts);
+        lexer_delete(b->lexer);
+        scan_tape_delete(b->tape);
+        free(b);
+    }
+}
+
+/* the first byte of a token, strings start at the quote */
+static size_t parser_token_start(const ScanToken *t)
+{
+    return t->kind >= SCAN_STRING && t->kind <= SCAN_OPEN_STRING
+           ? t->offset - 1 : t->offset;
+}
+
+/* the first byte after a token */
+static size_t parser_token_end(const ScanToken *t)
+{
+    return t->kind == SCAN_STRING || t->kind == SCAN_ESCAPED_STRING
+           ? t->offset + t->length + 1 : t->offset + t->length;
+}
+
+/* the current form ends before token last and byte end */
+static void parser_batch_push(ParserStream *ps, size_t last, size_t end)
+{
+    ParserBatch *b = ps->batch;
+    if (b->n_forms == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 1024;
+        b->forms = realloc(b->forms, b->capacity * sizeof(ParserForm));
+    }
+    parser_stream_count_lines(ps, ps->start);
+    b->forms[b->n_forms++] = (ParserForm) {
+        .first = b->first, .last = last, .end = end, .line = ps->line
+    };
+    ps->started = false;
+}
+
+/*
+ * Walks the tape to the ends of the complete top-level forms, with the
+ * same boundaries as parser_stream_scan(). An atom or string that may
+ * continue in the next batch is still open.
+ */
+static void parser_batch_split(ParserStream *ps)
+{
+    ParserBatch *b = ps->batch;
+    const ScanTape *tape = b->tape;
+    while (b->split < tape->size && b->split != tape->open) {
+        const ScanToken *t = &tape->tokens[b->split++];
+        if (!ps->started) {
+            ps->started = true;
+            ps->start = parser_token_start(t);
+            b->first = b->split - 1;
         }
-        Value *list = value_make_list(sexpr);
-        Value *head;
-        while((head = list_head(LIST(list2))) != NULL) {
-            LIST(list) = list_append(LIST(list), head);
-            LIST(list2) = list_tail(LIST(list2));
+        switch (t->kind) {
+        case SCAN_LPAREN:
+            ps->depth++;
+            continue;
+        case SCAN_RPAREN:
+            if (--ps->depth > 0) {
+                continue;
+            }
+            // a stray paren is a form of its own and fails to parse
+            ps->depth = 0;
+            break;
+        case SCAN_QUOTE:
+        case SCAN_QUASIQUOTE:
+        case SCAN_UNQUOTE:
+        case SCAN_SPLICE_UNQUOTE:
+            continue;
+        default:
+            if (ps->depth > 0) {
+                continue;
+            }
+            break;
         }
-        *ast = list;
-        return PARSER_SUCCESS;
+        parser_batch_push(ps, b->split, parser_token_end(t));
     }
-    default: {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected token type for atom: %s",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     token_type_names[tok->type]);
-        return PARSER_FAIL;
+}
+
+/* drops the forms handed out, reads the next batch and scans it */
+static void parser_batch_read(ParserStream *ps)
+{
+    ParserBatch *b = ps->batch;
+    size_t keep = b->tape->scanned;
+    if (ps->started) {
+        keep = ps->start;
+    } else if (b->split < b->tape->size) {
+        // an open token
+        keep = parser_token_start(&b->tape->tokens[b->split]);
     }
+    parser_stream_compact(ps, keep, b->read);
+    size_t dropped = scan_tape_drop(b->tape, keep);
+    b->split -= dropped;
+    b->first -= dropped;
+    size_t n = fread(ps->buf + ps->size, 1, b->read, ps->fp);
+    ps->size += n;
+    ps->eof = n < b->read;
+    scan_tape_extend(b->tape, ps->buf, ps->size);
+    if (ps->eof) {
+        scan_tape_finish(b->tape, ps->buf, ps->size);
     }
-    /* unreachable */
-    LOG_CRITICAL("Reached unreachable code. X-(");
-    return PARSER_FAIL;
 }
 
-static ParseResult parser_parse_sexpr(TokenStream *ts, Value **ast)
+/* points the token stream at the tokens of form f */
+static void parser_batch_select(ParserStream *ps, const ParserForm *f,
+                                TokenStream *ts)
 {
-    LexerToken *tok = tokenstream_peek(ts);
-    if (!tok) {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected lexer failure",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        return PARSER_FAIL;
+    const ScanTape *tape = ps->batch->tape;
+    ts->lexer->buf = ps->buf;
+    ts->lexer->size = f->end;
+    ts->lexer->line_no = f->line;
+    ts->tape = tape->tokens;
+    ts->next = f->first;
+    ts->end = f->last;
+    ts->atom_end = 0;
+    ts->origin = parser_token_start(&tape->tokens[f->first]);
+    ts->has_cur_tok = false;
+}
+
+static void parser_batch_build(void *arg)
+{
+    ParserChunk *chunk = arg;
+    ParserBatch *b = chunk->ps->batch;
+    Lexer *lexer = lexer_new_from_buffer(NULL, 0);
+    TokenStream *ts = tokenstream_new(lexer);
+    ts->quiet = true;
+    for (size_t i = chunk->first; i < chunk->last; ++i) {
+        parser_batch_select(chunk->ps, &b->forms[i], ts);
+        b->forms[i].result = parser_parse_tape(ts, &b->values[i]);
+    }
+    tokenstream_delete(ts);
+    lexer_delete(lexer);
+    if (atomic_fetch_sub(&b->remaining, 1) == 1) {
+        atomic_store(&b->done, true);
+    }
+}
+
+/* builds the forms of a large batch on the pool, if it has workers to spare */
+static void parser_batch_build_ahead(ParserStream *ps)
+{
+    ParserBatch *b = ps->batch;
+    b->ahead = false;
+    if (b->n_forms < 2 || b->forms[b->n_forms - 1].end < b->parallel) {
+        return;
+    }
+    if (!b->pool) {
+        // started on first use, as for futures
+        Interpreter *root = interp_current()->root;
+        if (!root->pool) {
+            root->pool = pool_new(root, 0);
+        }
+        b->pool = root->pool;
+    }
+    if (!b->pool || b->pool->n_workers < 2) {
+        return;
+    }
+    if (b->n_values < b->n_forms) {
+        heap_free(b->values);
+        b->values = heap_make_static(heap_calloc(b->capacity, sizeof(Value *)));
+        b->n_values = b->capacity;
+    }
+    // a few runs per worker, so that stealing evens out the load
+    size_t n_chunks = 4 * b->pool->n_workers;
+    if (n_chunks > b->n_forms) {
+        n_chunks = b->n_forms;
+    }
+    b->chunks = realloc(b->chunks, n_chunks * sizeof(ParserChunk));
+    for (size_t k = 0; k < n_chunks; ++k) {
+        b->chunks[k] = (ParserChunk) {
+            .ps = ps,
+            .first = k * b->n_forms / n_chunks,
+            .last = (k + 1) * b->n_forms / n_chunks
+        };
+    }
+    atomic_init(&b->remaining, n_chunks);
+    atomic_init(&b->done, false);
+    // everything built stays reachable until it is handed out
+    heap_pause();
+    for (size_t k = 0; k < n_chunks; ++k) {
+        pool_submit(b->pool, parser_batch_build, &b->chunks[k]);
+    }
+    pool_wait(b->pool, &b->done);
+    heap_resume();
+    b->ahead = true;
+}
+
+/*
+ * Collects the complete forms of the next batch. Returns false at the end
+ * of the stream.
+ */
+static bool parser_batch_fill(ParserStream *ps)
+{
+    ParserBatch *b = ps->batch;
+    b->n_forms = b->next = 0;
+    while (b->n_forms == 0) {
+        if (ps->eof) {
+            if (!ps->started) {
+                return false;
+            }
+            // let the parser report the incomplete form
+            ps->depth = 0;
+            parser_batch_push(ps, b->tape->size, ps->size);
+            b->split = b->tape->size;
+            break;
+        }
+        parser_batch_read(ps);
+        parser_batch_split(ps);
+    }
+    parser_batch_build_ahead(ps);
+    return true;
+}
+
+static ParseResult parser_batch_next(ParserStream *ps, Value **ast)
+{
+    ParserBatch *b = ps->batch;
+    if (b->next == b->n_forms && !parser_batch_fill(ps)) {
+        *ast = NULL;
+        return PARSER_EOF;
+    }
+    size_t i = b->next++;
+    ParserForm *f = &b->forms[i];
+    ps->form_line = f->line;
+    if (b->ahead && f->result == PARSER_SUCCESS) {
+        *ast = b->values[i];
+        // the evaluator's now, and collectable once it is done with it
+        b->values[i] = NULL;
+        return PARSER_SUCCESS;
+    }
+    parser_batch_select(ps, f, b->ts);
+    return parser_parse_tape(b->ts, ast);
+}
+
+/*
+ * The grammar
+ *
+ *   P -> L $
+ *   L -> S L | eps
+ *   S -> ( L ) | quote S | A
+ *
+ * is parsed without recursion: open lists and pending quotes live on an
+ * explicit stack, so neither very long nor deeply nested input can
+ * exhaust the C stack, and lists are built front to back in linear time.
+ */
+
+typedef struct {
+    ListBuilder items;
+    bool quote;  /* S -> quote S, waiting for the quoted S */
+} ParserFrame;
+
+typedef struct {
+    ParserFrame *frames;  /* GC-allocated to keep partial lists reachable */
+    size_t size;
+    size_t capacity;
+} ParserStack;
+
+static ParserFrame *parser_stack_push(ParserStack *s, bool quote)
+{
+    if (s->size == s->capacity) {
+        s->capacity *= 2;
+        s->frames = heap_realloc(s->frames, s->capacity * sizeof(ParserFrame));
+    }
+    ParserFrame *f = &s->frames[s->size++];
+    f->quote = quote;
+    list_builder_init(&f->items);
+    return f;
+}
+
+static Value *parser_stack_pop(ParserStack *s)
+{
+    Value *v = value_new_list(NULL);
+    LIST(v) = list_builder_finish(&s->frames[--s->size].items);
+    return v;
+}
+
+/* adds a complete S to the enclosing L, closing the quotes waiting for it */
+static void parser_stack_add(ParserStack *s, Value *v)
+{
+    while (true) {
+        ParserFrame *f = &s->frames[s->size - 1];
+        list_builder_append(&f->items, v);
+        if (!f->quote) {
+            return;
+        }
+        v = parser_stack_pop(s);
     }
+}
+
+static ParseResult parser_parse_sexpr(TokenStream *ts, ParserStack *s)
+{
+    LexerSlice *tok = tokenstream_peek(ts);
     size_t q = 0;
     switch (tok->type) {
     /*
      * S -> ( L )
      */
-    case LEXER_TOK_LPAREN: {
-        tokenstream_consume(ts); // LPAREN
-        Value *list = NULL;
-        ParseResult success = parser_parse_list(ts, &list);
-        if (success == PARSER_SUCCESS) {
-            tokenstream_consume(ts); // RPAREN
-            *ast = list;
-            return PARSER_SUCCESS;
-        }
-        return PARSER_FAIL;
-    }
+    case LEXER_TOK_LPAREN:
+        tokenstream_consume(ts);
+        parser_stack_push(s, false);
+        return PARSER_SUCCESS;
     /*
      * S -> quote S
      *
@@ -254,20 +918,19 @@ static ParseResult parser_parse_sexpr(TokenStream *ts, Value **ast)
      */
     case LEXER_TOK_SPLICE_UNQUOTE:
         q++;
+        /* fall through */
     case LEXER_TOK_UNQUOTE:
         q++;
+        /* fall through */
     case LEXER_TOK_QUASIQUOTE:
         q++;
+        /* fall through */
     case LEXER_TOK_QUOTE: {
-        LOG_DEBUG("Line %lu, column %lu: S -> (quote S)", ts->lexer->line_no, ts->lexer->char_no);
-        Value *quote = value_make_list(value_new_symbol(QUOTES[q]));
-        Value *sexpr;
+        LOG_DEBUG("Line %lu, column %lu: S -> (quote S)", tokenstream_line(ts), tokenstream_column(ts));
         tokenstream_consume(ts);
-        if (parser_parse_sexpr(ts, &sexpr) == PARSER_SUCCESS) {
-            LIST(quote) = list_append(LIST(quote), sexpr);
-            *ast = quote;
-            return PARSER_SUCCESS;
-        }
+        ParserFrame *f = parser_stack_push(s, true);
+        list_builder_append(&f->items, value_new_symbol(QUOTES[q]));
+        return PARSER_SUCCESS;
     }
     /*
      * S -> A
@@ -276,66 +939,132 @@ static ParseResult parser_parse_sexpr(TokenStream *ts, Value **ast)
     case LEXER_TOK_FLOAT:
     case LEXER_TOK_STRING:
     case LEXER_TOK_SYMBOL:
-        return parser_parse_atom(ts, ast);
+    case LEXER_TOK_KEYWORD: {
+        Value *atom = NULL;
+        if (parser_parse_atom(ts, &atom) != PARSER_SUCCESS) {
+            return PARSER_FAIL;
+        }
+        parser_stack_add(s, atom);
+        return PARSER_SUCCESS;
+    }
     /*
      * failures and wrong tokens
      */
     case LEXER_TOK_EOF:
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected EOF",
-                     ts->lexer->line_no, ts->lexer->char_no);
+        PARSER_CRITICAL(ts, "Unexpected EOF");
         return PARSER_FAIL;
     case LEXER_TOK_ERROR:
-        LOG_CRITICAL("Line %lu, column %lu: Lexer error",
-                     ts->lexer->line_no, ts->lexer->char_no);
+        PARSER_CRITICAL(ts, "Lexer error");
         return PARSER_FAIL;
     default:
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected token type for atom: %s",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     token_type_names[tok->type]);
+        PARSER_CRITICAL(ts, "Unexpected token type for atom: %s",
+                        token_type_names[tok->type]);
         return PARSER_FAIL;
     }
-    return PARSER_SUCCESS;
+}
+
+static ParseResult parser_parse_program(TokenStream *ts, Value **ast)
+{
+    *ast = NULL;
+    LexerSlice *tok = tokenstream_peek(ts);
+    switch (tok->type) {
+    case LEXER_TOK_ERROR:
+        PARSER_CRITICAL(ts, "L -> ? has parse error at \"%.*s\"",
+                        (int) tok->length, ts->lexer->buf + tok->offset);
+        return PARSER_FAIL;
+    case LEXER_TOK_EOF:
+        PARSER_CRITICAL(ts, "Unexpected EOF");
+        return PARSER_FAIL;
+    case LEXER_TOK_RPAREN:
+        PARSER_CRITICAL(ts, "Unexpected token %s", token_type_names[tok->type]);
+        return PARSER_FAIL;
+    default:
+        break;
+    }
+
+    LOG_DEBUG("Line %lu, column %lu: P -> L $", tokenstream_line(ts), tokenstream_column(ts));
+    ParserStack s = {
+        .frames = heap_malloc(16 * sizeof(ParserFrame)),
+        .size = 0,
+        .capacity = 16
+    };
+    parser_stack_push(&s, false);
+    ParseResult success = PARSER_SUCCESS;
+    while (success == PARSER_SUCCESS) {
+        tok = tokenstream_peek(ts);
+        if (!s.frames[s.size - 1].quote) {
+            // L -> S L | eps
+            if (tok->type == LEXER_TOK_ERROR) {
+                PARSER_CRITICAL(ts, "L -> ? has parse error at \"%.*s\"",
+                                (int) tok->length, ts->lexer->buf + tok->offset);
+                success = PARSER_FAIL;
+                break;
+            }
+            if (tok->type == LEXER_TOK_EOF || tok->type == LEXER_TOK_RPAREN) {
+                LOG_DEBUG("Line %lu, column %lu: L -> eps", tokenstream_line(ts), tokenstream_column(ts));
+                if (s.size == 1) {
+                    break;
+                }
+                // RPAREN, or EOF for a list that is never closed
+                tokenstream_consume(ts);
+                Value *list = parser_stack_pop(&s);
+                parser_stack_add(&s, list);
+                continue;
+            }
+            LOG_DEBUG("Line %lu, column %lu: L -> S L", tokenstream_line(ts), tokenstream_column(ts));
+        }
+        success = parser_parse_sexpr(ts, &s);
+    }
+
+    if (success == PARSER_SUCCESS) {
+        // consume eof
+        tok = tokenstream_get(ts);
+        if (tok->type != LEXER_TOK_EOF) {
+            PARSER_CRITICAL(ts, "Expected EOF, got: %s",
+                            token_type_names[tok->type]);
+            success = PARSER_FAIL;
+        } else {
+            *ast = (Value *) list_head(LIST(parser_stack_pop(&s)));
+        }
+    }
+    heap_free(s.frames);
+    return success;
 }
 
 static ParseResult parser_parse_atom(TokenStream *ts, Value **ast)
 {
-    LexerToken *tok = tokenstream_get(ts);
+    LexerSlice *tok = tokenstream_get(ts);
     if (!tok) {
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected lexer failure",
-                     ts->lexer->line_no, ts->lexer->char_no);
+        PARSER_CRITICAL(ts, "Unexpected lexer failure");
         return PARSER_FAIL;
     }
     switch (tok->type) {
     case LEXER_TOK_INT:
-        *ast = value_new_int(tok->as.int_);
+        *ast = value_new_int(lexer_slice_int(ts->lexer, tok));
         break;
     case LEXER_TOK_FLOAT:
-        *ast = value_new_float(tok->as.double_);
+        *ast = value_new_float(lexer_slice_float(ts->lexer, tok));
         break;
     case LEXER_TOK_STRING:
-        *ast = value_new_string(tok->as.str);
+        *ast = tokenstream_string(ts, tok);
         break;
     case LEXER_TOK_SYMBOL:
-        *ast = value_new_symbol(tok->as.str);
+        *ast = value_new_symbol_len(ts->lexer->buf + tok->offset, tok->length);
+        break;
+    case LEXER_TOK_KEYWORD:
+        *ast = value_new_keyword(tokenstream_str(ts, tok));
         break;
     case LEXER_TOK_EOF:
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected EOF",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        lexer_delete_token(tok);
+        PARSER_CRITICAL(ts, "Unexpected EOF");
         return PARSER_FAIL;
     case LEXER_TOK_ERROR:
-        LOG_CRITICAL("Line %lu, column %lu: Lexer error",
-                     ts->lexer->line_no, ts->lexer->char_no);
-        lexer_delete_token(tok);
+        PARSER_CRITICAL(ts, "Lexer error");
         return PARSER_FAIL;
     default:
-        LOG_CRITICAL("Line %lu, column %lu: Unexpected token type for atom: %s",
-                     ts->lexer->line_no, ts->lexer->char_no,
-                     token_type_names[tok->type]);
-        lexer_delete_token(tok);
+        PARSER_CRITICAL(ts, "Unexpected token type for atom: %s",
+                        token_type_names[tok->type]);
         return PARSER_FAIL;
     }
-    lexer_delete_token(tok);
     return PARSER_SUCCESS;
 }
 
@@ -0,0 +1,346 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define POOL_DEQUE_CAPACITY 64
+
+/* the worker running on the calling thread, if any */
+static _Thread_local PoolWorker *pool_worker_self = NULL;
+
+static PoolBuffer *pool_buffer_new(long capacity, PoolBuffer *prev)
+{
+    PoolBuffer *buf = malloc(sizeof(PoolBuffer) + capacity * sizeof(PoolTask *));
+    if (!buf) {
+        LOG_CRITICAL("Failed to allocate a task buffer");
+        abort();
+    }
+    buf->capacity = capacity;
+    buf->prev = prev;
+    return buf;
+}
+
+static void pool_deque_init(PoolDeque *d)
+{
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->buffer, pool_buffer_new(POOL_DEQUE_CAPACITY, NULL));
+}
+
+static void pool_deque_destroy(PoolDeque *d)
+{
+    PoolBuffer *buf = atomic_load(&d->buffer);
+    while (buf) {
+        PoolBuffer *prev = buf->prev;
+        free(buf);
+        buf = prev;
+    }
+}
+
+/*
+ * The owner pushes and takes at the bottom, thieves steal at the top.
+ * Thieves may still read from a buffer that was replaced by a bigger
+ * one, so old buffers are kept until the deque is destroyed.
+ */
+static void pool_deque_push(PoolDeque *d, PoolTask *task)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    PoolBuffer *buf = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+    if (b - t > buf->capacity - 1) {
+        PoolBuffer *grown = pool_buffer_new(2 * buf->capacity, buf);
+        for (long i = t; i < b; ++i) {
+            PoolTask *item = atomic_load_explicit(&buf->items[i % buf->capacity],
+                                                  memory_order_relaxed);
+            atomic_store_explicit(&grown->items[i % grown->capacity], item,
+                                  memory_order_relaxed);
+        }
+        atomic_store_explicit(&d->buffer, grown, memory_order_release);
+        buf = grown;
+    }
+    atomic_store_explicit(&buf->items[b % buf->capacity], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static PoolTask *pool_deque_take(PoolDeque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    PoolBuffer *buf = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    PoolTask *task = NULL;
+    if (t <= b) {
+        task = atomic_load_explicit(&buf->items[b % buf->capacity], memory_order_relaxed);
+        if (t == b) {
+            // the last task, race the thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                task = NULL;
+            }
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/* NULL if the deque is empty, or with *retry set if another thread won */
+static PoolTask *pool_deque_steal(PoolDeque *d, bool *retry)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    PoolBuffer *buf = atomic_load_explicit(&d->buffer, memory_order_acquire);
+    PoolTask *task = atomic_load_explicit(&buf->items[t % buf->capacity], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        *retry = true;
+        return NULL;
+    }
+    return task;
+}
+
+static PoolWorker *pool_self(Pool *pool)
+{
+    return pool_worker_self && pool_worker_self->pool == pool ? pool_worker_self : NULL;
+}
+
+static PoolTask *pool_take(Pool *pool)
+{
+    PoolWorker *self = pool_self(pool);
+    PoolTask *task = self ? pool_deque_take(&self->deque) : NULL;
+    if (!task && atomic_load(&pool->queued) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        task = pool->queue_head;
+        if (task) {
+            pool->queue_head = task->next;
+            if (!pool->queue_head) {
+                pool->queue_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (!task) {
+        size_t start = self ? (size_t) rand_r(&self->seed) : 0;
+        bool retry;
+        do {
+            retry = false;
+            for (size_t i = 0; i < pool->n_workers && !task; ++i) {
+                PoolWorker *w = &pool->workers[(start + i) % pool->n_workers];
+                if (w != self) {
+                    task = pool_deque_steal(&w->deque, &retry);
+                }
+            }
+        } while (!task && retry);
+    }
+    if (task) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return task;
+}
+
+static void pool_run(Pool *pool, PoolTask *task)
+{
+    task->run(task->arg);
+    free(task);
+    pool_notify(pool);
+}
+
+bool pool_help(Pool *pool)
+{
+    // between tasks, the heap may collect
+    heap_safepoint();
+    PoolTask *task = pool_take(pool);
+    if (!task) {
+        return false;
+    }
+    pool_run(pool, task);
+    return true;
+}
+
+static void *pool_worker_run(void *arg)
+{
+    PoolWorker *self = arg;
+    Pool *pool = self->pool;
+    // a separate pending exception and allocation cache, the rest is the root's
+    Interpreter interp = {
+        .gc = pool->root->gc,
+        .env = pool->root->env,
+        .root = pool->root
+    };
+    interp_enter(&interp);
+    interp_attach(&interp, __builtin_frame_address(0));
+    pool_worker_self = self;
+    while (true) {
+        if (pool_help(pool)) {
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && atomic_load(&pool->queued) <= 0) {
+            heap_wait(&pool->work, &pool->lock);
+        }
+        bool stopping = pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+        if (stopping) {
+            break;
+        }
+    }
+    interp_detach(&interp);
+    return NULL;
+}
+
+Pool *pool_new(Interpreter *root, size_t n_workers)
+{
+    if (n_workers == 0) {
+        // STUTTER_WORKERS overrides the number of cores
+        char *env = getenv("STUTTER_WORKERS");
+        long n = env ? strtol(env, NULL, 10) : 0;
+        if (n <= 0) {
+            n = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        n_workers = n > 0 ? (size_t) n : 1;
+    }
+    if (n_workers > POOL_MAX_WORKERS) {
+        n_workers = POOL_MAX_WORKERS;
+    }
+    Pool *pool = calloc(1, sizeof(Pool));
+    PoolWorker *workers = calloc(n_workers, sizeof(PoolWorker));
+    if (!pool || !workers) {
+        free(pool);
+        free(workers);
+        return NULL;
+    }
+    pool->root = root;
+    pool->workers = workers;
+    pool->n_workers = n_workers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    atomic_init(&pool->queued, 0);
+    interp_share(root);
+    for (size_t i = 0; i < n_workers; ++i) {
+        pool_deque_init(&workers[i].deque);
+        workers[i].pool = pool;
+        workers[i].seed = (unsigned) i + 1;
+    }
+    // all deques exist before any worker starts stealing
+    for (size_t i = 0; i < n_workers; ++i) {
+        workers[i].started = pthread_create(&workers[i].thread, NULL,
+                                            pool_worker_run, &workers[i]) == 0;
+        if (!workers[i].started) {
+            LOG_WARNING("Failed to start worker %zu, waiting threads will help out", i);
+        }
+    }
+    return pool;
+}
+
+void pool_delete(Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->n_workers; ++i) {
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+    for (size_t i = 0; i < pool->n_workers; ++i) {
+        PoolDeque *d = &pool->workers[i].deque;
+        PoolTask *task;
+        while ((task = pool_deque_take(d))) {
+            free(task);
+        }
+        pool_deque_destroy(d);
+    }
+    while (pool->queue_head) {
+        PoolTask *next = pool->queue_head->next;
+        free(pool->queue_head);
+        pool->queue_head = next;
+    }
+    pthread_cond_destroy(&pool->changed);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+void pool_submit(Pool *pool, void (*run)(void *), void *arg)
+{
+    PoolTask *task = malloc(sizeof(PoolTask));
+    if (!task) {
+        run(arg);
+        return;
+    }
+    task->run = run;
+    task->arg = arg;
+    task->next = NULL;
+    atomic_fetch_add(&pool->queued, 1);
+    PoolWorker *self = pool_self(pool);
+    if (self) {
+        pool_deque_push(&self->deque, task);
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (!self) {
+        if (pool->queue_tail) {
+            pool->queue_tail->next = task;
+        } else {
+            pool->queue_head = task;
+        }
+        pool->queue_tail = task;
+    }
+    pthread_cond_signal(&pool->work);
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(Pool *pool, atomic_bool *done)
+{
+    while (!atomic_load(done)) {
+        if (pool_help(pool)) {
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (!atomic_load(done) && atomic_load(&pool->queued) <= 0) {
+            heap_wait(&pool->changed, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void pool_notify(Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t pool_pending(Pool *pool, void **args)
+{
+    size_t n = 0;
+    for (PoolTask *task = pool->queue_head; task; task = task->next, ++n) {
+        if (args) {
+            args[n] = task->arg;
+        }
+    }
+    for (size_t i = 0; i < pool->n_workers; ++i) {
+        PoolDeque *d = &pool->workers[i].deque;
+        long t = atomic_load(&d->top);
+        long b = atomic_load(&d->bottom);
+        PoolBuffer *buf = atomic_load(&d->buffer);
+        for (long j = t; j < b; ++j, ++n) {
+            if (args) {
+                args[n] = atomic_load(&buf->items[j % buf->capacity])->arg;
+            }
+        }
+    }
+    return n;
+}
@@ -20,7 +20,7 @@ Reader *reader_new(FILE *stream)
 
 void reader_delete(Reader *r)
 {
-    free(r->lexer);
+    lexer_delete(r->lexer);
     free(r);
 }
 
@@ -188,7 +188,7 @@ AstSexpr *reader_read(Reader *reader)
                     // push rule RHS onto stack in reverse order
                     ReaderStackToken token;
                     token.type = N_SEXP;
-                    token.ast.sexp = tos.ast.list->as.compound.sexpr;
+                    token.ast.sexp = tos.ast.sexp->as.quoted;
                     reader_stack_push(stack, token);
                     if (tok->type == LEXER_TOK_QUOTE) {
                         token.type = T_QUOTE;
@@ -42,7 +42,8 @@ void reader_stack_delete(ReaderStack *stack)
 void reader_stack_push(ReaderStack *stack, ReaderStackToken item)
 {
     if (stack->size >= stack->capacity) {
-        stack->bos = realloc(stack->bos, 2 * stack->capacity);
+        stack->capacity *= 2;
+        stack->bos = realloc(stack->bos, sizeof(ReaderStackToken) * stack->capacity);
     }
     stack->bos[stack->size++] = item;
 }
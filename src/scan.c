@@ -0,0 +1,569 @@
+#include "scan.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#define SCAN_BLOCK 64
+#define SCAN_INITIAL_CAPACITY 1024
+
+/*
+ * Per-block character classes, one bit per input byte.
+ */
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t space;
+    uint64_t punct;     /* ( ) ' ` ~ */
+    uint64_t semicolon;
+    uint64_t newline;
+} ScanMasks;
+
+static void scan_classify_scalar(const unsigned char *s, ScanMasks *m)
+{
+    memset(m, 0, sizeof(ScanMasks));
+    for (size_t i = 0; i < SCAN_BLOCK; ++i) {
+        uint64_t bit = 1ULL << i;
+        switch (s[i]) {
+            case '"':
+                m->quote |= bit;
+                break;
+            case '\\':
+                m->backslash |= bit;
+                break;
+            case '\n':
+                m->newline |= bit;
+                m->space |= bit;
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+                m->space |= bit;
+                break;
+            case '(':
+            case ')':
+            case '\'':
+            case '`':
+            case '~':
+                m->punct |= bit;
+                break;
+            case ';':
+                m->semicolon |= bit;
+                break;
+        }
+    }
+}
+
+#ifdef SCAN_X86
+static uint64_t scan_eq16(const __m128i v[4], char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t r0 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[0], needle));
+    uint64_t r1 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[1], needle));
+    uint64_t r2 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[2], needle));
+    uint64_t r3 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[3], needle));
+    return r0 | (r1 << 16) | (r2 << 32) | (r3 << 48);
+}
+
+static void scan_classify_sse2(const unsigned char *s, ScanMasks *m)
+{
+    const __m128i v[4] = {
+        _mm_loadu_si128((const __m128i *) (s + 0)),
+        _mm_loadu_si128((const __m128i *) (s + 16)),
+        _mm_loadu_si128((const __m128i *) (s + 32)),
+        _mm_loadu_si128((const __m128i *) (s + 48))
+    };
+    m->quote = scan_eq16(v, '"');
+    m->backslash = scan_eq16(v, '\\');
+    m->newline = scan_eq16(v, '\n');
+    m->space = m->newline | scan_eq16(v, ' ') | scan_eq16(v, '\t')
+               | scan_eq16(v, '\r');
+    m->punct = scan_eq16(v, '(') | scan_eq16(v, ')') | scan_eq16(v, '\'')
+               | scan_eq16(v, '`') | scan_eq16(v, '~');
+    m->semicolon = scan_eq16(v, ';');
+}
+
+__attribute__((target("avx2")))
+static uint64_t scan_eq32(const __m256i v[2], char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    uint64_t lo = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v[0], needle));
+    uint64_t hi = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v[1], needle));
+    return lo | (hi << 32);
+}
+
+__attribute__((target("avx2")))
+static void scan_classify_avx2(const unsigned char *s, ScanMasks *m)
+{
+    const __m256i v[2] = {
+        _mm256_loadu_si256((const __m256i *) (s + 0)),
+        _mm256_loadu_si256((const __m256i *) (s + 32))
+    };
+    m->quote = scan_eq32(v, '"');
+    m->backslash = scan_eq32(v, '\\');
+    m->newline = scan_eq32(v, '\n');
+    m->space = m->newline | scan_eq32(v, ' ') | scan_eq32(v, '\t')
+               | scan_eq32(v, '\r');
+    m->punct = scan_eq32(v, '(') | scan_eq32(v, ')') | scan_eq32(v, '\'')
+               | scan_eq32(v, '`') | scan_eq32(v, '~');
+    m->semicolon = scan_eq32(v, ';');
+}
+#endif
+
+typedef void (*ScanClassifyFn)(const unsigned char *, ScanMasks *);
+
+static ScanClassifyFn scan_classifier()
+{
+#ifdef SCAN_X86
+#if defined(__GNUC__) || defined(__clang__)
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_classify_avx2;
+    }
+#endif
+    return scan_classify_sse2;
+#else
+    return scan_classify_scalar;
+#endif
+}
+
+/*
+ * Bits of all bytes that directly follow an odd-length run of
+ * backslashes. Backslashes are rare, so walking them is cheaper than
+ * anything clever.
+ */
+static uint64_t scan_escaped(uint64_t backslash, uint64_t *carry)
+{
+    uint64_t escaped = *carry;
+    backslash &= ~escaped;
+    *carry = 0;
+    while (backslash) {
+        int i = __builtin_ctzll(backslash);
+        if (i == 63) {
+            *carry = 1;
+        } else {
+            escaped |= 1ULL << (i + 1);
+        }
+        backslash &= backslash - 1;
+        backslash &= ~escaped;
+    }
+    return escaped;
+}
+
+/*
+ * Inclusive prefix xor: bit i is the parity of bits 0..i of x.
+ */
+static uint64_t scan_prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/* bits [from, to) */
+static uint64_t scan_range(int from, int to)
+{
+    uint64_t hi = to >= 64 ? ~0ULL : (1ULL << to) - 1;
+    uint64_t lo = (1ULL << from) - 1;
+    return hi & ~lo;
+}
+
+/*
+ * Resolves strings and comments sequentially. Only used for blocks that
+ * contain a comment, where the interplay of ';', '"' and '\n' can not be
+ * expressed with a prefix xor.
+ */
+static void scan_resolve_comments(uint64_t quote, uint64_t semicolon,
+                                  uint64_t newline, ScanState *st,
+                                  uint64_t *in_string, uint64_t *comment)
+{
+    uint64_t events = quote | semicolon | newline;
+    bool str = st->in_string != 0;
+    int start = 0;
+    *in_string = 0;
+    *comment = 0;
+    while (events) {
+        int i = __builtin_ctzll(events);
+        uint64_t bit = 1ULL << i;
+        events &= events - 1;
+        if (st->in_comment) {
+            if (newline & bit) {
+                *comment |= scan_range(start, i);
+                st->in_comment = false;
+            }
+        } else if (str) {
+            if (quote & bit) {
+                *in_string |= scan_range(start, i);
+                str = false;
+            }
+        } else if (quote & bit) {
+            start = i;
+            str = true;
+        } else if (semicolon & bit) {
+            start = i;
+            st->in_comment = true;
+        }
+    }
+    if (st->in_comment) {
+        *comment |= scan_range(start, 64);
+    } else if (str) {
+        *in_string |= scan_range(start, 64);
+    }
+    st->in_string = str ? ~0ULL : 0;
+}
+
+/*
+ * What a block holds besides its character classes.
+ */
+typedef struct {
+    uint64_t start;     /* token starts, see ScanIndex */
+    uint64_t atom_end;  /* the first byte after each atom */
+    uint64_t escape;    /* backslashes in strings */
+} ScanBits;
+
+static void scan_block(const ScanMasks *m, ScanState *st, ScanBits *b)
+{
+    uint64_t escaped = scan_escaped(m->backslash, &st->escaped);
+    uint64_t quote = m->quote & ~escaped;
+    uint64_t in_string, comment = 0;
+
+    if (!st->in_comment && !m->semicolon) {
+        // in_string covers the opening quote up to, but excluding, the
+        // closing quote
+        in_string = scan_prefix_xor(quote) ^ st->in_string;
+        st->in_string = (uint64_t) ((int64_t) in_string >> 63);
+    } else {
+        scan_resolve_comments(quote, m->semicolon, m->newline, st,
+                              &in_string, &comment);
+        quote &= ~comment;
+    }
+
+    uint64_t outside = ~(in_string | quote | comment);
+    uint64_t punct = m->punct & outside;
+    uint64_t atom = outside & ~(m->space | m->punct | m->semicolon);
+    uint64_t atom_start = atom & ~((atom << 1) | st->in_atom);
+    b->atom_end = ~atom & ((atom << 1) | st->in_atom);
+    b->escape = m->backslash & in_string;
+    b->start = punct | quote | atom_start;
+    st->in_atom = atom >> 63;
+}
+
+ScanIndex *scan_index_new()
+{
+    ScanIndex *idx = (ScanIndex *) malloc(sizeof(ScanIndex));
+    *idx = (ScanIndex) {
+        .offsets = NULL,
+        .size = 0,
+        .capacity = 0,
+        .scanned = 0,
+        .state = { 0 }
+    };
+    return idx;
+}
+
+void scan_index_delete(ScanIndex *idx)
+{
+    if (idx) {
+        free(idx->offsets);
+        free(idx);
+    }
+}
+
+static void scan_index_reserve(ScanIndex *idx, size_t extra)
+{
+    if (idx->size + extra > idx->capacity) {
+        size_t capacity = idx->capacity ? idx->capacity : SCAN_INITIAL_CAPACITY;
+        while (capacity < idx->size + extra) {
+            capacity *= 2;
+        }
+        idx->offsets = (size_t *) realloc(idx->offsets, capacity * sizeof(size_t));
+        idx->capacity = capacity;
+    }
+}
+
+static void scan_index_append(ScanIndex *idx, size_t base, uint64_t bits)
+{
+    scan_index_reserve(idx, SCAN_BLOCK);
+    size_t *out = idx->offsets + idx->size;
+    while (bits) {
+        *out++ = base + __builtin_ctzll(bits);
+        bits &= bits - 1;
+    }
+    idx->size = out - idx->offsets;
+}
+
+void scan_index_build(ScanIndex *idx, const char *buf, size_t n)
+{
+    idx->size = 0;
+    idx->scanned = 0;
+    idx->state = (ScanState) { 0 };
+    // a single pre-sizing guess; dense input grows the index as needed
+    scan_index_reserve(idx, n / 4 + SCAN_BLOCK);
+    scan_index_extend(idx, buf, n);
+}
+
+void scan_index_extend(ScanIndex *idx, const char *buf, size_t n)
+{
+    ScanClassifyFn classify = scan_classifier();
+    ScanMasks m;
+    ScanBits b;
+    // entries of the last incomplete block are redone with what follows
+    while (idx->size > 0 && idx->offsets[idx->size - 1] >= idx->scanned) {
+        idx->size--;
+    }
+    size_t base = idx->scanned;
+    for (; n - base >= SCAN_BLOCK; base += SCAN_BLOCK) {
+        classify((const unsigned char *) buf + base, &m);
+        scan_block(&m, &idx->state, &b);
+        scan_index_append(idx, base, b.start);
+    }
+    idx->scanned = base;
+    if (base < n) {
+        // pad the incomplete block with whitespace, which never produces
+        // an index entry, and keep the state before it
+        unsigned char tail[SCAN_BLOCK];
+        memset(tail, ' ', SCAN_BLOCK);
+        memcpy(tail, buf + base, n - base);
+        scan_classify_scalar(tail, &m);
+        ScanState st = idx->state;
+        scan_block(&m, &st, &b);
+        scan_index_append(idx, base, b.start);
+    }
+}
+
+size_t scan_index_drop(ScanIndex *idx, size_t n)
+{
+    size_t k = 0;
+    while (k < idx->size && idx->offsets[k] < n) {
+        k++;
+    }
+    for (size_t i = k; i < idx->size; ++i) {
+        idx->offsets[i - k] = idx->offsets[i] - n;
+    }
+    idx->size -= k;
+    idx->scanned -= n;
+    return k;
+}
+
+ScanTape *scan_tape_new()
+{
+    ScanTape *tape = (ScanTape *) malloc(sizeof(ScanTape));
+    *tape = (ScanTape) {
+        .tokens = NULL,
+        .size = 0,
+        .capacity = 0,
+        .open = SIZE_MAX,
+        .scanned = 0,
+        .state = { 0 }
+    };
+    return tape;
+}
+
+void scan_tape_delete(ScanTape *tape)
+{
+    if (tape) {
+        free(tape->tokens);
+        free(tape);
+    }
+}
+
+static void scan_tape_reserve(ScanTape *tape, size_t extra)
+{
+    if (tape->size + extra > tape->capacity) {
+        size_t capacity = tape->capacity ? tape->capacity : SCAN_INITIAL_CAPACITY;
+        while (capacity < tape->size + extra) {
+            capacity *= 2;
+        }
+        tape->tokens = (ScanToken *) realloc(tape->tokens, capacity * sizeof(ScanToken));
+        tape->capacity = capacity;
+    }
+}
+
+static void scan_tape_push(ScanTape *tape, ScanKind kind, size_t offset, size_t length)
+{
+    tape->tokens[tape->size++] = (ScanToken) {
+        .kind = kind, .offset = offset, .length = length
+    };
+}
+
+/* the first kind of each punctuation character, "~@" is fixed up later */
+static ScanKind scan_punct_kind(char c)
+{
+    switch (c) {
+    case '(':
+        return SCAN_LPAREN;
+    case ')':
+        return SCAN_RPAREN;
+    case '\'':
+        return SCAN_QUOTE;
+    case '`':
+        return SCAN_QUASIQUOTE;
+    default:
+        return SCAN_UNQUOTE;
+    }
+}
+
+/* bits above i */
+static uint64_t scan_above(int i)
+{
+    return ~0ULL << i << 1;
+}
+
+/* the tokens of a block, a string or an atom may still be open */
+static void scan_tape_append(ScanTape *tape, const char *block, size_t base,
+                             const ScanBits *b)
+{
+    // at most one token per byte
+    scan_tape_reserve(tape, SCAN_BLOCK);
+    uint64_t starts = b->start;
+    if (tape->open != SIZE_MAX) {
+        // the token open since an earlier block ends at the first atom end
+        // or, for a string, at the closing quote, which is the first start
+        ScanToken *t = &tape->tokens[tape->open];
+        uint64_t end = t->kind == SCAN_ATOM ? b->atom_end : starts;
+        uint64_t inside = end ? (end & -end) - 1 : ~0ULL;
+        if (t->kind != SCAN_ATOM) {
+            if (b->escape & inside) {
+                t->kind = SCAN_ESCAPED_STRING;
+            }
+            starts &= starts - 1;
+        }
+        if (!end) {
+            return;
+        }
+        t->length = base + __builtin_ctzll(end) - t->offset;
+        if (t->length == 0) {
+            // the lone '@' of a "~@"
+            tape->size--;
+        }
+        tape->open = SIZE_MAX;
+    }
+    while (starts) {
+        int i = __builtin_ctzll(starts);
+        size_t pos = base + i;
+        char c = block[i];
+        starts &= starts - 1;
+        if (c == '"') {
+            ScanKind kind = SCAN_STRING;
+            if (starts) {
+                int j = __builtin_ctzll(starts);
+                starts &= starts - 1;
+                if (b->escape & scan_above(i) & ((1ULL << j) - 1)) {
+                    kind = SCAN_ESCAPED_STRING;
+                }
+                scan_tape_push(tape, kind, pos + 1, j - i - 1);
+            } else {
+                if (b->escape & scan_above(i)) {
+                    kind = SCAN_ESCAPED_STRING;
+                }
+                tape->open = tape->size;
+                scan_tape_push(tape, kind, pos + 1, 0);
+            }
+        } else if (c == '(' || c == ')' || c == '\'' || c == '`' || c == '~') {
+            scan_tape_push(tape, scan_punct_kind(c), pos, 1);
+        } else {
+            ScanToken *prev = tape->size > 0 ? &tape->tokens[tape->size - 1] : NULL;
+            size_t start = pos;
+            if (c == '@' && prev && prev->kind == SCAN_UNQUOTE
+                    && prev->offset + 1 == pos) {
+                prev->kind = SCAN_SPLICE_UNQUOTE;
+                prev->length = 2;
+                start++;
+            }
+            uint64_t end = b->atom_end & scan_above(i);
+            if (!end) {
+                tape->open = tape->size;
+                scan_tape_push(tape, SCAN_ATOM, start, 0);
+            } else if (base + __builtin_ctzll(end) > start) {
+                scan_tape_push(tape, SCAN_ATOM, start, base + __builtin_ctzll(end) - start);
+            }
+        }
+    }
+}
+
+void scan_tape_build(ScanTape *tape, const char *buf, size_t n)
+{
+    tape->size = 0;
+    tape->open = SIZE_MAX;
+    tape->scanned = 0;
+    tape->state = (ScanState) { 0 };
+    scan_tape_reserve(tape, n / 4 + SCAN_BLOCK);
+    scan_tape_extend(tape, buf, n);
+    scan_tape_finish(tape, buf, n);
+}
+
+void scan_tape_extend(ScanTape *tape, const char *buf, size_t n)
+{
+    ScanClassifyFn classify = scan_classifier();
+    ScanMasks m;
+    ScanBits b;
+    size_t base = tape->scanned;
+    for (; n - base >= SCAN_BLOCK; base += SCAN_BLOCK) {
+        classify((const unsigned char *) buf + base, &m);
+        scan_block(&m, &tape->state, &b);
+        scan_tape_append(tape, buf + base, base, &b);
+    }
+    tape->scanned = base;
+}
+
+void scan_tape_finish(ScanTape *tape, const char *buf, size_t n)
+{
+    size_t base = tape->scanned;
+    if (base < n) {
+        // padded with whitespace as in the index, which also ends an atom
+        // that runs to the end
+        unsigned char tail[SCAN_BLOCK];
+        ScanMasks m;
+        ScanBits b;
+        memset(tail, ' ', SCAN_BLOCK);
+        memcpy(tail, buf + base, n - base);
+        scan_classify_scalar(tail, &m);
+        scan_block(&m, &tape->state, &b);
+        scan_tape_append(tape, (const char *) tail, base, &b);
+        tape->scanned = n;
+    }
+    if (tape->open != SIZE_MAX) {
+        ScanToken *t = &tape->tokens[tape->open];
+        t->length = n - t->offset;
+        if (t->kind == SCAN_ATOM) {
+            if (t->length == 0) {
+                tape->size--;
+            }
+        } else {
+            t->kind = SCAN_OPEN_STRING;
+        }
+        tape->open = SIZE_MAX;
+    }
+}
+
+void scan_tape_forget(ScanTape *tape, size_t k)
+{
+    memmove(tape->tokens, tape->tokens + k,
+            (tape->size - k) * sizeof(ScanToken));
+    tape->size -= k;
+    if (tape->open != SIZE_MAX) {
+        tape->open -= k;
+    }
+}
+
+size_t scan_tape_drop(ScanTape *tape, size_t n)
+{
+    size_t k = 0;
+    while (k < tape->size && tape->tokens[k].offset < n) {
+        k++;
+    }
+    scan_tape_forget(tape, k);
+    for (size_t i = 0; i < tape->size; ++i) {
+        tape->tokens[i].offset -= n;
+    }
+    tape->scanned -= n;
+    return k;
+}
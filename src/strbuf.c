@@ -0,0 +1,121 @@
+#include "strbuf.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+void strbuf_init(StrBuf *b)
+{
+    *b = (StrBuf) {
+        .data = NULL,
+        .size = 0,
+        .capacity = 0,
+        .fd = -1
+    };
+}
+
+void strbuf_init_fd(StrBuf *b, int fd, size_t capacity)
+{
+    *b = (StrBuf) {
+        .data = malloc(capacity),
+        .size = 0,
+        .capacity = capacity,
+        .fd = fd
+    };
+}
+
+void strbuf_destroy(StrBuf *b)
+{
+    strbuf_flush(b);
+    free(b->data);
+    strbuf_init(b);
+}
+
+/*
+ * Writes all of iov, in as few system calls as the kernel allows. Output
+ * that can not be written (e.g. to a closed pipe) is dropped.
+ */
+static void strbuf_write(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void strbuf_flush(StrBuf *b)
+{
+    if (b->fd >= 0 && b->size > 0) {
+        struct iovec iov = { .iov_base = b->data, .iov_len = b->size };
+        strbuf_write(b->fd, &iov, 1);
+        b->size = 0;
+    }
+}
+
+/* makes room for n more bytes plus a terminating NUL */
+static void strbuf_reserve(StrBuf *b, size_t n)
+{
+    if (b->size + n < b->capacity) {
+        return;
+    }
+    size_t capacity = b->capacity ? b->capacity : 64;
+    while (capacity <= b->size + n) {
+        capacity *= 2;
+    }
+    b->data = realloc(b->data, capacity);
+    b->capacity = capacity;
+}
+
+void strbuf_append(StrBuf *b, const char *s, size_t n)
+{
+    if (b->fd >= 0 && b->size + n >= b->capacity) {
+        if (n >= b->capacity) {
+            // too big to buffer, write it together with what is pending
+            struct iovec iov[2] = {
+                { .iov_base = b->data, .iov_len = b->size },
+                { .iov_base = (void *) s, .iov_len = n }
+            };
+            strbuf_write(b->fd, iov, 2);
+            b->size = 0;
+            return;
+        }
+        strbuf_flush(b);
+    }
+    strbuf_reserve(b, n);
+    memcpy(b->data + b->size, s, n);
+    b->size += n;
+}
+
+void strbuf_puts(StrBuf *b, const char *s)
+{
+    strbuf_append(b, s, strlen(s));
+}
+
+void strbuf_putc(StrBuf *b, char c)
+{
+    if (b->size + 1 < b->capacity) {
+        b->data[b->size++] = c;
+    } else {
+        strbuf_append(b, &c, 1);
+    }
+}
+
+const char *strbuf_cstr(StrBuf *b)
+{
+    strbuf_reserve(b, 0);
+    b->data[b->size] = '\0';
+    return b->data;
+}
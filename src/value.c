@@ -1,22 +1,34 @@
 #include "value.h"
 #include <string.h>
+#include "djb2.h"
+#include "interp.h"
 #include "log.h"
+#include "number.h"
 #include <assert.h>
 #include <stdarg.h>
+#include <unistd.h>
 
 
 const char *value_type_names[] = {
+    "VALUE_ATOM",
     "VALUE_BOOL",
     "VALUE_BUILTIN_FN",
+    "VALUE_CHANNEL",
     "VALUE_EXCEPTION",
     "VALUE_FLOAT",
     "VALUE_FN",
+    "VALUE_FUTURE",
     "VALUE_INT",
+    "VALUE_KEYWORD",
+    "VALUE_LAZY_SEQ",
     "VALUE_LIST",
     "VALUE_MACRO_FN",
     "VALUE_NIL",
+    "VALUE_STREAM",
     "VALUE_STRING",
-    "VALUE_SYMBOL"
+    "VALUE_SYMBOL",
+    "VALUE_TRANSDUCER",
+    "VALUE_TRANSIENT"
 };
 
 
@@ -43,6 +55,11 @@ bool is_symbol(const Value *value)
     return value->type == VALUE_SYMBOL;
 }
 
+bool is_keyword(const Value *value)
+{
+    return value->type == VALUE_KEYWORD;
+}
+
 bool is_macro(const Value *value)
 {
     return value->type == VALUE_MACRO_FN;
@@ -53,10 +70,27 @@ bool is_list(const Value *value)
     return value->type == VALUE_LIST;
 }
 
+bool is_stream(const Value *value)
+{
+    return value->type == VALUE_STREAM;
+}
+
+bool is_lazy_seq(const Value *value)
+{
+    return value->type == VALUE_LAZY_SEQ;
+}
+
+bool is_seq(const Value *value)
+{
+    return value->type == VALUE_NIL || value->type == VALUE_LIST
+           || value->type == VALUE_LAZY_SEQ || value->type == VALUE_STREAM;
+}
+
 static Value *value_new(ValueType type)
 {
-    Value *v = (Value *) gc_malloc(&gc, sizeof(Value));
+    Value *v = (Value *) heap_malloc(sizeof(Value));
     v->type = type;
+    atomic_init(&v->checked, false);
     return v;
 }
 
@@ -80,7 +114,7 @@ Value *value_new_int(int int_)
     return v;
 }
 
-Value *value_new_float(float float_)
+Value *value_new_float(double float_)
 {
     Value *v = value_new(VALUE_FLOAT);
     v->value.float_ = float_;
@@ -97,7 +131,7 @@ Value *value_new_builtin_fn(Value * (fn)(const Value *))
 Value *value_new_fn(Value *args, Value *body, Environment *env)
 {
     Value *v = value_new(VALUE_FN);
-    v->value.fn = gc_calloc(&gc, 1, sizeof(CompositeFunction));
+    v->value.fn = heap_calloc(1, sizeof(CompositeFunction));
     v->value.fn->args = args;
     v->value.fn->body = body;
     v->value.fn->env = env;
@@ -107,43 +141,266 @@ Value *value_new_fn(Value *args, Value *body, Environment *env)
 Value *value_new_macro(Value *args, Value *body, Environment *env)
 {
     Value *v = value_new(VALUE_MACRO_FN);
-    v->value.fn = gc_calloc(&gc, 1, sizeof(CompositeFunction));
+    v->value.fn = heap_calloc(1, sizeof(CompositeFunction));
     v->value.fn->args = args;
     v->value.fn->body = body;
     v->value.fn->env = env;
     return v;
 }
 
+/*
+ * String headers follow their Value in the same allocation, so a
+ * destructor run on collection can still read them.
+ */
+static String *value_init_string(Value *v, ValueType type, const char *data, size_t length)
+{
+    v->type = type;
+    String *s = (String *) (v + 1);
+    s->data = data;
+    s->length = length;
+    atomic_init(&s->hash, 0);
+    s->owner = NULL;
+    s->terminated = true;
+    atomic_init(&s->cstr, NULL);
+    v->value.string = s;
+    return s;
+}
+
+/* a value with its string header and length + 1 bytes of contents */
+static Value *value_new_str(ValueType type, const char *str, size_t length)
+{
+    Value *v = (Value *) heap_malloc(sizeof(Value) + sizeof(String) + length + 1);
+    char *data = (char *) value_init_string(v, type, NULL, length) + sizeof(String);
+    if (length > 0) {
+        memcpy(data, str, length);
+    }
+    data[length] = '\0';
+    v->value.string->data = data;
+    return v;
+}
+
 Value *value_new_string(const char *str)
 {
-    Value *v = value_new(VALUE_STRING);
-    v->value.str = gc_strdup(&gc, str);
+    return value_new_str(VALUE_STRING, str, strlen(str));
+}
+
+Value *value_new_string_len(const char *str, size_t length)
+{
+    return value_new_str(VALUE_STRING, str, length);
+}
+
+Value *value_new_string_nocopy(char *str, size_t length)
+{
+    Value *v = (Value *) heap_malloc(sizeof(Value) + sizeof(String));
+    value_init_string(v, VALUE_STRING, str, length);
     return v;
 }
 
-Value *value_new_exception(const char *str)
+Value *value_new_string_ext(char *str, size_t length, void (*dtor)(void *))
+{
+    Value *v = (Value *) heap_malloc_ext(sizeof(Value) + sizeof(String), dtor);
+    value_init_string(v, VALUE_STRING, str, length);
+    return v;
+}
+
+Value *value_new_string_view(const Value *str, size_t start, size_t end)
 {
-    Value *v = value_new(VALUE_EXCEPTION);
-    v->value.str = gc_strdup(&gc, str);
+    const String *from = str->value.string;
+    assert(start <= end && end <= from->length);
+    Value *v = (Value *) heap_malloc(sizeof(Value) + sizeof(String));
+    String *s = value_init_string(v, VALUE_STRING, from->data + start, end - start);
+    // point at the string that owns the memory, so views of views do not
+    // keep each other alive
+    s->owner = from->owner ? from->owner : str;
+    s->terminated = from->terminated && end == from->length;
     return v;
 }
 
+Value *value_new_exception(const char *str)
+{
+    return value_new_str(VALUE_EXCEPTION, str, strlen(str));
+}
+
 Value *value_make_exception(const char *fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
     char *message = NULL;
-    vasprintf(&message, fmt, args);
+    int length = vasprintf(&message, fmt, args);
     va_end(args);
-    Value *ex = value_new_exception(message);
+    Value *ex = value_new_str(VALUE_EXCEPTION, message, length < 0 ? 0 : length);
     free(message);
     return ex;
 }
 
 Value *value_new_symbol(const char *str)
 {
-    Value *v = value_new(VALUE_SYMBOL);
-    v->value.str = gc_strdup(&gc, str);
+    return value_new_str(VALUE_SYMBOL, str, strlen(str));
+}
+
+Value *value_new_symbol_len(const char *str, size_t length)
+{
+    return value_new_str(VALUE_SYMBOL, str, length);
+}
+
+char *value_cstr(const Value *v)
+{
+    String *s = v->value.string;
+    if (s->terminated) {
+        return (char *) s->data;
+    }
+    char *cstr = atomic_load_explicit(&s->cstr, memory_order_acquire);
+    if (!cstr) {
+        char *copy = heap_malloc(s->length + 1);
+        memcpy(copy, s->data, s->length);
+        copy[s->length] = '\0';
+        // another thread may have stored its copy meanwhile, then use that one
+        cstr = atomic_compare_exchange_strong_explicit(&s->cstr, &cstr, copy,
+                memory_order_acq_rel, memory_order_acquire) ? copy : cstr;
+    }
+    return cstr;
+}
+
+unsigned long string_hash(String *s)
+{
+    unsigned long hash = atomic_load_explicit(&s->hash, memory_order_relaxed);
+    if (hash == 0) {
+        hash = djb2_n(s->data, s->length);
+        atomic_store_explicit(&s->hash, hash, memory_order_relaxed);
+    }
+    return hash;
+}
+
+bool string_equal(String *a, String *b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (a->length != b->length) {
+        return false;
+    }
+    unsigned long ha = atomic_load_explicit(&a->hash, memory_order_relaxed);
+    unsigned long hb = atomic_load_explicit(&b->hash, memory_order_relaxed);
+    if (ha && hb && ha != hb) {
+        return false;
+    }
+    return memcmp(a->data, b->data, a->length) == 0;
+}
+
+int string_compare(const String *a, const String *b)
+{
+    size_t n = a->length < b->length ? a->length : b->length;
+    int cmp = n > 0 ? memcmp(a->data, b->data, n) : 0;
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+Value *value_new_keyword(const char *name)
+{
+    // name -> Value *, per interpreter and never collected
+    Interpreter *interp = interp_current()->root;
+    heap_lock();
+    if (!interp->keywords) {
+        interp->keywords = map_new(64);
+        heap_make_static(interp->keywords);
+    }
+    Value **interned = map_get(interp->keywords, (char *) name);
+    Value *v = interned ? *interned : NULL;
+    if (!v) {
+        v = value_new_str(VALUE_KEYWORD, name, strlen(name));
+        map_put(interp->keywords, KEYWORD(v), &v, sizeof(Value *));
+    }
+    heap_unlock();
+    return v;
+}
+
+Value *value_new_stream(Value * (*next)(Stream *), void *state)
+{
+    Value *v = value_new(VALUE_STREAM);
+    v->value.stream = heap_malloc(sizeof(Stream));
+    v->value.stream->next = next;
+    v->value.stream->state = state;
+    return v;
+}
+
+Value *value_new_lazy_seq(bool (*realize)(LazySeq *, bool), void *state, bool pure)
+{
+    Value *v = value_new(VALUE_LAZY_SEQ);
+    LazySeq *seq = heap_calloc(1, sizeof(LazySeq));
+    seq->realize = realize;
+    seq->state = state;
+    seq->pure = pure;
+    v->value.lazy_seq = seq;
+    return v;
+}
+
+Value *value_new_chunk(Value **items, size_t count, Value *rest)
+{
+    Value *v = value_new(VALUE_LAZY_SEQ);
+    LazySeq *seq = heap_calloc(1, sizeof(LazySeq));
+    seq->realized = true;
+    seq->items = items;
+    seq->count = count;
+    seq->rest = rest;
+    v->value.lazy_seq = seq;
+    return v;
+}
+
+Value *value_new_transducer(XformStage *stages, size_t count)
+{
+    Value *v = value_new(VALUE_TRANSDUCER);
+    v->value.transducer = heap_malloc(sizeof(Transducer));
+    v->value.transducer->stages = stages;
+    v->value.transducer->count = count;
+    return v;
+}
+
+Value *value_new_transient(void)
+{
+    Value *v = value_new(VALUE_TRANSIENT);
+    v->value.transient = heap_calloc(1, sizeof(Transient));
+    return v;
+}
+
+Value *value_new_future(Value *fn)
+{
+    Value *v = value_new(VALUE_FUTURE);
+    Future *f = heap_malloc(sizeof(Future));
+    f->fn = fn;
+    atomic_init(&f->delivered, false);
+    atomic_init(&f->done, false);
+    f->value = NULL;
+    f->exc = NULL;
+    v->value.future = f;
+    return v;
+}
+
+Value *value_new_channel(size_t capacity)
+{
+    Value *v = value_new(VALUE_CHANNEL);
+    Channel *c = heap_calloc(1, sizeof(Channel));
+    if (capacity > 0) {
+        c->buf = heap_malloc(capacity * sizeof(Value *));
+    }
+    c->capacity = capacity;
+    v->value.channel = c;
+    return v;
+}
+
+Value *value_new_atom(Value *value)
+{
+    Value *v = value_new(VALUE_ATOM);
+    v->value.atom = heap_malloc(sizeof(Atom));
+    atomic_init(&v->value.atom->value, value);
+    return v;
+}
+
+Value *value_new_list_nocopy(const List *l)
+{
+    Value *v = value_new(VALUE_LIST);
+    v->value.list = l;
     return v;
 }
 
@@ -165,53 +422,118 @@ Value *value_make_list(Value *v)
     return r;
 }
 
-void value_print(const Value *v)
+/*
+ * Lists are walked with an explicit stack of positions, so printing
+ * deeply nested values can not overflow the C stack. Functions recurse
+ * into their argument list and body. Lazy sequences are realized into
+ * lists first; the stack lives on the gc heap to keep those alive.
+ */
+void value_write(StrBuf *out, const Value *v)
 {
-    if (!v) return;
-    switch(v->type) {
-    case VALUE_NIL:
-        fprintf(stderr, "NIL");
-        break;
-    case VALUE_BOOL:
-        fprintf(stderr, "%s", v->value.bool_ ? "true" : "false");
-        break;
-    case VALUE_INT:
-        fprintf(stderr, "%d", v->value.int_);
-        break;
-    case VALUE_FLOAT:
-        fprintf(stderr, "%f", v->value.float_);
-        break;
-    case VALUE_EXCEPTION:
-    case VALUE_STRING:
-    case VALUE_SYMBOL:
-        fprintf(stderr, "%s", v->value.str);
-        break;
-    case VALUE_LIST:
-        fprintf(stderr, "( ");
-        Value *head;
-        const List *tail = v->value.list;
-        while((head = list_head(tail)) != NULL) {
-            value_print(head);
-            fprintf(stderr, " ");
-            tail = list_tail(tail);
+    const ListItem **open = NULL;  /* current element of every open list */
+    size_t depth = 0, capacity = 0;
+    char buf[NUMBER_FLOAT_BUFSIZE];
+    while (true) {
+        switch (v ? v->type : VALUE_NIL) {
+        case VALUE_NIL:
+            if (v) strbuf_append(out, "nil", 3);
+            break;
+        case VALUE_BOOL:
+            strbuf_puts(out, v->value.bool_ ? "true" : "false");
+            break;
+        case VALUE_INT:
+            strbuf_append(out, buf, number_format_int(v->value.int_, buf));
+            break;
+        case VALUE_FLOAT:
+            strbuf_append(out, buf, number_format_float(v->value.float_, buf));
+            break;
+        case VALUE_EXCEPTION:
+        case VALUE_STRING:
+        case VALUE_SYMBOL:
+            strbuf_append(out, v->value.string->data, v->value.string->length);
+            break;
+        case VALUE_KEYWORD:
+            strbuf_putc(out, ':');
+            strbuf_append(out, v->value.string->data, v->value.string->length);
+            break;
+        case VALUE_LIST:
+        case VALUE_LAZY_SEQ: {
+            const List *list = is_list(v) ? LIST(v) : value_seq_list(v, false);
+            strbuf_putc(out, '(');
+            if (list->head) {
+                if (depth == capacity) {
+                    capacity = capacity ? 2 * capacity : 16;
+                    open = open ? heap_realloc(open, capacity * sizeof(ListItem *))
+                           : heap_malloc(capacity * sizeof(ListItem *));
+                }
+                open[depth++] = list->head;
+                v = list->head->val;
+                continue;
+            }
+            strbuf_putc(out, ')');
+            break;
         }
-        fprintf(stderr, ")");
-        break;
-    case VALUE_FN:
-        fprintf(stderr, "lambda: ");
-        value_print(FN(v)->args);
-        value_print(FN(v)->body);
-        break;
-    case VALUE_MACRO_FN:
-        fprintf(stderr, "macro: ");
-        value_print(FN(v)->args);
-        value_print(FN(v)->body);
-        break;
-    case VALUE_BUILTIN_FN:
-        fprintf(stderr, "#<@%p>", (void *) v->value.builtin_fn);
-        break;
+        case VALUE_FN:
+        case VALUE_MACRO_FN:
+            strbuf_append(out, "(lambda ", 8);
+            value_write(out, FN(v)->args);
+            strbuf_putc(out, ' ');
+            value_write(out, FN(v)->body);
+            strbuf_putc(out, ')');
+            break;
+        case VALUE_BUILTIN_FN:
+            snprintf(buf, sizeof(buf), "#<builtin_fn@%p>", (void *) v->value.builtin_fn);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_STREAM:
+            snprintf(buf, sizeof(buf), "#<stream@%p>", (void *) v->value.stream);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_TRANSDUCER:
+            snprintf(buf, sizeof(buf), "#<transducer@%p>", (void *) v->value.transducer);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_TRANSIENT:
+            snprintf(buf, sizeof(buf), "#<transient@%p>", (void *) v->value.transient);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_FUTURE:
+            snprintf(buf, sizeof(buf), "#<%s@%p>",
+                     v->value.future->fn ? "future" : "promise", (void *) v->value.future);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_CHANNEL:
+            snprintf(buf, sizeof(buf), "#<channel@%p>", (void *) v->value.channel);
+            strbuf_puts(out, buf);
+            break;
+        case VALUE_ATOM:
+            snprintf(buf, sizeof(buf), "#<atom@%p>", (void *) v->value.atom);
+            strbuf_puts(out, buf);
+            break;
+        }
+        // move on to the next element, closing the lists that are done
+        while (depth > 0 && !open[depth - 1]->next) {
+            strbuf_putc(out, ')');
+            depth--;
+        }
+        if (depth == 0) {
+            break;
+        }
+        open[depth - 1] = open[depth - 1]->next;
+        strbuf_putc(out, ' ');
+        v = open[depth - 1]->val;
+    }
+    if (open) {
+        heap_free(open);
     }
+}
 
+void value_print(const Value *v)
+{
+    StrBuf out;
+    strbuf_init_fd(&out, STDERR_FILENO, 4096);
+    value_write(&out, v);
+    strbuf_destroy(&out);
 }
 
 Value *value_head(const Value *v)
@@ -226,3 +548,135 @@ Value *value_tail(const Value *v)
     return value_new_list(list_tail(LIST(v)));
 }
 
+
+LazySeq *lazy_seq_realize(LazySeq *seq, bool cache)
+{
+    if (seq->realized) {
+        return seq;
+    }
+    if (!cache && seq->pure) {
+        LazySeq *copy = heap_malloc(sizeof(LazySeq));
+        *copy = *seq;
+        seq = copy;
+    }
+    if (!seq->realize(seq, cache)) {
+        return NULL;
+    }
+    // the producer state is not needed anymore
+    seq->realize = NULL;
+    seq->state = NULL;
+    seq->realized = true;
+    return seq;
+}
+
+/* continues the iteration with the elements of seq */
+static void seq_iter_enter(SeqIter *it, const Value *seq)
+{
+    if (!seq) {
+        return;
+    }
+    switch (seq->type) {
+    case VALUE_LIST:
+        it->item = LIST(seq)->head;
+        it->remaining = LIST(seq)->size;
+        break;
+    case VALUE_LAZY_SEQ:
+        it->chunk = lazy_seq_realize(LAZY_SEQ(seq), it->cache);
+        it->index = 0;
+        break;
+    case VALUE_STREAM:
+        it->stream = (Value *) seq;
+        break;
+    default:
+        break;
+    }
+}
+
+void seq_iter_init(SeqIter *it, const Value *seq, bool cache)
+{
+    it->item = NULL;
+    it->remaining = 0;
+    it->chunk = NULL;
+    it->index = 0;
+    it->stream = NULL;
+    it->cache = cache;
+    seq_iter_enter(it, seq);
+}
+
+bool seq_iter_next(SeqIter *it, Value **v)
+{
+    while (true) {
+        if (it->remaining > 0) {
+            *v = (Value *) it->item->val;
+            it->item = it->item->next;
+            it->remaining--;
+            return true;
+        }
+        if (it->chunk) {
+            if (it->index < it->chunk->count) {
+                *v = it->chunk->items[it->index++];
+                return true;
+            }
+            Value *rest = it->chunk->rest;
+            it->chunk = NULL;
+            seq_iter_enter(it, rest);
+            continue;
+        }
+        if (it->stream) {
+            Stream *stream = STREAM(it->stream);
+            if ((*v = stream->next(stream))) {
+                return true;
+            }
+            it->stream = NULL;
+        }
+        return false;
+    }
+}
+
+bool seq_iter_buffered(const SeqIter *it)
+{
+    return it->remaining > 0 || (it->chunk && it->index < it->chunk->count);
+}
+
+Value *seq_iter_rest(const SeqIter *it)
+{
+    if (it->remaining > 0) {
+        List *l = heap_malloc(sizeof(List));
+        l->head = (ListItem *) it->item;
+        l->size = it->remaining;
+        return value_new_list_nocopy(l);
+    }
+    if (it->chunk) {
+        if (it->index < it->chunk->count) {
+            // the collector only keeps arrays alive through pointers to
+            // their start, the rest of a chunk gets an array of its own
+            size_t count = it->chunk->count - it->index;
+            Value **items = heap_malloc(count * sizeof(Value *));
+            memcpy(items, it->chunk->items + it->index, count * sizeof(Value *));
+            return value_new_chunk(items, count, it->chunk->rest);
+        }
+        if (it->chunk->rest) {
+            return it->chunk->rest;
+        }
+    }
+    if (it->stream) {
+        return it->stream;
+    }
+    return value_new_list(list_new());
+}
+
+const List *value_seq_list(const Value *seq, bool cache)
+{
+    if (is_list(seq)) {
+        return LIST(seq);
+    }
+    ListBuilder b;
+    list_builder_init(&b);
+    SeqIter it;
+    seq_iter_init(&it, seq, cache);
+    Value *v;
+    while (seq_iter_next(&it, &v)) {
+        list_builder_append(&b, v);
+    }
+    return list_builder_finish(&b);
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parser.h"
+#include "../src/parser.c"
+
+/*
+ * Parse time for inputs of doubling size. Linear parsing shows up as a
+ * constant time per byte across the rows. The bulk column is the
+ * two-stage reader on the same input.
+ */
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t make_long(char *buf, size_t items)
+{
+    size_t n = sprintf(buf, "(");
+    for (size_t i = 0; i < items; ++i) {
+        n += sprintf(buf + n, "(f %zu \"s\") ", i % 1000);
+    }
+    n += sprintf(buf + n, ")");
+    return n;
+}
+
+static size_t make_deep(char *buf, size_t items)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < items; ++i) {
+        n += sprintf(buf + n, "(f %zu ", i % 1000);
+    }
+    for (size_t i = 0; i < items; ++i) {
+        buf[n++] = ')';
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* a data file: one record per line, with comments */
+static size_t make_data(char *buf, size_t items)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < items; ++i) {
+        if (i % 16 == 0) {
+            n += sprintf(buf + n, "; block %zu\n", i / 16);
+        }
+        n += sprintf(buf + n, "(:id %zu :name \"n%zu\" :x %zu.5 :tag t%zu)\n",
+                     i, i % 1000, i % 100, i % 7);
+    }
+    return n;
+}
+
+/* dead stack left over from the last run would keep its result alive */
+static void __attribute__((noinline)) clear_stack()
+{
+    volatile char pad[1 << 16];
+    memset((char *) pad, 0, sizeof(pad));
+}
+
+static double parse_time(const char *buf, size_t n,
+                         ParseResult (*parse)(const char *, size_t, Value **))
+{
+    Value *ast = NULL;
+    // without the garbage of the previous run
+    clear_stack();
+    gc_run(&gc);
+    double t = now();
+    ParseResult r = parse(buf, n, &ast);
+    t = now() - t;
+    if (r != PARSER_SUCCESS) {
+        printf("parse failed\n");
+        exit(1);
+    }
+    return t * 1e9 / n;
+}
+
+static void bench(const char *name, size_t (*make)(char *, size_t))
+{
+    printf("%-5s %10s %12s %10s %10s\n", name, "items", "bytes", "ns/byte",
+           "bulk");
+    for (size_t items = 1 << 12; items <= 1 << 20; items <<= 1) {
+        char *buf = malloc(64 * items + 64);
+        size_t n = make(buf, items);
+        double t = parse_time(buf, n, parser_parse_buffer);
+        double t_bulk = parse_time(buf, n, parser_parse_bulk);
+        printf("%-5s %10zu %12zu %10.2f %10.2f\n", "", items, n, t, t_bulk);
+        free(buf);
+    }
+}
+
+int main()
+{
+    int bos;
+    gc_start(&gc, &bos);
+    bench("long", make_long);
+    bench("deep", make_deep);
+    bench("data", make_data);
+    gc_stop(&gc);
+    return 0;
+}
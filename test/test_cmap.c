@@ -0,0 +1,123 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "minunit.h"
+#include "gc.h"
+
+#include "../src/cmap.c"
+
+static char *test_cmap()
+{
+    CMap *map = cmap_new(3);
+    int one = 1, two = 2;
+    mu_assert(cmap_get(map, "key") == NULL, "New map should be empty");
+    cmap_put(map, "key", &one);
+    mu_assert(cmap_get(map, "key") == &one, "Query must return inserted value");
+    cmap_put(map, "key", &two);
+    mu_assert(cmap_get(map, "key") == &two, "Query must return updated value");
+    mu_assert(map->size == 1, "Updates must not add entries");
+    cmap_put(map, "k", &one);
+    mu_assert(cmap_get(map, "key") == &two, "Query must not match a prefix of the key");
+    mu_assert(cmap_get_hashed(map, "k", djb2("k")) == &one, "Hashed query must find key");
+
+    // growing keeps all entries
+    CMapTable *table = atomic_load(&map->table);
+    char key[32];
+    for (int i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        cmap_put(map, key, &one);
+    }
+    mu_assert(atomic_load(&map->table)->capacity > table->capacity, "Map must grow");
+    for (int i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        mu_assert(cmap_get(map, key) == &one, "Map must keep entries when growing");
+    }
+    // readers still holding a replaced table see later updates
+    cmap_put(map, "key", &one);
+    mu_assert(cmap_find(table, "key", djb2("key"))->value == &one,
+              "Replaced tables must share entries");
+    return 0;
+}
+
+#define N_READERS 4
+#define N_FIXED 64
+#define N_WRITES 20000
+
+static CMap *shared;
+static int values[N_FIXED];
+static atomic_bool writing;
+static atomic_long errors;
+
+static void *read_shared(void *arg)
+{
+    (void) arg;
+    char key[32];
+    do {
+        for (int i = 0; i < N_FIXED; ++i) {
+            snprintf(key, sizeof(key), "fixed%d", i);
+            int *value = cmap_get(shared, key);
+            if (value != &values[i] && value != &values[(i + 1) % N_FIXED]) {
+                atomic_fetch_add(&errors, 1);
+            }
+        }
+    } while (atomic_load(&writing));
+    return NULL;
+}
+
+static char *test_cmap_concurrent()
+{
+    shared = cmap_new(3);
+    char key[32];
+    for (int i = 0; i < N_FIXED; ++i) {
+        snprintf(key, sizeof(key), "fixed%d", i);
+        cmap_put(shared, key, &values[i]);
+    }
+    // the readers are no heap threads, a shared heap only collects on request
+    interp_share(interp_current());
+    atomic_store(&writing, true);
+    pthread_t readers[N_READERS];
+    for (int i = 0; i < N_READERS; ++i) {
+        pthread_create(&readers[i], NULL, read_shared, NULL);
+    }
+    for (int i = 0; i < N_WRITES; ++i) {
+        // new keys make the table grow under the readers
+        snprintf(key, sizeof(key), "key%d", i);
+        cmap_put(shared, key, &values[0]);
+        snprintf(key, sizeof(key), "fixed%d", i % N_FIXED);
+        cmap_put(shared, key, &values[(i / N_FIXED) % 2 ? i % N_FIXED
+                                      : (i + 1) % N_FIXED]);
+    }
+    atomic_store(&writing, false);
+    for (int i = 0; i < N_READERS; ++i) {
+        pthread_join(readers[i], NULL);
+    }
+    mu_assert(atomic_load(&errors) == 0, "Readers must only see values that were put");
+    mu_assert(shared->size == N_FIXED + N_WRITES, "Map must hold all keys");
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    void *bos = NULL;
+    gc_start(&gc, &bos);
+    mu_run_test(test_cmap);
+    mu_run_test(test_cmap_concurrent);
+    gc_stop(&gc);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ cmap tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -13,6 +13,7 @@ static char *test_djb2()
     mu_assert(hash == 5381, "djb2 implementation error");
     hash = djb2("Hello World!");
     mu_assert(hash != 5381, "djb2 addition failure");
+    mu_assert(djb2_n("Hello World!", 5) == djb2("Hello"), "djb2_n must hash a prefix");
     return 0;
 }
 
@@ -18,6 +18,7 @@ static char *test_env()
     Value *ret0 = env_get(env0, "key1");
     mu_assert(ret0->type = VALUE_INT, "value type must not change");
     mu_assert(42 == ret0->value.int_, "Value must not change");
+    mu_assert(ret0 == val0, "Env must hold the value itself, not a copy");
     /*
      * nesting
      */
@@ -33,6 +34,27 @@ static char *test_env()
     return 0;
 }
 
+static char *test_env_frame()
+{
+    Environment *env0 = env_new(NULL);
+    Value *outer = value_new_int(1);
+    env_set(env0, "a", outer);
+    Environment *frame = env_new_frame(env0, 2);
+    Value *val0 = value_new_int(2);
+    Value *val1 = value_new_int(3);
+    env_bind(frame, "a", val0);
+    env_bind(frame, "b", val1);
+    mu_assert(env_get(frame, "a") == val0, "Slots must shadow the parent");
+    mu_assert(env_get(frame, "b") == val1, "Slots must hold the value itself");
+    env_set(frame, "b", val0);
+    mu_assert(env_get(frame, "b") == val0, "Setting a slot name must rebind the slot");
+    mu_assert(frame->nslots == 2, "Setting a slot name must not add a binding");
+    env_set(frame, "c", val1);
+    mu_assert(INT(env_get(frame, "c")) == 3, "Other names must go to the map");
+    mu_assert(INT(env_get(env0, "a")) == 1, "Parent must be unchanged");
+    return 0;
+}
+
 int tests_run = 0;
 
 static char *test_suite()
@@ -40,6 +62,7 @@ static char *test_suite()
     int bos;
     gc_start(&gc, &bos);
     mu_run_test(test_env);
+    mu_run_test(test_env_frame);
     gc_stop(&gc);
     return 0;
 }
@@ -0,0 +1,59 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "minunit.h"
+
+#include "../src/filemap.c"
+
+static char *test_filemap()
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    /* empty, short, exactly one page and a few pages plus a bit */
+    size_t sizes[] = { 0, 1, 100, page - 1, page, 3 * page + 17 };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        size_t size = sizes[k];
+        char path[] = "/tmp/stutter_filemap_XXXXXX";
+        int fd = mkstemp(path);
+        mu_assert(fd >= 0, "Failed to create temporary file");
+        unlink(path);
+        char *expected = malloc(size + 1);
+        for (size_t i = 0; i < size; ++i) {
+            expected[i] = 'a' + i % 26;
+        }
+        expected[size] = '\0';
+        mu_assert(write(fd, expected, size) == (ssize_t) size, "Short write");
+
+        char *data = filemap_open(fd, size);
+        close(fd);
+        mu_assert(data != NULL, "Failed to map file");
+        mu_assert(memcmp(data, expected, size) == 0, "Mapping differs from file");
+        mu_assert(data[size] == '\0', "Mapping is not NUL-terminated");
+        mu_assert(strlen(data) == size, "Unexpected string length");
+        filemap_close(data);
+        free(expected);
+    }
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_filemap);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Filemap tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
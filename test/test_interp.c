@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "minunit.h"
+#include "value.h"
+
+#include "../src/interp.c"
+
+#define N_THREADS 4
+#define N_ALLOCS 10000
+
+typedef struct {
+    int id;
+    Value *outer_keyword;   /* interned by the default interpreter */
+    char *error;
+} Run;
+
+static void *run_interp(void *arg)
+{
+    Run *run = arg;
+    int bos;
+    Interpreter *interp = interp_new(&bos);
+    interp_enter(interp);
+    if (HEAP != &interp->heap) {
+        run->error = "An entered interpreter must allocate from its own heap";
+        goto out;
+    }
+    interp->env = env_new(NULL);
+    gc_make_static(HEAP, interp->env);
+    env_set(interp->env, "x", value_new_int(run->id));
+    Value *keyword = value_new_keyword("k");
+    if (keyword == run->outer_keyword || value_new_keyword("k") != keyword) {
+        run->error = "Keywords must be interned per interpreter";
+        goto out;
+    }
+    for (int i = 0; i < N_ALLOCS; ++i) {
+        env_set(interp->env, "y", value_new_string("garbage"));
+    }
+    if (INT(env_get(interp->env, "x")) != run->id) {
+        run->error = "Bindings must not leak between interpreters";
+        goto out;
+    }
+out:
+    interp_delete(interp);
+    if (interp_current()->gc != &gc) {
+        run->error = "Deleting the current interpreter must restore the default";
+    }
+    return NULL;
+}
+
+static char *test_interp_default()
+{
+    Interpreter *interp = interp_current();
+    mu_assert(interp->gc == &gc, "The default interpreter must use the global heap");
+    mu_assert(interp_enter(interp) == interp, "Entering must return the previous interpreter");
+    mu_assert(interp_current() == interp, "Entering must make an interpreter current");
+    return 0;
+}
+
+static char *test_interp_threads()
+{
+    Value *keyword = value_new_keyword("k");
+    pthread_t threads[N_THREADS];
+    Run runs[N_THREADS];
+    for (int i = 0; i < N_THREADS; ++i) {
+        runs[i] = (Run) { .id = i, .outer_keyword = keyword, .error = NULL };
+        mu_assert(pthread_create(&threads[i], NULL, run_interp, &runs[i]) == 0,
+                  "Failed to start thread");
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        mu_assert(runs[i].error == NULL, runs[i].error);
+    }
+    mu_assert(value_new_keyword("k") == keyword, "Other interpreters must not touch the default");
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    int bos;
+    gc_start(&gc, &bos);
+    mu_run_test(test_interp_default);
+    mu_run_test(test_interp_threads);
+    gc_stop(&gc);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Interpreter tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -46,6 +46,34 @@ static char *test_ir()
     return 0;
 }
 
+static char *test_ir_deep()
+{
+    /* (((... '(1 2 3) ...))) */
+    size_t depth = 100000;
+    AstList *items = ast_list_empty();
+    for (int i = 3; i > 0; --i) {
+        items = ast_list_from_compound_list(
+                    ast_sexpr_from_atom(ast_atom_from_int(i)), items);
+    }
+    AstSexpr *ast = ast_sexpr_from_quote(ast_sexpr_from_list(items));
+    for (size_t i = 0; i < depth; ++i) {
+        ast = ast_sexpr_from_list(ast_list_from_compound_list(ast, ast_list_empty()));
+    }
+    Value *v = ir_from_ast_sexpr(ast);
+    for (size_t i = 0; i < depth; ++i) {
+        mu_assert(is_list(v) && list_size(LIST(v)) == 1, "Wrong nesting");
+        v = (Value *) list_head(LIST(v));
+    }
+    mu_assert(list_size(LIST(v)) == 2, "Quote should have two elements");
+    mu_assert(strcmp(STRING(list_head(LIST(v))), "quote") == 0, "Wrong quote symbol");
+    v = (Value *) list_nth(LIST(v), 1);
+    mu_assert(list_size(LIST(v)) == 3, "Quoted list has the wrong size");
+    for (size_t i = 0; i < 3; ++i) {
+        mu_assert(INT(list_nth(LIST(v), i)) == (int) i + 1, "Quoted list is out of order");
+    }
+    return 0;
+}
+
 int tests_run = 0;
 
 static char *test_suite()
@@ -53,6 +81,7 @@ static char *test_suite()
     int bos;
     gc_start(&gc, &bos);
     mu_run_test(test_ir);
+    mu_run_test(test_ir_deep);
     gc_stop(&gc);
     return 0;
 }
@@ -7,22 +7,27 @@
 
 static char *type_names[] = {
     "ERROR", "INT", "FLOAT", "STRING", "SYMBOL",
-    "LPAREN", "RPAREN", "QUOTE", "EOF"
+    "LPAREN", "RPAREN", "QUOTE", "QUASIQUOTE", "UNQUOTE",
+    "SPLICE_UNQUOTE", "KEYWORD", "EOF"
 };
 
 static char *input[] = {"12 ( 34.5 ) \"Hello World!\" abc 23.b (12(23))) \n"
                         "\"this is a string\" vEryC0mplicated->NamE 'symbol ",
                         "x ",
-                        "\"Testing \\\"n escapes\" "
+                        "\"Testing \\\"n escapes\" ",
+                        ":key (:a-b) : x :",
+                        ":a/b (ns/f /) a/"
                        };
 
-static size_t n_inputs = 3;
+static size_t n_inputs = 5;
 
 static char *expected[] = {"INT LPAREN FLOAT RPAREN STRING SYMBOL ERROR LPAREN "
                            "INT LPAREN INT RPAREN RPAREN RPAREN STRING SYMBOL "
                            "QUOTE SYMBOL ",
                            "SYMBOL ",
-                           "STRING "
+                           "STRING ",
+                           "KEYWORD LPAREN KEYWORD RPAREN ERROR SYMBOL ERROR ",
+                           "KEYWORD LPAREN SYMBOL SYMBOL RPAREN SYMBOL "
                           };
 
 static char *eval_lexer(char *input, char *expected)
@@ -93,12 +98,117 @@ static char *test_lexer()
     return 0;
 }
 
+static char *eval_buffer_lexer(char *input, char *expected)
+{
+    Lexer *lexer = lexer_new_from_buffer(input, strlen(input));
+    mu_assert(lexer != NULL, "Failed to create a buffer lexer object");
+
+    size_t n = strlen(expected);
+    FILE *ref_fd = fmemopen(expected, n, "r");
+    mu_assert(ref_fd != NULL, "Failed to open lexer test reference file");
+    char *ref_line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    LexerSlice tok;
+    lexer_next_slice(lexer, &tok);
+    linelen = getdelim(&ref_line, &linecap, ' ', ref_fd);
+    while (tok.type != LEXER_TOK_EOF && linelen > 0) {
+        ref_line[linelen - 1] = '\0';
+        mu_assert(strcmp(type_names[tok.type], ref_line) == 0,
+                  "Unexpected symbol in buffer mode");
+        lexer_next_slice(lexer, &tok);
+        linelen = getdelim(&ref_line, &linecap, ' ', ref_fd);
+    }
+    mu_assert(tok.type == LEXER_TOK_EOF && linelen == -1,
+              "Incorrect number of symbols in buffer mode");
+    free(ref_line);
+    lexer_delete(lexer);
+    fclose(ref_fd);
+    return 0;
+}
+
+static char *test_buffer_lexer()
+{
+    for (size_t i = 0; i < n_inputs; ++i) {
+        char *retval = eval_buffer_lexer(input[i], expected[i]);
+        if (retval) {
+            return retval;
+        }
+    }
+    return 0;
+}
+
+static char *test_buffer_slices()
+{
+    /* slices point into the buffer, strings decode their escapes */
+    char *input = "(def -x -1.5) ; comment\n\"a \\\"b\\\"\\n\" -7 - ~@y";
+    Lexer *lexer = lexer_new_from_buffer(input, strlen(input));
+    LexerSlice tok;
+    char str[64];
+
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_LPAREN && tok.offset == 0, "Expect LPAREN");
+    lexer_next_slice(lexer, &tok);
+    lexer_slice_str(lexer, &tok, str);
+    mu_assert(tok.type == LEXER_TOK_SYMBOL && strcmp(str, "def") == 0, "Expect def");
+    lexer_next_slice(lexer, &tok);
+    lexer_slice_str(lexer, &tok, str);
+    mu_assert(tok.type == LEXER_TOK_SYMBOL && strcmp(str, "-x") == 0, "Expect -x");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_FLOAT, "Expect float");
+    mu_assert(lexer_slice_float(lexer, &tok) == -1.5, "Expect -1.5");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_RPAREN, "Expect RPAREN");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_STRING && tok.line == 2, "Expect string on line 2");
+    lexer_slice_str(lexer, &tok, str);
+    mu_assert(strcmp(str, "a \"b\"\n") == 0, "Expect escapes to be decoded");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_INT && lexer_slice_int(lexer, &tok) == -7, "Expect -7");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_SYMBOL && tok.length == 1, "Expect -");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_SPLICE_UNQUOTE, "Expect ~@");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_SYMBOL, "Expect y");
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_EOF, "Expect EOF");
+    lexer_delete(lexer);
+
+    /* namespaced keywords and symbols */
+    input = ":a/b x/y";
+    lexer = lexer_new_from_buffer(input, strlen(input));
+    lexer_next_slice(lexer, &tok);
+    lexer_slice_str(lexer, &tok, str);
+    mu_assert(tok.type == LEXER_TOK_KEYWORD && strcmp(str, "a/b") == 0, "Expect :a/b");
+    lexer_next_slice(lexer, &tok);
+    lexer_slice_str(lexer, &tok, str);
+    mu_assert(tok.type == LEXER_TOK_SYMBOL && strcmp(str, "x/y") == 0, "Expect x/y");
+    lexer_delete(lexer);
+
+    /* no length limit */
+    size_t n = 100000;
+    char *big = malloc(n + 3);
+    big[0] = '"';
+    memset(big + 1, 'x', n);
+    big[n + 1] = '"';
+    big[n + 2] = '\0';
+    lexer = lexer_new_from_buffer(big, n + 2);
+    lexer_next_slice(lexer, &tok);
+    mu_assert(tok.type == LEXER_TOK_STRING && tok.length == n, "Expect a long string");
+    lexer_delete(lexer);
+    free(big);
+    return 0;
+}
+
 int tests_run = 0;
 
 static char *test_suite()
 {
     mu_run_test(test_lexer);
     mu_run_test(test_escapes);
+    mu_run_test(test_buffer_lexer);
+    mu_run_test(test_buffer_slices);
     return 0;
 }
 
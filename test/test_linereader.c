@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "minunit.h"
+
+#include "../src/linereader.c"
+
+/* a reader over a temporary file holding n bytes of s */
+static int open_input(const char *s, size_t n)
+{
+    char path[] = "/tmp/stutter_linereader_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return fd;
+    }
+    unlink(path);
+    if (write(fd, s, n) != (ssize_t) n) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static char *test_line_reader()
+{
+    const char source[] = "first\nsecond\r\n\nlast";
+    const char *expected[] = { "first", "second", "", "last" };
+    int fd = open_input(source, strlen(source));
+    mu_assert(fd >= 0, "Failed to create input");
+    LineReader r;
+    line_reader_init(&r, fd);
+    size_t n;
+    for (size_t k = 0; k < sizeof(expected) / sizeof(expected[0]); ++k) {
+        char *line = line_reader_next(&r, &n);
+        mu_assert(line != NULL, "Expected a line");
+        mu_assert(strcmp(line, expected[k]) == 0, "Unexpected line");
+        mu_assert(n == strlen(expected[k]), "Unexpected line length");
+    }
+    mu_assert(line_reader_next(&r, &n) == NULL, "Expected end of input");
+    mu_assert(line_reader_next(&r, &n) == NULL, "End of input must be sticky");
+    mu_assert(r.error == 0, "Unexpected read error");
+    line_reader_destroy(&r);
+    close(fd);
+    return 0;
+}
+
+static char *test_line_reader_refill()
+{
+    /* lines that straddle buffer refills, and one longer than the buffer */
+    size_t long_line = 3 * LINE_READER_BUFFER_SIZE + 5;
+    size_t capacity = 2 * LINE_READER_BUFFER_SIZE + long_line + 64;
+    char *source = malloc(capacity);
+    size_t n = 0, lines = 0;
+    while (n < LINE_READER_BUFFER_SIZE + 100) {
+        n += sprintf(source + n, "line %zu\n", lines++);
+    }
+    memset(source + n, 'x', long_line);
+    n += long_line;
+    source[n++] = '\n';
+    n += sprintf(source + n, "tail");
+
+    int fd = open_input(source, n);
+    mu_assert(fd >= 0, "Failed to create input");
+    LineReader r;
+    line_reader_init(&r, fd);
+    char expected[32];
+    size_t len;
+    for (size_t i = 0; i < lines; ++i) {
+        sprintf(expected, "line %zu", i);
+        char *line = line_reader_next(&r, &len);
+        mu_assert(line && strcmp(line, expected) == 0, "Unexpected line across refills");
+    }
+    char *line = line_reader_next(&r, &len);
+    mu_assert(line && len == long_line && strlen(line) == long_line, "Wrong long line");
+    line = line_reader_next(&r, &len);
+    mu_assert(line && strcmp(line, "tail") == 0, "Expected the unterminated last line");
+    mu_assert(line_reader_next(&r, &len) == NULL, "Expected end of input");
+    line_reader_destroy(&r);
+    close(fd);
+    free(source);
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_line_reader);
+    mu_run_test(test_line_reader_refill);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Line reader tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -148,6 +148,99 @@ static char *test_list()
     return 0;
 }
 
+static char *test_list_builder()
+{
+    ListBuilder b;
+    list_builder_init(&b);
+    const List *empty = list_builder_finish(&b);
+    mu_assert(list_size(empty) == 0, "Empty builder should give an empty list");
+    mu_assert(empty->head == NULL, "head ptr must be NULL");
+
+    Value *numbers[1000];
+    list_builder_init(&b);
+    for (size_t i = 0; i < 1000; ++i) {
+        numbers[i] = value_new_int(i);
+        list_builder_append(&b, numbers[i]);
+    }
+    const List *l = list_builder_finish(&b);
+    mu_assert(list_size(l) == 1000, "Builder list has the wrong length");
+    size_t i = 0;
+    for (ListItem *item = l->head; item; item = item->next, ++i) {
+        mu_assert(item->val == numbers[i], "Builder must keep the insertion order");
+    }
+    mu_assert(i == 1000, "Builder list size and items disagree");
+    return 0;
+}
+
+/* counts up from its state, two elements per chunk, ten in total */
+static size_t realizations = 0;
+
+static bool count_realize(LazySeq *seq, bool cache)
+{
+    (void) cache;
+    int start = *(int *) seq->state;
+    realizations++;
+    seq->items = gc_malloc(&gc, 2 * sizeof(Value *));
+    seq->items[0] = value_new_int(start);
+    seq->items[1] = value_new_int(start + 1);
+    seq->count = 2;
+    seq->rest = NULL;
+    if (start + 2 < 10) {
+        int *next = gc_malloc(&gc, sizeof(int));
+        *next = start + 2;
+        seq->rest = value_new_lazy_seq(count_realize, next, true);
+    }
+    return true;
+}
+
+static char *test_seq_iter()
+{
+    int *start = gc_malloc(&gc, sizeof(int));
+    *start = 0;
+    Value *seq = value_new_lazy_seq(count_realize, start, true);
+    SeqIter it;
+    Value *v;
+
+    /* without caching the sequence stays unrealized */
+    seq_iter_init(&it, seq, false);
+    for (int i = 0; i < 10; ++i) {
+        mu_assert(seq_iter_next(&it, &v) && INT(v) == i, "Unexpected element");
+    }
+    mu_assert(!seq_iter_next(&it, &v), "Expected end of sequence");
+    mu_assert(!LAZY_SEQ(seq)->realized, "Private walk must not realize in place");
+    mu_assert(realizations == 5, "Expected one realization per chunk");
+
+    /* caching realizes once, a second walk reuses the chunks */
+    seq_iter_init(&it, seq, true);
+    while (seq_iter_next(&it, &v));
+    seq_iter_init(&it, seq, true);
+    while (seq_iter_next(&it, &v));
+    mu_assert(LAZY_SEQ(seq)->realized, "Caching walk must realize in place");
+    mu_assert(realizations == 10, "Cached chunks must not be realized again");
+
+    /* the rest of a walk, in the middle of a chunk and of a list */
+    seq_iter_init(&it, seq, true);
+    seq_iter_next(&it, &v);
+    const List *rest = value_seq_list(seq_iter_rest(&it), true);
+    mu_assert(list_size(rest) == 9 && INT(list_head(rest)) == 1, "Wrong rest of chunk");
+    seq_iter_init(&it, value_new_list(rest), true);
+    seq_iter_next(&it, &v);
+    seq_iter_next(&it, &v);
+    Value *tail = seq_iter_rest(&it);
+    mu_assert(is_list(tail) && list_size(LIST(tail)) == 7, "Wrong rest of list");
+
+    /* chunks continue with their rest */
+    Value *items[1] = { value_new_int(-1) };
+    Value *chunk = value_new_chunk(items, 1, tail);
+    seq_iter_init(&it, chunk, false);
+    mu_assert(seq_iter_next(&it, &v) && INT(v) == -1, "Expected chunk element");
+    mu_assert(seq_iter_next(&it, &v) && INT(v) == 3, "Expected rest element");
+
+    seq_iter_init(&it, VALUE_CONST_NIL, true);
+    mu_assert(!seq_iter_next(&it, &v), "nil is empty");
+    return 0;
+}
+
 int tests_run = 0;
 
 static char *test_suite()
@@ -155,6 +248,8 @@ static char *test_suite()
     int bos;
     gc_start(&gc, &bos);
     mu_run_test(test_list);
+    mu_run_test(test_list_builder);
+    mu_run_test(test_seq_iter);
     gc_stop(&gc);
     return 0;
 }
@@ -24,6 +24,14 @@ static char *test_map()
     mu_assert(value != NULL, "Query must find key");
     mu_assert(strcmp(value, "other") == 0, "Query must return updated value");
 
+    // keys must match exactly, not just by prefix
+    map_put(ht, "k", "short", strlen("short") + 1);
+    value = (char *) map_get(ht, "key");
+    mu_assert(strcmp(value, "other") == 0, "Query must not match a prefix of the key");
+    value = (char *) map_get(ht, "ke");
+    mu_assert(value == NULL, "Query must not match a longer key");
+    map_remove(ht, "k");
+
     // delete item
     map_remove(ht, "key");
     value = (char *) map_get(ht, "key");
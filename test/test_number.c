@@ -0,0 +1,157 @@
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+
+#include "../src/number.c"
+
+static bool same_double(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static char *test_number_parse()
+{
+    mu_assert(number_parse_int("0", 1) == 0, "Expect 0");
+    mu_assert(number_parse_int("-17", 3) == -17, "Expect -17");
+    mu_assert(number_parse_int("1234567890", 10) == 1234567890, "Expect 1234567890");
+    mu_assert(number_parse_int("-2147483648", 11) == -2147483647 - 1, "Expect INT_MIN");
+    mu_assert(number_parse_int("42)", 2) == 42, "Only the slice counts");
+
+    const char *source[] = {
+        "0.0", "-0.0", "1.", "-.7", "3.14159", "0.1", "0.3",
+        "123456789012345678.5",           /* more than 19 digits */
+        "9007199254740993.0",             /* halfway, rounds to even */
+        "0.000000000000000000000000000001",
+        "179769313486231570000000000000000000000000000000000000000000000000"
+        "000000000000000000000000000000000000000000000000000000000000000000"
+        "000000000000000000000000000000000000000000000000000000000000000000"
+        "000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000.0",  /* DBL_MAX */
+    };
+    for (size_t k = 0; k < sizeof(source) / sizeof(source[0]); ++k) {
+        double expected = strtod(source[k], NULL);
+        double actual = number_parse_float(source[k], strlen(source[k]));
+        mu_assert(same_double(expected, actual), "Float differs from strtod");
+    }
+    mu_assert(number_parse_float("2.5e", 3) == 2.5, "Only the slice counts");
+
+    /* random digit strings, long enough to leave the fast paths */
+    char buf[64];
+    srand(42);
+    for (size_t round = 0; round < 100000; ++round) {
+        size_t n = 0;
+        if (rand() % 2) buf[n++] = '-';
+        size_t int_digits = rand() % 20, frac_digits = rand() % 30;
+        for (size_t i = 0; i < int_digits; ++i) buf[n++] = '0' + rand() % 10;
+        buf[n++] = '.';
+        for (size_t i = 0; i < frac_digits; ++i) buf[n++] = '0' + rand() % 10;
+        buf[n] = '\0';
+        if (int_digits + frac_digits == 0) continue;
+        mu_assert(same_double(strtod(buf, NULL), number_parse_float(buf, n)),
+                  "Random float differs from strtod");
+    }
+    return 0;
+}
+
+static char *test_number_format()
+{
+    struct {
+        double value;
+        const char *text;
+    } cases[] = {
+        { 0.0, "0.0" },
+        { -0.0, "-0.0" },
+        { 1.0, "1.0" },
+        { -2.5, "-2.5" },
+        { 0.1, "0.1" },
+        { 0.1 + 0.2, "0.30000000000000004" },
+        { 100.0, "100.0" },
+        { 123456.789, "123456.789" },
+        { 1e-7, "0.0000001" },
+        { 1e21, "1000000000000000000000.0" },
+        { 1.0 / 3.0, "0.3333333333333333" },
+        { 5e-324, NULL },
+        { DBL_MAX, NULL },
+        { 1.0 / 0.0, "inf" },
+        { -1.0 / 0.0, "-inf" },
+    };
+    char buf[NUMBER_FLOAT_BUFSIZE];
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+        size_t n = number_format_float(cases[k].value, buf);
+        mu_assert(n == strlen(buf), "Wrong length");
+        if (cases[k].text) {
+            mu_assert(strcmp(buf, cases[k].text) == 0, "Unexpected float format");
+        } else {
+            mu_assert(same_double(number_parse_float(buf, n), cases[k].value),
+                      "Extreme float does not round-trip");
+        }
+    }
+
+    /* random bit patterns read back as the same double, and no shorter
+     * representation does */
+    srand(42);
+    for (size_t round = 0; round < 100000; ++round) {
+        uint64_t bits = ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+        bits ^= (uint64_t) (rand() % 4096) << 52;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value == 0.0 || value != value || value - value != 0.0) continue;
+        size_t n = number_format_float(value, buf);
+        mu_assert(same_double(strtod(buf, NULL), value), "Float does not round-trip");
+
+        size_t digits = 0;
+        const char *first = strpbrk(buf, "123456789");
+        for (const char *p = first; p < buf + n; ++p) {
+            if (*p != '.') digits++;
+        }
+        for (const char *p = buf + n - 1; *p == '0' || *p == '.'; --p) {
+            if (*p == '0') digits--;
+        }
+        char shorter[32];
+        snprintf(shorter, sizeof(shorter), "%.*e", (int) digits - 2, value);
+        mu_assert(digits == 1 || strtod(shorter, NULL) != value,
+                  "Float format is not the shortest");
+    }
+    return 0;
+}
+
+static char *test_number_format_int()
+{
+    int64_t values[] = {
+        0, 7, -7, 10, 99, 100, -12345, 2147483647, -2147483647 - 1,
+        INT64_MAX, INT64_MIN
+    };
+    char expected[32], buf[NUMBER_INT_BUFSIZE];
+    for (size_t k = 0; k < sizeof(values) / sizeof(values[0]); ++k) {
+        snprintf(expected, sizeof(expected), "%lld", (long long) values[k]);
+        size_t n = number_format_int(values[k], buf);
+        mu_assert(strcmp(buf, expected) == 0, "Unexpected integer format");
+        mu_assert(n == strlen(expected), "Wrong length");
+    }
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_number_parse);
+    mu_run_test(test_number_format);
+    mu_run_test(test_number_format_int);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Number tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
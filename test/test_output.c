@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "minunit.h"
+
+#include "../src/output.c"
+
+/* bytes that can be read from fd without blocking */
+static size_t pending(int fd, char *buf, size_t n)
+{
+    ssize_t r = read(fd, buf, n);
+    return r < 0 ? 0 : (size_t) r;
+}
+
+static char *test_output_block()
+{
+    int fds[2];
+    mu_assert(pipe(fds) == 0, "Failed to open pipe");
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    char buf[64];
+
+    Output out;
+    output_init(&out, fds[1]);
+    mu_assert(out.policy == OUTPUT_FLUSH_BLOCK, "Pipes should be block buffered");
+    output_write(&out, "line 1\nline 2\n", 14);
+    mu_assert(pending(fds[0], buf, sizeof(buf)) == 0, "Output should be buffered");
+    output_flush(&out);
+    size_t n = pending(fds[0], buf, sizeof(buf));
+    mu_assert(n == 14 && memcmp(buf, "line 1\nline 2\n", n) == 0,
+              "Flush should write the buffered output");
+
+    /* filling the buffer writes it out */
+    for (size_t i = 0; i < OUTPUT_BUFFER_SIZE / 4; ++i) {
+        output_write(&out, "x", 1);
+    }
+    mu_assert(pending(fds[0], buf, sizeof(buf)) == 0, "Output should be buffered");
+    output_destroy(&out);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+static char *test_output_line()
+{
+    int fds[2];
+    mu_assert(pipe(fds) == 0, "Failed to open pipe");
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    char buf[64];
+
+    Output out;
+    output_init(&out, fds[1]);
+    out.policy = OUTPUT_FLUSH_LINE;
+    output_write(&out, "partial", 7);
+    mu_assert(pending(fds[0], buf, sizeof(buf)) == 0, "Partial lines should be buffered");
+    output_write(&out, " line\n", 6);
+    size_t n = pending(fds[0], buf, sizeof(buf));
+    mu_assert(n == 13 && memcmp(buf, "partial line\n", n) == 0,
+              "Complete lines should be written");
+    output_destroy(&out);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+static void *print_b(void *arg)
+{
+    (void) arg;
+    output_write(output_stdout(), "b\n", 2);
+    return NULL;
+}
+
+#define PRINT_LINES 20000
+
+static void *print_lines(void *arg)
+{
+    const char *line = arg;
+    for (size_t i = 0; i < PRINT_LINES; ++i) {
+        output_write(output_stdout(), line, strlen(line));
+    }
+    return NULL;
+}
+
+static char *test_output_threads()
+{
+    /* stdout goes to a file, so it is block buffered */
+    char path[] = "/tmp/test_output_XXXXXX";
+    int fd = mkstemp(path);
+    mu_assert(fd >= 0, "Failed to create a temporary file");
+    unlink(path);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+
+    /* output appears in the order it was printed, across threads */
+    pthread_t t;
+    output_write(output_stdout(), "a\n", 2);
+    pthread_create(&t, NULL, print_b, NULL);
+    pthread_join(t, NULL);
+    output_write(output_stdout(), "c\n", 2);
+
+    /* concurrent prints never mix within a write */
+    pthread_t t1, t2;
+    pthread_create(&t1, NULL, print_lines, "first thread\n");
+    pthread_create(&t2, NULL, print_lines, "second thread\n");
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+    output_flush(output_stdout());
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    size_t size = lseek(fd, 0, SEEK_END);
+    char *buf = malloc(size + 1);
+    mu_assert(pread(fd, buf, size, 0) == (ssize_t) size, "Failed to read the output");
+    buf[size] = '\0';
+    close(fd);
+    mu_assert(strncmp(buf, "a\nb\nc\n", 6) == 0, "Output should be in program order");
+    size_t first = 0, second = 0;
+    for (char *line = strtok(buf + 6, "\n"); line; line = strtok(NULL, "\n")) {
+        if (strcmp(line, "first thread") == 0) {
+            first++;
+        } else if (strcmp(line, "second thread") == 0) {
+            second++;
+        } else {
+            free(buf);
+            mu_assert(false, "Concurrent output should not interleave");
+        }
+    }
+    free(buf);
+    mu_assert(first == PRINT_LINES && second == PRINT_LINES,
+              "No output should be lost");
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_output_block);
+    mu_run_test(test_output_line);
+    mu_run_test(test_output_threads);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Output tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -27,6 +27,308 @@ static char *test_parser()
     return 0;
 }
 
+static bool values_equal(const Value *a, const Value *b)
+{
+    if (a == NULL || b == NULL || a->type != b->type) {
+        return a == b;
+    }
+    switch (a->type) {
+    case VALUE_INT:
+        return INT(a) == INT(b);
+    case VALUE_FLOAT:
+        return FLOAT(a) == FLOAT(b);
+    case VALUE_STRING:
+    case VALUE_SYMBOL:
+        return strcmp(STRING(a), STRING(b)) == 0;
+    case VALUE_LIST: {
+        if (list_size(LIST(a)) != list_size(LIST(b))) return false;
+        ListItem *x = LIST(a)->head, *y = LIST(b)->head;
+        for (; x && y; x = x->next, y = y->next) {
+            if (!values_equal(x->val, y->val)) return false;
+        }
+        return true;
+    }
+    default:
+        return a == b;
+    }
+}
+
+static char *test_parser_bulk()
+{
+    char *source[] = {
+        "1",
+        "(fn 3 4 1)",
+        "(a/b -main - 3 -2.5 -.7)",
+        "'(1 `(2 ~x ~@y))",
+        "(\"a;b\" ; \"not a string\n  \"esc \\\" \\\\\" \"multi\nline\")",
+        "(\"a\"b c\"d\")",
+        "; only a comment\n(x) ; trailing",
+        "(list 1 2",
+        "(list 1 2))",
+        "(1a)",
+        "(\"unterminated)",
+        "(~)",
+        "(a\\b)",
+    };
+    for (size_t k = 0; k < sizeof(source) / sizeof(source[0]); ++k) {
+        size_t n = strlen(source[k]);
+        Value *expected = NULL, *actual = NULL;
+        ParseResult r1 = parser_parse_buffer(source[k], n, &expected);
+        ParseResult r2 = parser_parse_bulk(source[k], n, &actual);
+        mu_assert(r1 == r2, "Bulk parser result differs");
+        mu_assert(values_equal(expected, actual), "Bulk parser value differs");
+    }
+
+    /*
+     * long enough to push strings, escapes and comments across blocks and
+     * windows of the tape, with a string and a comment longer than two windows
+     */
+    const char *items[] = {
+        "(sym-%zu %zu -%zu.5 \"s\\\\%zu\\\"\") ",
+        "; comment %zu \"\n",
+        "\"%zu;(\\\\\" ",
+        "'(%zu ~@x)\n"
+    };
+    size_t capacity = 1 << 20;
+    char *buf = malloc(capacity);
+    size_t n = 0;
+    n += sprintf(buf, "(");
+    for (size_t i = 0; n < capacity - 128; ++i) {
+        if (i == 1000 || i == 1001) {
+            size_t length = 2 * PARSER_TAPE_WINDOW + 100;
+            memset(buf + n, 'x', length);
+            buf[n] = i == 1000 ? '"' : ';';
+            buf[n + length - 1] = i == 1000 ? '"' : '\n';
+            n += length;
+        }
+        n += sprintf(buf + n, items[i % 4], i, i, i, i);
+    }
+    n += sprintf(buf + n, ")");
+    Value *expected = NULL, *actual = NULL;
+    mu_assert(parser_parse_buffer(buf, n, &expected) == PARSER_SUCCESS,
+              "Failed to parse bulk test input");
+    mu_assert(parser_parse_bulk(buf, n, &actual) == PARSER_SUCCESS,
+              "Bulk parser failed");
+    mu_assert(values_equal(expected, actual), "Bulk parser value differs");
+    free(buf);
+    return 0;
+}
+
+static char *test_parser_deep()
+{
+    /* nesting that would exhaust the C stack of a recursive parser */
+    size_t depth = 200000;
+    char *buf = malloc(2 * depth + 2);
+    memset(buf, '(', depth);
+    buf[depth] = 'x';
+    memset(buf + depth + 1, ')', depth);
+    buf[2 * depth + 1] = '\0';
+    Value *ast = NULL;
+    mu_assert(parser_parse_buffer(buf, 2 * depth + 1, &ast) == PARSER_SUCCESS,
+              "Failed to parse deeply nested list");
+    for (size_t i = 0; i < depth; ++i) {
+        mu_assert(is_list(ast) && list_size(LIST(ast)) == 1, "Wrong nesting");
+        ast = (Value *) list_head(LIST(ast));
+    }
+    mu_assert(is_symbol(ast) && strcmp(STRING(ast), "x") == 0,
+              "Wrong innermost value");
+
+    /* nested quotes */
+    memset(buf, '\'', depth);
+    buf[depth] = 'x';
+    mu_assert(parser_parse_buffer(buf, depth + 1, &ast) == PARSER_SUCCESS,
+              "Failed to parse nested quotes");
+    for (size_t i = 0; i < depth; ++i) {
+        mu_assert(is_list(ast) && list_size(LIST(ast)) == 2, "Wrong quote");
+        ast = (Value *) list_nth(LIST(ast), 1);
+    }
+    mu_assert(is_symbol(ast), "Wrong quoted value");
+    free(buf);
+
+    /* a single very long list keeps its order */
+    size_t length = 200000;
+    buf = malloc(8 * length);
+    size_t n = sprintf(buf, "(");
+    for (size_t i = 0; i < length; ++i) {
+        n += sprintf(buf + n, "%zu ", i);
+    }
+    n += sprintf(buf + n, ")");
+    mu_assert(parser_parse_buffer(buf, n, &ast) == PARSER_SUCCESS,
+              "Failed to parse long list");
+    mu_assert(list_size(LIST(ast)) == length, "Long list has the wrong size");
+    size_t i = 0;
+    for (ListItem *item = LIST(ast)->head; item; item = item->next, ++i) {
+        mu_assert(INT(item->val) == (int) i, "Long list is out of order");
+    }
+    free(buf);
+    return 0;
+}
+
+static char *test_parser_write()
+{
+    /* forms that print exactly as they are written */
+    char *source[] = {
+        "1",
+        "-2.5",
+        "(fn 3 4 0.1)",
+        "(lambda (a) (+ 1 a))",
+        "(quote (() (1 (2 (3))) x))",
+        "(:a (:b-c x) :d)",
+    };
+    StrBuf out;
+    for (size_t k = 0; k < sizeof(source) / sizeof(source[0]); ++k) {
+        Value *ast = NULL;
+        mu_assert(parser_parse_buffer(source[k], strlen(source[k]), &ast) == PARSER_SUCCESS,
+                  "Failed to parse");
+        strbuf_init(&out);
+        value_write(&out, ast);
+        mu_assert(strcmp(strbuf_cstr(&out), source[k]) == 0, "Unexpected output");
+        strbuf_destroy(&out);
+    }
+
+    /* keywords are interned */
+    Value *ast = NULL;
+    mu_assert(parser_parse_buffer("(:k :k)", 7, &ast) == PARSER_SUCCESS, "Failed to parse");
+    mu_assert(list_head(LIST(ast)) == list_nth(LIST(ast), 1), "Expected one keyword instance");
+
+    /* deep nesting prints without recursion */
+    size_t depth = 200000;
+    char *buf = malloc(2 * depth + 2);
+    memset(buf, '(', depth);
+    buf[depth] = 'x';
+    memset(buf + depth + 1, ')', depth);
+    buf[2 * depth + 1] = '\0';
+    mu_assert(parser_parse_buffer(buf, 2 * depth + 1, &ast) == PARSER_SUCCESS,
+              "Failed to parse deeply nested list");
+    strbuf_init(&out);
+    value_write(&out, ast);
+    mu_assert(strcmp(strbuf_cstr(&out), buf) == 0, "Unexpected deep output");
+    strbuf_destroy(&out);
+    free(buf);
+    return 0;
+}
+
+static char *test_parser_stream()
+{
+    char source[] =
+        "; leading comment\n"
+        "(def a \"(not a list;\\\"\")\n"
+        "  42 sym'(1 2) \"s\"\n"
+        "~@(x) `(a ~b)\n"
+        "(multi\n"
+        "  line) ; trailing comment\n"
+        "~@x \"a string that spans more than one line and one block of the\n"
+        "structural index\" last";
+    const char *expected[] = {
+        "(def a \"(not a list;\\\"\")",
+        "42", "sym", "'(1 2)", "\"s\"", "~@(x)", "`(a ~b)",
+        "(multi\n  line)", "~@x",
+        "\"a string that spans more than one line and one block of the\n"
+        "structural index\"", "last"
+    };
+    FILE *stream = fmemopen(source, strlen(source), "r");
+    mu_assert(stream != NULL, "Failed to open stream");
+    ParserStream *ps = parser_stream_new(stream);
+    for (size_t k = 0; k < sizeof(expected) / sizeof(expected[0]); ++k) {
+        Value *form = NULL, *reference = NULL;
+        mu_assert(parser_stream_next(ps, &form) == PARSER_SUCCESS,
+                  "Failed to read form from stream");
+        parser_parse_buffer(expected[k], strlen(expected[k]), &reference);
+        mu_assert(values_equal(form, reference), "Unexpected form from stream");
+    }
+    Value *form = NULL;
+    mu_assert(parser_stream_next(ps, &form) == PARSER_EOF, "Expected EOF");
+    mu_assert(parser_stream_next(ps, &form) == PARSER_EOF, "EOF must be sticky");
+    parser_stream_delete(ps);
+    fclose(stream);
+
+    /* errors are reported per form, the stream stays usable */
+    char broken[] = "(a b\n)) 3 \"c";
+    stream = fmemopen(broken, strlen(broken), "r");
+    ps = parser_stream_new(stream);
+    mu_assert(parser_stream_next(ps, &form) == PARSER_SUCCESS, "Expected (a b)");
+    mu_assert(parser_stream_next(ps, &form) == PARSER_FAIL, "Expected stray paren");
+    mu_assert(ps->form_line == 2, "Wrong line for stray paren");
+    mu_assert(parser_stream_next(ps, &form) == PARSER_SUCCESS, "Expected 3");
+    mu_assert(form->type == VALUE_INT && INT(form) == 3, "Expected 3");
+    mu_assert(parser_stream_next(ps, &form) == PARSER_FAIL, "Expected incomplete form");
+    mu_assert(parser_stream_next(ps, &form) == PARSER_EOF, "Expected EOF");
+    parser_stream_delete(ps);
+    fclose(stream);
+    return 0;
+}
+
+static char *test_parser_stream_batch()
+{
+    /*
+     * many small batches, with an error in the middle, read form by form
+     * and built ahead on a pool
+     */
+    size_t capacity = 1 << 20;
+    char *source = malloc(capacity);
+    size_t n = 0;
+    for (size_t i = 0; n < capacity - 128; ++i) {
+        if (i == 5000) {
+            n += sprintf(source + n, "(oops))\n");
+        }
+        if (i == 7000) {
+            // forms longer than a batch
+            n += sprintf(source + n, "\"%0*d\" (", 3000, 0);
+            for (size_t k = 0; k < 500; ++k) {
+                n += sprintf(source + n, "x%zu ", k);
+            }
+            n += sprintf(source + n, ")\n");
+        }
+        n += sprintf(source + n, "(rec %zu \"s;%zu\" '(a ~@b)) ; c\n%zu\n", i, i, i);
+    }
+
+    FILE *a = fmemopen(source, n, "r");
+    FILE *b = fmemopen(source, n, "r");
+    FILE *c = fmemopen(source, n, "r");
+    ParserStream *serial = parser_stream_new(a);
+    ParserStream *batched = parser_stream_new(b);
+    ParserStream *parallel = parser_stream_new(c);
+    mu_assert(serial->batch == NULL, "Memory streams should not be batched");
+    batched->batch = parser_batch_new();
+    batched->batch->read = 1000;
+    batched->batch->parallel = SIZE_MAX;
+    parallel->batch = parser_batch_new();
+    parallel->batch->read = 1000;
+    parallel->batch->parallel = 0;
+    parallel->batch->pool = pool_new(interp_current(), 4);
+
+    size_t forms = 0;
+    ParseResult r1, r2, r3;
+    do {
+        Value *expected = NULL, *actual = NULL, *ahead = NULL;
+        r1 = parser_stream_next(serial, &expected);
+        r2 = parser_stream_next(batched, &actual);
+        r3 = parser_stream_next(parallel, &ahead);
+        mu_assert(r1 == r2, "Batched stream result differs");
+        mu_assert(values_equal(expected, actual), "Batched stream value differs");
+        mu_assert(serial->form_line == batched->form_line, "Line numbers differ");
+        mu_assert(r1 == r3, "Parallel stream result differs");
+        mu_assert(values_equal(expected, ahead), "Parallel stream value differs");
+        mu_assert(serial->form_line == parallel->form_line,
+                  "Parallel stream line numbers differ");
+        forms++;
+    } while (r1 != PARSER_EOF);
+    mu_assert(forms > 10000, "Expected more forms");
+    mu_assert(parallel->batch->ahead || parallel->batch->n_forms < 2,
+              "Large batches should be built ahead");
+
+    Pool *pool = parallel->batch->pool;
+    parser_stream_delete(serial);
+    parser_stream_delete(batched);
+    parser_stream_delete(parallel);
+    pool_delete(pool);
+    fclose(a);
+    fclose(b);
+    fclose(c);
+    free(source);
+    return 0;
+}
+
 int tests_run = 0;
 
 static char *test_suite()
@@ -34,6 +336,11 @@ static char *test_suite()
     int bos;
     gc_start(&gc, &bos);
     mu_run_test(test_parser);
+    mu_run_test(test_parser_bulk);
+    mu_run_test(test_parser_deep);
+    mu_run_test(test_parser_write);
+    mu_run_test(test_parser_stream);
+    mu_run_test(test_parser_stream_batch);
     gc_stop(&gc);
     return 0;
 }
@@ -0,0 +1,184 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "minunit.h"
+
+#include "../src/pool.c"
+
+static char *test_pool_deque()
+{
+    PoolDeque d;
+    pool_deque_init(&d);
+    PoolTask tasks[3 * POOL_DEQUE_CAPACITY];
+    size_t n = sizeof(tasks) / sizeof(tasks[0]);
+    mu_assert(pool_deque_take(&d) == NULL, "New deque should be empty");
+    for (size_t i = 0; i < n; ++i) {
+        pool_deque_push(&d, &tasks[i]);
+    }
+    mu_assert(atomic_load(&d.buffer)->capacity >= (long) n, "Deque must grow");
+    bool retry = false;
+    mu_assert(pool_deque_steal(&d, &retry) == &tasks[0], "Thieves take the oldest task");
+    mu_assert(pool_deque_take(&d) == &tasks[n - 1], "The owner takes the newest task");
+    for (size_t i = n - 2; i > 0; --i) {
+        mu_assert(pool_deque_take(&d) == &tasks[i], "The owner takes tasks in LIFO order");
+    }
+    mu_assert(pool_deque_take(&d) == NULL, "Deque should be empty");
+    mu_assert(pool_deque_steal(&d, &retry) == NULL && !retry, "Nothing left to steal");
+    pool_deque_destroy(&d);
+    return 0;
+}
+
+#define N_TASKS 10000
+
+static atomic_long counter;
+static atomic_bool counted;
+static Pool *pool;
+
+static void count(void *arg)
+{
+    (void) arg;
+    if (atomic_fetch_add(&counter, 1) + 1 == N_TASKS) {
+        atomic_store(&counted, true);
+    }
+}
+
+static char *test_pool_tasks()
+{
+    atomic_init(&counter, 0);
+    atomic_init(&counted, false);
+    for (size_t i = 0; i < N_TASKS; ++i) {
+        pool_submit(pool, count, NULL);
+    }
+    pool_wait(pool, &counted);
+    mu_assert(atomic_load(&counter) == N_TASKS, "Every task must run once");
+    return 0;
+}
+
+/* each task below depth 0 submits two more from a worker */
+typedef struct {
+    int depth;
+    atomic_long *leaves;
+} Tree;
+
+static atomic_bool grown;
+#define TREE_DEPTH 12
+
+static void grow(void *arg)
+{
+    Tree *t = arg;
+    if (t->depth == 0) {
+        if (atomic_fetch_add(t->leaves, 1) + 1 == 1 << TREE_DEPTH) {
+            atomic_store(&grown, true);
+        }
+    } else {
+        for (int i = 0; i < 2; ++i) {
+            Tree *child = malloc(sizeof(Tree));
+            child->depth = t->depth - 1;
+            child->leaves = t->leaves;
+            pool_submit(pool, grow, child);
+        }
+    }
+    free(t);
+}
+
+static char *test_pool_nested()
+{
+    atomic_long leaves;
+    atomic_init(&leaves, 0);
+    atomic_init(&grown, false);
+    Tree *root = malloc(sizeof(Tree));
+    root->depth = TREE_DEPTH;
+    root->leaves = &leaves;
+    pool_submit(pool, grow, root);
+    pool_wait(pool, &grown);
+    mu_assert(atomic_load(&leaves) == 1 << TREE_DEPTH, "Tasks submitted by tasks must run");
+    return 0;
+}
+
+/* tasks building chains on the shared heap while the root collects */
+typedef struct Link {
+    struct Link *next;
+    long value;
+} Link;
+
+#define N_CHAINS 16
+#define CHAIN_LENGTH 20000
+
+static atomic_long chains_done;
+static atomic_bool chained;
+static long chain_sums[N_CHAINS];
+
+static void chain(void *arg)
+{
+    long id = (long) (intptr_t) arg;
+    Link *head = NULL;
+    for (long i = 0; i < CHAIN_LENGTH; ++i) {
+        Link *link = heap_malloc(sizeof(Link));
+        link->next = head;
+        link->value = i;
+        head = link;
+        // garbage in between, so that collections have work to do
+        heap_malloc(3 * sizeof(Link));
+        if (i % 1000 == 0) {
+            heap_safepoint();
+        }
+    }
+    long sum = 0;
+    for (Link *link = head; link; link = link->next) {
+        sum += link->value;
+    }
+    chain_sums[id] = sum;
+    if (atomic_fetch_add(&chains_done, 1) + 1 == N_CHAINS) {
+        atomic_store(&chained, true);
+    }
+}
+
+static char *test_pool_heap()
+{
+    atomic_init(&chains_done, 0);
+    atomic_init(&chained, false);
+    for (long i = 0; i < N_CHAINS; ++i) {
+        pool_submit(pool, chain, (void *) (intptr_t) i);
+    }
+    // collect while the tasks allocate, instead of helping them
+    while (!atomic_load(&chained)) {
+        heap_collect();
+    }
+    heap_collect();
+    for (long i = 0; i < N_CHAINS; ++i) {
+        mu_assert(chain_sums[i] == (long) CHAIN_LENGTH * (CHAIN_LENGTH - 1) / 2,
+                  "Collections must keep what workers still use");
+    }
+    mu_assert(atomic_load(&interp_current()->allocated) == 0,
+              "Collections must count allocations from zero");
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    int bos;
+    gc_start(&gc, &bos);
+    pool = pool_new(interp_current(), 4);
+    mu_run_test(test_pool_deque);
+    mu_run_test(test_pool_tasks);
+    mu_run_test(test_pool_nested);
+    mu_run_test(test_pool_heap);
+    pool_delete(pool);
+    gc_stop(&gc);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Pool tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+
+#include "../src/scan.c"
+
+static char *test_scan_index()
+{
+    const char *src = "(ab \"c;\\\"d\" ; e\n'x ~@y)";
+    /* "@y" is a single run of atom characters, the parser splits it */
+    size_t expected[] = { 0, 1, 4, 10, 16, 17, 19, 20, 22 };
+    size_t n = sizeof(expected) / sizeof(expected[0]);
+
+    ScanIndex *idx = scan_index_new();
+    scan_index_build(idx, src, strlen(src));
+    mu_assert(idx->size == n, "Unexpected number of index entries");
+    for (size_t i = 0; i < n; ++i) {
+        mu_assert(idx->offsets[i] == expected[i], "Unexpected index entry");
+    }
+
+    /* rebuilding resets the index */
+    scan_index_build(idx, "", 0);
+    mu_assert(idx->size == 0, "Empty input should have an empty index");
+    scan_index_delete(idx);
+    return 0;
+}
+
+static char *test_scan_blocks()
+{
+    /* strings, escapes and comments that straddle block boundaries */
+    char src[3 * SCAN_BLOCK + 1];
+    memset(src, ' ', sizeof(src));
+    src[3 * SCAN_BLOCK] = '\0';
+    src[60] = '"';
+    src[63] = '\\';           /* escapes the quote that opens block 2 */
+    src[64] = '"';
+    src[70] = '"';            /* closes the string */
+    src[120] = ';';           /* comment hides the quote in block 3 */
+    src[130] = '"';
+    src[140] = '\n';
+    src[150] = 'x';
+
+    ScanIndex *idx = scan_index_new();
+    scan_index_build(idx, src, strlen(src));
+    mu_assert(idx->size == 3, "Unexpected number of index entries");
+    mu_assert(idx->offsets[0] == 60, "Wrong opening quote");
+    mu_assert(idx->offsets[1] == 70, "Wrong closing quote");
+    mu_assert(idx->offsets[2] == 150, "Wrong atom start");
+    scan_index_delete(idx);
+    return 0;
+}
+
+static char *test_scan_extend()
+{
+    /* growing and dropping input in odd steps indexes like a full build */
+    char src[1024];
+    const char alphabet[] = "\"\\ \n()'~;ab@";
+    srand(7);
+    for (size_t i = 0; i < sizeof(src); ++i) {
+        src[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+    ScanIndex *full = scan_index_new();
+    scan_index_build(full, src, sizeof(src));
+
+    ScanIndex *idx = scan_index_new();
+    size_t dropped = 0, entries = 0;
+    for (size_t n = 0; n < sizeof(src); ) {
+        n += 1 + rand() % 100;
+        if (n > sizeof(src)) {
+            n = sizeof(src);
+        }
+        scan_index_extend(idx, src + dropped, n - dropped);
+        size_t drop = idx->scanned / 2;
+        entries += scan_index_drop(idx, drop);
+        dropped += drop;
+    }
+    mu_assert(entries + idx->size == full->size, "Wrong number of entries");
+    for (size_t i = 0; i < idx->size; ++i) {
+        mu_assert(idx->offsets[i] + dropped == full->offsets[entries + i],
+                  "Entries differ from a full build");
+    }
+    scan_index_delete(idx);
+    scan_index_delete(full);
+    return 0;
+}
+
+static char *test_scan_tape()
+{
+    const char *src = "(ab \"c;\\\"d\" \"e\" ; f\n'x ~@y ~@ `z ~q \"open";
+    ScanToken expected[] = {
+        { SCAN_LPAREN, 0, 1 },
+        { SCAN_ATOM, 1, 2 },
+        { SCAN_ESCAPED_STRING, 5, 5 },
+        { SCAN_STRING, 13, 1 },
+        { SCAN_QUOTE, 20, 1 },
+        { SCAN_ATOM, 21, 1 },
+        { SCAN_SPLICE_UNQUOTE, 23, 2 },
+        { SCAN_ATOM, 25, 1 },
+        { SCAN_SPLICE_UNQUOTE, 27, 2 },
+        { SCAN_QUASIQUOTE, 30, 1 },
+        { SCAN_ATOM, 31, 1 },
+        { SCAN_UNQUOTE, 33, 1 },
+        { SCAN_ATOM, 34, 1 },
+        { SCAN_OPEN_STRING, 37, 4 }
+    };
+    size_t n = sizeof(expected) / sizeof(expected[0]);
+
+    ScanTape *tape = scan_tape_new();
+    scan_tape_build(tape, src, strlen(src));
+    mu_assert(tape->size == n, "Unexpected number of tape tokens");
+    for (size_t i = 0; i < n; ++i) {
+        mu_assert(tape->tokens[i].kind == expected[i].kind, "Wrong token kind");
+        mu_assert(tape->tokens[i].offset == expected[i].offset, "Wrong token offset");
+        mu_assert(tape->tokens[i].length == expected[i].length, "Wrong token length");
+    }
+    scan_tape_delete(tape);
+    return 0;
+}
+
+static char *test_scan_tape_extend()
+{
+    /* growing and dropping input in odd steps gives the tape of a full build */
+    char src[4096];
+    const char alphabet[] = "\"\\ \n()'~;ab@";
+    srand(11);
+    for (size_t i = 0; i < sizeof(src); ++i) {
+        src[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+    ScanTape *full = scan_tape_new();
+    scan_tape_build(full, src, sizeof(src));
+
+    ScanTape *tape = scan_tape_new();
+    size_t dropped = 0, tokens = 0;
+    for (size_t n = 0; n < sizeof(src); ) {
+        n += 1 + rand() % 300;
+        if (n > sizeof(src)) {
+            n = sizeof(src);
+        }
+        scan_tape_extend(tape, src + dropped, n - dropped);
+        // keep the last two tokens: one may be open, and a '~' may still
+        // become a "~@"
+        size_t keep = tape->size > 1 ? tape->size - 2 : 0;
+        size_t drop = keep < tape->size ? tape->tokens[keep].offset : tape->scanned;
+        drop = drop > 0 ? drop - 1 : 0;
+        tokens += scan_tape_drop(tape, drop);
+        dropped += drop;
+    }
+    scan_tape_finish(tape, src + dropped, sizeof(src) - dropped);
+    mu_assert(tokens + tape->size == full->size, "Wrong number of tokens");
+    for (size_t i = 0; i < tape->size; ++i) {
+        const ScanToken *a = &tape->tokens[i], *b = &full->tokens[tokens + i];
+        mu_assert(a->kind == b->kind && a->offset + dropped == b->offset
+                  && a->length == b->length, "Tokens differ from a full build");
+    }
+    scan_tape_delete(tape);
+    scan_tape_delete(full);
+    return 0;
+}
+
+static char *test_scan_classify()
+{
+    /* the vectorized classifier must agree with the scalar one */
+    const char alphabet[] = "\"\\ \t\r\n()'`~;ab1-@";
+    unsigned char block[SCAN_BLOCK];
+    ScanClassifyFn classify = scan_classifier();
+    srand(42);
+    for (size_t round = 0; round < 1000; ++round) {
+        for (size_t i = 0; i < SCAN_BLOCK; ++i) {
+            block[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        ScanMasks a, b;
+        scan_classify_scalar(block, &a);
+        classify(block, &b);
+        mu_assert(memcmp(&a, &b, sizeof(ScanMasks)) == 0,
+                  "Classifiers disagree");
+    }
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_scan_index);
+    mu_run_test(test_scan_blocks);
+    mu_run_test(test_scan_extend);
+    mu_run_test(test_scan_tape);
+    mu_run_test(test_scan_tape_extend);
+    mu_run_test(test_scan_classify);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ Scan tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}
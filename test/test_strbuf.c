@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+
+#include "../src/strbuf.c"
+
+static char *test_strbuf()
+{
+    StrBuf b;
+    strbuf_init(&b);
+    mu_assert(strcmp(strbuf_cstr(&b), "") == 0, "New buffer should be empty");
+
+    strbuf_puts(&b, "(a");
+    strbuf_putc(&b, ' ');
+    strbuf_append(&b, "bcd", 2);
+    strbuf_putc(&b, ')');
+    mu_assert(strcmp(strbuf_cstr(&b), "(a bc)") == 0, "Unexpected contents");
+    mu_assert(b.size == 6, "Unexpected size");
+
+    for (size_t i = 0; i < 10000; ++i) {
+        strbuf_putc(&b, 'x');
+    }
+    mu_assert(b.size == 10006, "Buffer should grow");
+    mu_assert(strlen(strbuf_cstr(&b)) == 10006, "Contents should be terminated");
+    strbuf_destroy(&b);
+    mu_assert(b.data == NULL && b.size == 0, "Destroyed buffer should be reset");
+    return 0;
+}
+
+static char *test_strbuf_fd()
+{
+    /* more than fits into the buffer, in small and oversized pieces */
+    size_t capacity = 1024;
+    size_t n = 3 * capacity;
+    char *big = malloc(capacity + 1);
+    memset(big, 'y', capacity + 1);
+
+    FILE *fp = tmpfile();
+    mu_assert(fp != NULL, "Failed to open temporary file");
+    StrBuf b;
+    strbuf_init_fd(&b, fileno(fp), capacity);
+    for (size_t i = 0; i < n; ++i) {
+        strbuf_putc(&b, 'a' + i % 26);
+    }
+    strbuf_append(&b, big, capacity + 1);
+    strbuf_puts(&b, "end");
+    mu_assert(b.capacity == capacity, "Streaming buffer must not grow");
+    mu_assert(b.size == 3, "Only the tail should be pending");
+    strbuf_destroy(&b);
+
+    rewind(fp);
+    for (size_t i = 0; i < n; ++i) {
+        mu_assert(fgetc(fp) == 'a' + (int) (i % 26), "Output out of order");
+    }
+    for (size_t i = 0; i <= capacity; ++i) {
+        mu_assert(fgetc(fp) == 'y', "Oversized append out of order");
+    }
+    char tail[5] = { 0 };
+    mu_assert(fread(tail, 1, 4, fp) == 3 && strcmp(tail, "end") == 0,
+              "Missing tail");
+    fclose(fp);
+    free(big);
+    return 0;
+}
+
+int tests_run = 0;
+
+static char *test_suite()
+{
+    mu_run_test(test_strbuf);
+    mu_run_test(test_strbuf_fd);
+    return 0;
+}
+
+int main()
+{
+    printf("---=[ StrBuf tests\n");
+    char *result = test_suite();
+    if (result != 0) {
+        printf("%s\n", result);
+    } else {
+        printf("ALL TESTS PASSED\n");
+    }
+    printf("Tests run: %d\n", tests_run);
+    return result != 0;
+}